@@ -45,9 +45,16 @@
 #include "LED.h"
 #include "TimersManager.h"
 #include "FunctionLib.h"
+#include "Flash_Adapter.h"
+#include "MemManager.h"
 #include "shell.h"
 #include "Panic.h"
 #include "PWR_Interface.h"
+#include "fsl_os_abstraction.h"
+#ifdef FSL_RTOS_FREE_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
 
 /* BLE Host Stack */
 #include "gatt_interface.h"
@@ -66,48 +73,212 @@
 
 #include "string.h"
 #include "stdlib.h"
+#include "stdio.h"
 #include "ApplMain.h"
 #include "app.h"
 #include "fsl_gpio.h"
 #include "fsl_port.h"
 
+#include "node_common.h"
+
 /************************************************************************************
 *************************************************************************************
 * Private macros
 *************************************************************************************
 ************************************************************************************/
 
-#define CUSTOM_CMD_SOURCE				0
-#define CUSTOM_CMD_DEST					1
-#define CUSTOM_CMD_FUNC					2
-#define CUSTOM_CMD_POLL_ITVL_0			3
-#define CUSTOM_CMD_POLL_ITVL_1			4
-#define CUSTOM_CMD_POLL_ITVL_2			5
-#define CUSTOM_CMD_POLL_ITVL_3			6
-#define CUSTOM_CMD_POWER_CTRL			7
-#define CUSTOM_CMD_VAL_ID				8
-#define CUSTOM_CMD_VAL_0				9
-#define CUSTOM_CMD_VAL_1				10
-#define CUSTOM_CMD_VAL_2				11
-#define CUSTOM_CMD_VAL_3				12
-
-#define CUSTOM_CMD_TEMP_ID				1
-#define CUSTOM_CMD_LIGHT_ID				2
-
-#define CUSTOM_CMD_SYS_AWAKE			1
-#define CUSTOM_CMD_SYS_SLEEP			2
-
-#define CUSTOM_CMD_START_DATA			1
-#define CUSTOM_CMD_STOP_DATA			2
-
 #define UART_TX_IND_GPIO GPIOA
 #define UART_TX_IND_GPIO_PIN 18U
 
+/* Node store is indexed directly by the 8 bit node ID */
+#define mNodeStoreSize_c				256
+
+/* Binary telemetry channel framing */
+#define mTelemetrySof_c					0x7E
+#define mTelemetryNodeSnapshot_c		0x01
+#define mTelemetryTopology_c			0x02
+
+#define mNodeSnapshotRecordSize_c		17
+
+/* mLinkReporter entry of a link measured by the Comm itself */
+#define mLinkStatsLocal_c				0xFF
+
+/* Outgoing frames kept from one send to the next, see Frame_Init */
+#define mFrameConfig_c					0	/* configuration for the relays */
+#define mFrameTimeSync_c				1	/* mesh time broadcast */
+#define mFrameLeafConfig_c				2	/* batch configuration for the leaves */
+#define mFrameNeighbor_c				3	/* neighbor queries and the Comm's hellos */
+#define mFrameProbe_c					4	/* hop probes of a TTL tuning run */
+#define mFrameSegStatus_c				5	/* missing segments of the message being received */
+#define mFrameSlots_c					6
+
+/* Nodes whose energy counters are kept, besides the Comm's own */
+#define mEnergyTableSize_c				8
+
+/* Energy model behind the mJ per reading estimate: KW41Z at 3 V, 0 dBm, custom data
+   advertised on three channels and the receiver scanning whenever the node is awake */
+#define mEnergyPerSend_uJ				30
+#define mEnergyPerTxByte_nJ				440
+#define mEnergyPerUartByte_nJ			800
+#define mEnergyAwake_uW					20000
+#define mEnergyAsleep_uW				6
+
+/* Leaf oversampling filter limits, see CUSTOM_CMD_FILTER_CONFIG; leaves sample on their
+   scheduler ticks, so the period is a multiple of mSchedTick_ms */
+#define mFilterMaxTaps_c				8
+#define mFilterMinPeriod_ms				mSchedTick_ms
+
+/* TTL tuning probes with the Comm's own TTL stepped up to mTtlProbeMax_c, waiting
+   mTtlProbeWait_ms per step, then sets each node to its hop distance plus a margin */
+#define mTtlProbeMax_c					8
+#define mTtlProbeWait_ms				1500
+#define mTtlMargin_c					1
+#define mTtlSetInterval_ms				250
+#define mTtlUnknown_c					0xFF
+
+/* Neighbor discovery, timed as on the nodes. The Comm makes the hello cycle as long as the
+   highest node ID it knows, so every node keeps a slot of its own and a discovery
+   puts at most one hello per slot and one report chunk per mNeighborChunkGap_ms on air */
+#define mHelloMinSlots_c				16
+#define mNeighborReportMargin_ms		2000
+
+/* Neighbor graph: directed edges (reporter heard neighbor) and node sets as bitmaps */
+#define mTopoMaxEdges_c					1024
+#define mTopoSetWords_c					(mNodeStoreSize_c / 32)
+
+#define mTopoIdle_c						0
+#define mTopoHello_c					1	/* the Comm's hellos going out */
+#define mTopoCollect_c					2	/* waiting for neighbor reports */
+#define mTopoApply_c					3	/* one relay state set per tick */
+
+/* Relay planning in automatic mode: rediscovery period, delay after hearing a node for
+   the first time, and pace of the relay state sets */
+#define mRelayPlanPeriod_ms				600000
+#define mRelayPlanJoinDelay_ms			5000
+#define mRelaySetInterval_ms			250
+
+/* The Comm's uptime is mesh time; a beacon with it goes out this often */
+#define mTimeSyncPeriod_ms				30000
+
+/* Entries asked for by a history query without a count */
+#define mHistoryDefaultCount_c			32
+
+/* Unacknowledged configuration frames are resent this often, this many times */
+#define mConfigRetryTimeout_ms			2000
+#define mConfigMaxRetries_c				3
+
+/* A silent gap this long makes the receiver report missing segments, at most this often */
+#define mSegRxGap_ms					600
+#define mSegRxMaxStatus_c				4
+
+/* Layout of the Comm's settings_t record, see Settings_Read */
+#define mSettingsVersion_c				3	/* bump when settings_t changes layout */
+
 /************************************************************************************
 *************************************************************************************
 * Private type definitions
 *************************************************************************************
 ************************************************************************************/
+/* Shell configuration kept across resets, so get commands and change detection match
+   what the relay and leaves restored on their side */
+typedef struct settings_tag
+{
+    settingsHeader_t header;
+    uint8_t     dataTx;
+    uint32_t    dataPollRate;
+    uint32_t    tempSenPollRate;
+    uint32_t    lightSenPollRate;
+    uint32_t    tempSenPollMax;
+    uint32_t    lightSenPollMax;
+    uint16_t    batchBudget_sec;
+    uint16_t    filterPeriod_ms;
+    uint8_t     batchSize;
+    uint8_t     filterKind;
+    uint8_t     filterTaps;
+    uint8_t     filterDecim;
+    uint8_t     tempSenPowSt;
+    uint8_t     lightSenPowSt;
+    uint8_t     batchAcked;
+} settings_t;
+
+/* Message being reassembled; aReceived bit n is set once segment n is in aData */
+typedef struct segRx_tag
+{
+    uint8_t     aData[mSegMaxMessage_c];
+    uint8_t     aReceived[mSegBitmapSize_c];
+    uint16_t    length;
+    uint8_t     source;
+    uint8_t     msgId;
+    uint8_t     count;
+    uint8_t     received;
+    uint8_t     statusLeft;
+    bool_t      active;
+} segRx_t;
+
+/* Energy counters last reported by other nodes, in CUSTOM_CMD_ENERGY_* order */
+typedef struct energyTable_tag
+{
+    uint32_t    aCounters[mEnergyTableSize_c][CUSTOM_CMD_ENERGY_COUNTERS];
+    uint8_t     aId[mEnergyTableSize_c];
+} energyTable_t;
+
+/* Handles one received custom data frame, selected by its CUSTOM_CMD_FUNC */
+typedef void (*pfCustomDataHandler_t)(meshCustomData_t* pFrame);
+
+/* Per-node telemetry, kept as parallel arrays so a scan over one field stays in cache */
+typedef struct nodeStore_tag
+{
+    int32_t     aLatest[CUSTOM_CMD_NUM_SENSORS][mNodeStoreSize_c];
+    uint32_t    aTimestamp_ms[mNodeStoreSize_c];	/* when the latest reading was taken */
+    uint16_t    aPacketCount[mNodeStoreSize_c];
+    uint16_t    aGapCount[mNodeStoreSize_c];
+    uint8_t     aSensorMask[mNodeStoreSize_c];
+    uint8_t     aSeqMask[mNodeStoreSize_c];		/* sensors recorded under aLastSeq */
+    uint8_t     aLastSeq[mNodeStoreSize_c];
+} nodeStore_t;
+
+/* TTL tuning run: aHops is 0 for nodes not probed and mTtlUnknown_c until one answers */
+typedef struct ttlTune_tag
+{
+    uint8_t     aHops[mNodeStoreSize_c];
+    uint8_t     probeTtl;       /* TTL of the current probe round */
+    uint8_t     savedTtl;       /* the Comm's TTL before the run */
+    uint16_t    nextId;         /* next node to set while bProbing is FALSE */
+    bool_t      bRunning;
+    bool_t      bProbing;
+} ttlTune_t;
+
+/* Neighbor graph from the last discovery round, as an edge list: node aFrom[n] heard
+   aQuality[n] percent of the hellos of node aTo[n]. Node sets are bitmaps by node ID. */
+typedef struct topology_tag
+{
+    uint8_t     aFrom[mTopoMaxEdges_c];
+    uint8_t     aTo[mTopoMaxEdges_c];
+    uint8_t     aQuality[mTopoMaxEdges_c];
+    uint8_t     aHelloHeard[mNodeStoreSize_c];     /* hellos the Comm itself heard */
+    uint32_t    aNodes[mTopoSetWords_c];
+    uint32_t    aCanRelay[mTopoSetWords_c];        /* nodes that may take the relay role */
+    uint32_t    aRelays[mTopoSetWords_c];          /* connected dominating set, with the Comm */
+    uint32_t    aUncovered[mTopoSetWords_c];       /* nodes no relay or Comm reaches */
+    uint16_t    edgeCount;
+    uint16_t    edgesDropped;
+    uint8_t     round;
+    uint8_t     slots;
+    uint8_t     state;
+    uint8_t     hellosSent;
+    bool_t      bPlan;                              /* plan relays when the round is over */
+} topology_t;
+
+/* Relay planning state; relay states set are remembered by node ID, so a new plan
+   only touches the nodes whose role changes */
+typedef struct relayPlan_tag
+{
+    uint32_t    aRelayOn[mTopoSetWords_c];
+    uint32_t    aRelayKnown[mTopoSetWords_c];
+    uint32_t    aHeard[mTopoSetWords_c];           /* nodes the Comm has had a frame from */
+    uint16_t    next;                               /* next node ID to apply */
+    bool_t      bAuto;                              /* rediscover periodically and when nodes join */
+} relayPlan_t;
 
 /************************************************************************************
 *************************************************************************************
@@ -123,11 +294,57 @@ static bool_t 	mDataTxStatus = FALSE;
 static uint32_t mDataPollRate = 10;
 static uint32_t mTempSenPollRate = 5;
 static uint32_t mLightSenPollRate = 5;
+static uint32_t mTempSenPollMax = 0;
+static uint32_t mLightSenPollMax = 0;
 static bool_t 	mTempSenPowSt = TRUE;
 static bool_t 	mLightSenPowSt = TRUE;
+static uint8_t 	mBatchSize = 1;
+static uint16_t mBatchBudget_sec = 0;
+static bool_t 	mBatchAcked = FALSE;
+static uint8_t 	mFilterKind = CUSTOM_CMD_FILTER_NONE;
+static uint8_t 	mFilterTaps = 1;
+static uint16_t mFilterPeriod_ms = 500;
+static uint8_t 	mFilterDecim = 1;
+
+static const uint8_t mSensorScale[CUSTOM_CMD_NUM_SENSORS] =
+{
+    CUSTOM_CMD_TEMP_SCALE,
+    CUSTOM_CMD_LIGHT_SCALE
+};
+
+static nodeStore_t mNodeStore;
+static energyTable_t mEnergyTable;
 
-uint32_t mTempLatVal = 0;
-uint32_t mLightLatVal = 0;
+static linkStats_t mLinkStats;
+static uint8_t mLinkReporter[mLinkStatsSize_c];    /* mLinkStatsLocal_c or ID of the relay that measured it */
+
+static uint8_t mTelemetryChecksum;
+
+static tmrTimerID_t mConfigRetryTimerId;
+static meshCustomData_t mConfigPending;
+static meshAddress_t mConfigPendingDest;
+static meshCustomData_t mFrames[mFrameSlots_c];
+static uint8_t mConfigRetries;
+static uint32_t mConfigAcked[mTopoSetWords_c];     /* relays that acknowledged a group configuration */
+static uint32_t mConfigExpected[mTopoSetWords_c];  /* relays a group configuration waits for */
+
+/* Relays that have forwarded leaf reports */
+static uint32_t mAggregators[mTopoSetWords_c];
+/* Relays in CUSTOM_CMD_RELAY_GROUP, from neighbor reports and group acknowledgements */
+static uint32_t mRelayGroup[mTopoSetWords_c];
+
+static tmrTimerID_t mSegRxTimerId;
+static segRx_t mSegRx;
+
+static tmrTimerID_t mTimeSyncTimerId;
+static uint8_t mTimeEpoch;
+
+static tmrTimerID_t mTtlTuneTimerId;
+static ttlTune_t mTtlTune;
+
+static tmrTimerID_t mTopologyTimerId;
+static topology_t mTopology;
+static relayPlan_t mRelayPlan;
 
 /************************************************************************************
 *************************************************************************************
@@ -167,6 +384,84 @@ int8_t ShellMesh_DataTransfer(uint8_t argc, char * argv[]);
 int8_t ShellMesh_DataPollRate(uint8_t argc, char * argv[]);
 int8_t ShellMesh_SenPollRate(uint8_t argc, char * argv[]);
 int8_t ShellMesh_SenPower(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Stats(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Links(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Batch(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Energy(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Mem(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Filter(uint8_t argc, char * argv[]);
+int8_t ShellMesh_History(uint8_t argc, char * argv[]);
+int8_t ShellMesh_Topo(uint8_t argc, char * argv[]);
+
+static void NodeStore_Update(uint8_t id, uint8_t valId, int32_t value, uint8_t seq, uint32_t time_ms);
+static void TimeSync_Send(void);
+static void TimeSyncTimerCallback(void* param);
+static uint32_t TimeSync_Resolve(uint16_t stamp);
+static bool_t TtlTune_Start(void);
+static void TtlTune_Probe(void);
+static void TtlTuneTimerCallback(void* param);
+static void CustomData_HandleHopProbe(meshCustomData_t* pFrame);
+static bool_t Topology_Discover(bool_t plan);
+static void Topology_SendHello(void);
+static void TopologyTimerCallback(void* param);
+static void Topology_AddEdge(uint8_t from, uint8_t to, uint8_t quality);
+static void Topology_Neighbors(uint8_t id, uint32_t* pSet);
+static bool_t Topology_Has(uint32_t* pSet, uint8_t id);
+static void Topology_Add(uint32_t* pSet, uint8_t id);
+static uint16_t Topology_Count(uint32_t* pSet);
+static void Topology_Print(void);
+static void Topology_Export(void);
+static void RelayPlan_Seen(uint8_t id);
+static void RelayPlan_Compute(void);
+static bool_t RelayPlan_Apply(void);
+static void CustomData_HandleHello(meshCustomData_t* pFrame);
+static void CustomData_HandleNeighborReport(meshCustomData_t* pFrame);
+static void NodeStore_Print(uint8_t id);
+static void NodeStore_Export(void);
+
+static uint16_t LinkStats_LossPermille(uint8_t id);
+
+static void ShellMesh_PrintValue(int32_t value, uint8_t scale);
+
+static void Telemetry_Begin(uint8_t type, uint16_t length);
+static void Telemetry_Write(uint8_t* pData, uint16_t length);
+static void Telemetry_End(void);
+
+static void Config_Send(meshAddress_t destination, meshCustomData_t* pFrame);
+static void CustomData_SendPowerConfig(uint8_t valId, uint8_t state);
+static void CustomData_SendIntervalConfig(uint8_t valId, uint32_t min_sec, uint32_t max_sec);
+static void ConfigRetryTimerCallback(void* param);
+static void CustomData_SendStartData(void);
+static void CustomData_SendBatchConfig(uint8_t dest);
+static void CustomData_Dispatch(meshCustomData_t* pFrame);
+static void CustomData_HandleSensorData(meshCustomData_t* pFrame);
+static void CustomData_HandleSegment(meshCustomData_t* pFrame);
+static void CustomData_HandleMessage(uint8_t source, uint8_t* pData, uint16_t length);
+static void Segment_SendStatus(void);
+static void SegmentRxTimerCallback(void* param);
+static void LinkStats_Import(uint8_t reporter, uint8_t* pRecords, uint16_t length);
+static void History_Print(uint8_t source, uint8_t* pData, uint16_t length);
+static void CustomData_HandleConfigAck(meshCustomData_t* pFrame);
+static void CustomData_HandleEnergyReport(meshCustomData_t* pFrame);
+static void CustomData_HandleMemReport(meshCustomData_t* pFrame);
+static void Mem_Print(uint8_t id, meshCustomData_t* pFrame);
+static void Energy_Print(uint8_t id, uint32_t* pCounters);
+static bool_t Settings_Load(void);
+static void Settings_Save(void);
+static void Settings_Capture(settings_t* pRecord);
+static void Settings_Apply(settings_t* pRecord);
+
+static const pfCustomDataHandler_t mCustomDataHandlers[CUSTOM_CMD_FUNC_COUNT] =
+{
+    [CUSTOM_CMD_SENSOR_DATA] = CustomData_HandleSensorData,
+    [CUSTOM_CMD_CONFIG_ACK] = CustomData_HandleConfigAck,
+    [CUSTOM_CMD_SEGMENT] = CustomData_HandleSegment,
+    [CUSTOM_CMD_ENERGY_REPORT] = CustomData_HandleEnergyReport,
+    [CUSTOM_CMD_MEM_REPORT] = CustomData_HandleMemReport,
+    [CUSTOM_CMD_HOP_PROBE] = CustomData_HandleHopProbe,
+    [CUSTOM_CMD_HELLO] = CustomData_HandleHello,
+    [CUSTOM_CMD_NEIGHBOR_REPORT] = CustomData_HandleNeighborReport,
+};
 
 void delay(uint32_t count);
 
@@ -201,8 +496,10 @@ const cmd_tbl_t mMeshRelayCmd =
     .cmd = ShellMesh_Relay,
     .help = "Usage:\r\n"
         ">>> relay get ID\r\n"
-        ">>> relay set ID value\r\n",
-    .usage = "Get/set Relay state for a node ID."
+        ">>> relay set ID value\r\n"
+        ">>> relay auto\r\n"
+        ">>> relay auto off\r\n",
+    .usage = "Get/set Relay state for a node ID, or keep only a connected set of relays enabled."
 };
 const cmd_tbl_t mMeshTtlCmd =
 {
@@ -212,8 +509,9 @@ const cmd_tbl_t mMeshTtlCmd =
     .cmd = ShellMesh_Ttl,
     .help = "Usage:\r\n"
         ">>> ttl get ID\r\n"
-        ">>> ttl set ID value\r\n",
-    .usage = "Get/set TTL value for a node ID."
+        ">>> ttl set ID value\r\n"
+        ">>> ttl auto\r\n",
+    .usage = "Get/set TTL value for a node ID, or set every known node's TTL from its measured hop distance."
 };
 const cmd_tbl_t mMeshLightCmd =
 {
@@ -271,17 +569,19 @@ const cmd_tbl_t mMeshCustomDataPollRateCmd =
 const cmd_tbl_t mMeshCustomSenPollRateCmd =
 {
     .name = "senpollrt",
-    .maxargs = 4,
+    .maxargs = 5,
     .repeatable = 1,
     .cmd = ShellMesh_SenPollRate,
     .help = "Usage:\r\n"
         ">>> senpollrt get sen_type\r\n"
     	">>> senpollrt set sen_type time_val_in_seconds\r\n"
+    	">>> senpollrt set sen_type min_in_seconds max_in_seconds\r\n"
     	">>> senpollrt get temp\r\n"
     	">>> senpollrt set temp time_val_in_seconds\r\n"
+    	">>> senpollrt set temp 5 120\r\n"
        	">>> senpollrt get light\r\n"
        	">>> senpollrt set light time_val_in_seconds\r\n",
-    .usage = "Set Sensor data poll rate time in seconds."
+    .usage = "Set Sensor data poll rate time in seconds; with a maximum leaves adapt it to the signal."
 };
 
 const cmd_tbl_t mMeshCustomSenPower =
@@ -302,6 +602,114 @@ const cmd_tbl_t mMeshCustomSenPower =
     .usage = "Set Sensor Power status."
 };
 
+const cmd_tbl_t mMeshStatsCmd =
+{
+    .name = "stats",
+    .maxargs = 2,
+    .repeatable = 1,
+    .cmd = ShellMesh_Stats,
+    .help = "Usage:\r\n"
+        ">>> stats\r\n"
+        ">>> stats all\r\n"
+        ">>> stats ID\r\n"
+        ">>> stats export\r\n",
+    .usage = "Show the latest telemetry per node or export it on the binary channel."
+};
+
+const cmd_tbl_t mMeshLinksCmd =
+{
+    .name = "links",
+    .maxargs = 2,
+    .repeatable = 1,
+    .cmd = ShellMesh_Links,
+    .help = "Usage:\r\n"
+        ">>> links\r\n"
+        ">>> links refresh\r\n",
+    .usage = "Rank links by loss rate; refresh pulls leaf link and rate limit counters from the relays."
+};
+
+const cmd_tbl_t mMeshBatchCmd =
+{
+    .name = "batch",
+    .maxargs = 5,
+    .repeatable = 1,
+    .cmd = ShellMesh_Batch,
+    .help = "Usage:\r\n"
+        ">>> batch get\r\n"
+        ">>> batch set samples budget_in_seconds\r\n"
+        ">>> batch set samples budget_in_seconds ID\r\n"
+        ">>> batch set 4 30\r\n"
+        ">>> batch ack on|off\r\n"
+        ">>> batch ack on|off ID\r\n",
+    .usage = "Set how many samples leaves hold per report, the longest a sample may wait and whether reports are resent until acknowledged."
+};
+
+const cmd_tbl_t mMeshEnergyCmd =
+{
+    .name = "energy",
+    .maxargs = 3,
+    .repeatable = 1,
+    .cmd = ShellMesh_Energy,
+    .help = "Usage:\r\n"
+        ">>> energy\r\n"
+        ">>> energy refresh\r\n"
+        ">>> energy refresh ID\r\n",
+    .usage = "Show radio, UART and awake time counters per node with estimated mJ per reading."
+};
+
+const cmd_tbl_t mMeshMemCmd =
+{
+    .name = "mem",
+    .maxargs = 2,
+    .repeatable = 1,
+    .cmd = ShellMesh_Mem,
+    .help = "Usage:\r\n"
+        ">>> mem\r\n"
+        ">>> mem ID\r\n",
+    .usage = "Show buffer pool peaks, allocation failures and stack use, with the pool sizes they suggest."
+};
+
+const cmd_tbl_t mMeshFilterCmd =
+{
+    .name = "filter",
+    .maxargs = 7,
+    .repeatable = 1,
+    .cmd = ShellMesh_Filter,
+    .help = "Usage:\r\n"
+        ">>> filter get\r\n"
+        ">>> filter set none|avg|median taps period_in_ms decimation\r\n"
+        ">>> filter set none|avg|median taps period_in_ms decimation ID\r\n"
+        ">>> filter set median 5 200 5\r\n",
+    .usage = "Set how leaves oversample and filter readings before reporting them."
+};
+
+const cmd_tbl_t mMeshHistoryCmd =
+{
+    .name = "history",
+    .maxargs = 4,
+    .repeatable = 1,
+    .cmd = ShellMesh_History,
+    .help = "Usage:\r\n"
+        ">>> history ID\r\n"
+        ">>> history ID count\r\n"
+        ">>> history ID from_entry count\r\n"
+        ">>> history 112 0 100\r\n",
+    .usage = "Read back readings a leaf logged to flash, e.g. to fill a gap after an outage."
+};
+
+const cmd_tbl_t mMeshTopoCmd =
+{
+    .name = "topo",
+    .maxargs = 2,
+    .repeatable = 1,
+    .cmd = ShellMesh_Topo,
+    .help = "Usage:\r\n"
+        ">>> topo\r\n"
+        ">>> topo scan\r\n"
+        ">>> topo export\r\n",
+    .usage = "Discover which node hears which, show the neighbor graph or export it on the binary channel."
+};
+
 /************************************************************************************
 *************************************************************************************
 * Public functions
@@ -314,6 +722,7 @@ const cmd_tbl_t mMeshCustomSenPower =
 ********************************************************************************** */
 void BleApp_Init(void)
 {      
+    Mem_TrackMainTask();
         /* UI */
     shell_init("BLE MESH >>> ");
     shell_register_function((cmd_tbl_t *)&mMeshPublishCmd);
@@ -326,6 +735,14 @@ void BleApp_Init(void)
     shell_register_function((cmd_tbl_t *)&mMeshCustomDataPollRateCmd);
     shell_register_function((cmd_tbl_t *)&mMeshCustomSenPollRateCmd);
     shell_register_function((cmd_tbl_t *)&mMeshCustomSenPower);
+    shell_register_function((cmd_tbl_t *)&mMeshStatsCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshLinksCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshBatchCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshEnergyCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshMemCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshFilterCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshHistoryCmd);
+    shell_register_function((cmd_tbl_t *)&mMeshTopoCmd);
 #if 0
     gpio_pin_config_t pin_config;
     port_pin_config_t i2c_pin_config = {0};
@@ -402,6 +819,20 @@ void BleApp_GenericCallback (gapGenericEvent_t* pGenericEvent)
 static void AppConfig()
 {
     mAppTimerId = TMR_AllocateTimer();
+    mConfigRetryTimerId = TMR_AllocateTimer();
+    Frame_Init(&mFrames[mFrameConfig_c], CUSTOM_CMD_DEST_RELAYS, 0, 0);
+    Frame_Init(&mFrames[mFrameLeafConfig_c], 0, CUSTOM_CMD_BATCH_CONFIG, CUSTOM_CMD_BATCH_CONFIG_LEN);
+    mSegRxTimerId = TMR_AllocateTimer();
+    Frame_Init(&mFrames[mFrameSegStatus_c], 0, CUSTOM_CMD_SEG_STATUS, CUSTOM_CMD_SEG_STATUS_LEN);
+    mTimeSyncTimerId = TMR_AllocateTimer();
+    Frame_Init(&mFrames[mFrameTimeSync_c], CUSTOM_CMD_DEST_ALL, CUSTOM_CMD_TIME_SYNC, CUSTOM_CMD_TIME_SYNC_LEN);
+    mTtlTuneTimerId = TMR_AllocateTimer();
+    Frame_Init(&mFrames[mFrameProbe_c], 0, CUSTOM_CMD_HOP_PROBE, CUSTOM_CMD_HOP_PROBE_LEN);
+    mTopologyTimerId = TMR_AllocateTimer();
+    Frame_Init(&mFrames[mFrameNeighbor_c], CUSTOM_CMD_DEST_ALL, CUSTOM_CMD_HELLO, CUSTOM_CMD_HELLO_LEN);
+
+    NV_Init();
+    Settings_Load();
 	
     MeshConfigClient_RegisterCallback(MeshConfigClientCallback);
     MeshLightClient_RegisterCallback(MeshLightClientCallback);
@@ -429,8 +860,15 @@ static meshResult_t MeshGenericCallback
         case gMeshInitComplete_c:
             {
                 shell_write("\r\n\r\nMesh Commissioner initialization complete!\r\n");
+                if (mDataTxStatus)
+                {
+                    shell_printf("Data transfer resumed from saved settings, every %d s\r\n", mDataPollRate);
+                }
                 shell_refresh();
 
+                TimeSync_Send();
+                TMR_StartIntervalTimer(mTimeSyncTimerId, mTimeSyncPeriod_ms, TimeSyncTimerCallback, NULL);
+
             	StopLed1Flashing();
             	StopLed2Flashing();
             	StopLed3Flashing();
@@ -440,56 +878,11 @@ static meshResult_t MeshGenericCallback
             break;
             
         case gMeshCustomDataReceived_c:
-			{
-				/*
-                shell_printf("\r\n -> Received Custom Data: Source: %d\r\n",
-                		pEvent->eventData.customDataReceived.source);
-                shell_printf("Data is: ");
-                for(int i = 0; i<pEvent->eventData.customDataReceived.data.dataLength && i<gMeshMaxAppCustomDataSize_c;
-                		i++)
-                {
-                	shell_printf("0x%x ",pEvent->eventData.customDataReceived.data.aData[i]);
-                }
-                shell_printf("\r\n");
-				*/
-				if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_SOURCE] == 22) // Comm is source
-				{
-
-					 mDataPollRate = (uint32_t)(
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_0]));
-
-					if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] == CUSTOM_CMD_TEMP_ID)
-					{
-						mTempLatVal = (uint32_t)(
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_3]<<24) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_2]<<16) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_1]<<8) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_0]));
-
-						shell_printf("Received Temp is: %d\r\n",mTempLatVal);
-
-					}
-					else if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] == CUSTOM_CMD_LIGHT_ID)
-					{
-						mLightLatVal = (uint32_t)(
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_3]<<24) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_2]<<16) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_1]<<8) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_0]));
-
-						shell_printf("Received Light is: %d\r\n",mLightLatVal);
-
-					}
-					else
-					{
-						shell_printf("Invalid Val type received: %d",pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] );
-					}
-				}
-			}
-			break;
+            {
+                gEnergyStats.rxFrames++;
+                CustomData_Dispatch(&pEvent->eventData.customDataReceived.data);
+            }
+            break;
 
         default:
             {
@@ -669,255 +1062,1583 @@ static meshResult_t MeshTemperatureClientCallback
     return gMeshSuccess_c;
 }
    
-int8_t ShellMesh_Publish(uint8_t argc, char * argv[])
+/*! *********************************************************************************
+* \brief        Hands a received frame to the handler of its function code.
+*
+* \param[in]    pFrame  Received custom data.
+********************************************************************************** */
+static void CustomData_Dispatch(meshCustomData_t* pFrame)
 {
-    if (argc > 4 || argc < 3)
+    uint8_t func = pFrame->aData[CUSTOM_CMD_FUNC];
+
+    Mem_Sample();
+
+    if ((pFrame->dataLength <= CUSTOM_CMD_FUNC) || (pFrame->dataLength > gMeshMaxAppCustomDataSize_c))
     {
-        return CMD_RET_USAGE;
+        return;
     }
-    
-    meshResult_t result;
-    if (argc == 3)
+
+    RelayPlan_Seen(pFrame->aData[CUSTOM_CMD_SOURCE]);
+
+    if ((func < CUSTOM_CMD_FUNC_COUNT) && mCustomDataHandlers[func])
     {
-        if (strcmp(argv[1], "get"))
-        {
-            return CMD_RET_USAGE;
-        }
-        int8_t id = atoi(argv[2]);
-        meshAddress_t destination = GetMeshAddressFromId(id);
-        result = MeshConfigClient_GetPublishAddress(destination, gMeshProfileLighting_c);
-        if (result == gMeshSuccess_c)
-        {
-            shell_printf("< Publish Get command sent to ID %d >", id);
-       }
-        else
-        {
-            shell_printf("< Cannot send command - Error code: 0x%04x >", result);
-        }
+        mCustomDataHandlers[func](pFrame);
     }
-    else /* argc == 4 */
+}
+
+static void CustomData_HandleSensorData(meshCustomData_t* pFrame)
+{
+    uint8_t relay = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t origin = pFrame->aData[CUSTOM_CMD_ORIGIN];
+    uint8_t seq = pFrame->aData[CUSTOM_CMD_SEQ];
+    uint8_t valId = pFrame->aData[CUSTOM_CMD_VAL_ID];
+    int32_t aSamples[mBatchMaxSamples_c];
+    uint8_t aValIds[mBatchMaxSamples_c];
+    uint32_t time_ms;
+    uint8_t count;
+
+    count = (valId == CUSTOM_CMD_MULTI_ID) ?
+            CustomData_UnpackMulti(pFrame, aValIds, aSamples) : CustomData_UnpackSamples(pFrame, aSamples);
+    if (!count)
     {
-        if (!strcmp(argv[1], "set"))
-        {
-            int8_t id = atoi(argv[2]);
-            int16_t add = atoi(argv[3]);
-            meshAddress_t destination = GetMeshAddressFromId(id);
-            result = MeshConfigClient_SetPublishAddress(destination, gMeshProfileLighting_c, add);
-            if (result == gMeshSuccess_c)
-            {
-                shell_printf("< Publish Set command sent to ID %d >", id);
-            }
-            else
-            {
-                shell_printf("< Cannot send command - Error code: 0x%04x >", result);
-            }
-        }
-        else
+        shell_printf("Malformed data frame from: %d\r\n", relay);
+        return;
+    }
+
+    /* The relay's own sequence number measures the relay to Comm hop */
+    mLinkReporter[relay] = mLinkStatsLocal_c;
+    Topology_Add(mAggregators, relay);
+    if (!LinkStats_Update(&mLinkStats, relay, pFrame->aData[CUSTOM_CMD_HOP_SEQ]))
+    {
+        return;
+    }
+
+    if ((valId != CUSTOM_CMD_TEMP_ID) && (valId != CUSTOM_CMD_LIGHT_ID) && (valId != CUSTOM_CMD_MULTI_ID))
+    {
+        shell_printf("Invalid Val type received: %d",valId);
+        return;
+    }
+
+    RelayPlan_Seen(origin);
+
+    /* The stamp dates the newest sample, which is the one the node store keeps */
+    time_ms = TimeSync_Resolve((uint16_t)(
+            (pFrame->aData[CUSTOM_CMD_STAMP_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_STAMP_0])));
+
+    if (valId == CUSTOM_CMD_MULTI_ID)
+    {
+        /* One reading of each sensor, all taken together */
+        for (uint8_t i = 0; i < count; i++)
         {
-            return CMD_RET_USAGE;
+            NodeStore_Update(origin, aValIds[i], aSamples[i], seq, time_ms);
+            shell_printf((aValIds[i] == CUSTOM_CMD_TEMP_ID) ? "Received Temp from %d is: " : "Received Light from %d is: ", origin);
+            ShellMesh_PrintValue(aSamples[i], mSensorScale[aValIds[i] - 1]);
+            shell_printf("\r\n");
         }
+        gEnergyStats.readings += count;
+        return;
     }
-    
-    if (result == gMeshSuccess_c)
+    for (uint8_t i = 0; i < count; i++)
     {
-        return CMD_RET_SUCCESS;
+        NodeStore_Update(origin, valId, aSamples[i], (uint8_t)(seq + i), time_ms);
     }
-    else
+    gEnergyStats.readings += count;
+    shell_printf((valId == CUSTOM_CMD_TEMP_ID) ? "Received Temp from %d is: " : "Received Light from %d is: ", origin);
+    ShellMesh_PrintValue(aSamples[count - 1], mSensorScale[valId - 1]);
+    if (count > 1)
     {
-        return CMD_RET_FAILURE;
+        shell_printf(" (%d samples)", count);
     }
+    shell_printf("\r\n");
 }
 
-int8_t ShellMesh_Subscribe(uint8_t argc, char * argv[])
+static void CustomData_HandleSegment(meshCustomData_t* pFrame)
 {
-        if (argc > 4 || argc < 3)
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t msgId = pFrame->aData[CUSTOM_CMD_SEG_MSG_ID];
+    uint8_t index = pFrame->aData[CUSTOM_CMD_SEG_INDEX];
+    uint8_t count = pFrame->aData[CUSTOM_CMD_SEG_COUNT];
+    uint8_t length = pFrame->dataLength - CUSTOM_CMD_SEG_DATA;
+
+    /* Every segment but the last is full */
+    if ((pFrame->dataLength <= CUSTOM_CMD_SEG_DATA) || (count == 0) || (count > mSegMaxCount_c) ||
+        (index >= count) || ((index != count - 1) && (length != mSegPayload_c)))
     {
-        return CMD_RET_USAGE;
+        shell_printf("Malformed segment from: %d\r\n", source);
+        return;
     }
-    
-    meshResult_t result;
-    if (argc == 3)
+
+    if ((mSegRx.source == source) && (mSegRx.msgId == msgId) && mSegRx.count && !mSegRx.active)
     {
-        if (strcmp(argv[1], "get"))
-        {
-            return CMD_RET_USAGE;
-        }
-        int8_t id = atoi(argv[2]);
-        meshAddress_t destination = GetMeshAddressFromId(id);
-        result = MeshConfigClient_GetSubscriptionList(destination, gMeshProfileLighting_c);
-        if (result == gMeshSuccess_c)
-        {
-            shell_printf("< Subscription List Get command sent to %d >", id);
-        }
-        else
+        /* A late copy of a delivered message only needs its completion repeated */
+        if (mSegRx.received == mSegRx.count)
         {
-            shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+            Segment_SendStatus();
+            return;
         }
+
+        /* The sender is still at a message that timed out here; carry on with the
+           segments already in */
+        mSegRx.active = TRUE;
     }
-    else /* argc == 4 */
+    else if (!mSegRx.active || (mSegRx.source != source) || (mSegRx.msgId != msgId))
     {
-        if (!strcmp(argv[1], "add"))
-        {
-            int8_t id = atoi(argv[2]);
-            int16_t add = atoi(argv[3]);
-            if (id != 0)
-            {
-                meshAddress_t destination = GetMeshAddressFromId(id);
-                result = MeshConfigClient_Subscribe(destination, gMeshProfileLighting_c, add);
-                if (result == gMeshSuccess_c)
-                {
-                    shell_printf("< Subscribe command sent to ID %d >", id);
-                }
-                else
-                {
-                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
-                }
-            }
-            else
-            {
-                result = Mesh_Subscribe(gMeshProfileLighting_c, add);
-                if (result == gMeshSuccess_c)
-                {
-                    shell_printf("< Subscribed local node to 0x%04X >", add);
-                }
-                else
-                {
-                    shell_printf("< Could not subscribe local node - Error code: 0x%04x >", result);
-                }
-            }
-            
-        }
-        else if (!strcmp(argv[1], "rem"))
-        {
-            int8_t id = atoi(argv[2]);
-            int16_t add = atoi(argv[3]);
-            if (id != 0)
-            {
-                meshAddress_t destination = GetMeshAddressFromId(id);
-                result = MeshConfigClient_Unsubscribe(destination, gMeshProfileLighting_c, add);
-                if (result == gMeshSuccess_c)
-                {
-                    shell_printf("< Unsubscribe command sent to ID %d >", id);
-                }
-                else
-                {
-                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
-                }
-            }
-            else
-            {
-                result = Mesh_Unsubscribe(gMeshProfileLighting_c, add);
-                if (result == gMeshSuccess_c)
-                {
-                    shell_printf("< Unsubscribed local node from 0x%04X >", add);
-                }
-                else
-                {
-                    shell_printf("< Could not unsubscribe local node - Error code: 0x%04x >", result);
-                }
-            }            
-        }
-        else
+        /* One message is reassembled at a time; a new one replaces it */
+        FLib_MemSet(mSegRx.aReceived, 0, sizeof(mSegRx.aReceived));
+        mSegRx.source = source;
+        mSegRx.msgId = msgId;
+        mSegRx.count = count;
+        mSegRx.received = 0;
+        mSegRx.length = 0;
+        mSegRx.active = TRUE;
+    }
+
+    if (!(mSegRx.aReceived[index >> 3] & (1 << (index & 7))) && (count == mSegRx.count))
+    {
+        FLib_MemCpy(&mSegRx.aData[(uint16_t)index * mSegPayload_c], &pFrame->aData[CUSTOM_CMD_SEG_DATA], length);
+        mSegRx.aReceived[index >> 3] |= (uint8_t)(1 << (index & 7));
+        mSegRx.received++;
+        if (index == count - 1)
         {
-            return CMD_RET_USAGE;
+            mSegRx.length = (uint16_t)index * mSegPayload_c + length;
         }
     }
-    
-    if (result == gMeshSuccess_c)
+    mSegRx.statusLeft = mSegRxMaxStatus_c;
+
+    if (mSegRx.received == mSegRx.count)
     {
-        return CMD_RET_SUCCESS;
+        TMR_StopTimer(mSegRxTimerId);
+        mSegRx.active = FALSE;
+        Segment_SendStatus();
+        CustomData_HandleMessage(mSegRx.source, mSegRx.aData, mSegRx.length);
+        return;
     }
-    else
+
+    TMR_StartSingleShotTimer(mSegRxTimerId, mSegRxGap_ms, SegmentRxTimerCallback, NULL);
+}
+
+static void SegmentRxTimerCallback(void* param)
+{
+    if (!mSegRx.active)
     {
-        return CMD_RET_FAILURE;
+        return;
+    }
+
+    if (!mSegRx.statusLeft)
+    {
+        shell_printf("\r\nMessage %d from %d incomplete: %d of %d segments\r\n",
+                mSegRx.msgId, mSegRx.source, mSegRx.received, mSegRx.count);
+        mSegRx.active = FALSE;
+        return;
     }
+
+    mSegRx.statusLeft--;
+    Segment_SendStatus();
+    TMR_StartSingleShotTimer(mSegRxTimerId, mSegRxGap_ms, SegmentRxTimerCallback, NULL);
 }
 
-int8_t ShellMesh_Relay(uint8_t argc, char * argv[])
+/*! *********************************************************************************
+* \brief        Tells the sender of the current message which segments are missing,
+*               starting from the first one; none missing confirms the message.
+********************************************************************************** */
+static void Segment_SendStatus(void)
 {
-    if (argc > 4 || argc < 3)
+    meshCustomData_t* pFrame = &mFrames[mFrameSegStatus_c];
+    uint16_t base = 0;
+
+    while ((base < mSegRx.count) && (mSegRx.aReceived[base >> 3] & (1 << (base & 7))))
     {
-        return CMD_RET_USAGE;
+        base++;
+    }
+
+    pFrame->aData[CUSTOM_CMD_DEST] = mSegRx.source;
+    pFrame->aData[CUSTOM_CMD_SEG_MSG_ID] = mSegRx.msgId;
+    pFrame->aData[CUSTOM_CMD_SEG_BASE] = (uint8_t)base;
+    FLib_MemSet(&pFrame->aData[CUSTOM_CMD_SEG_MISSING], 0, mSegWindow_c / 8);
+
+    for (uint8_t bit = 0; (bit < mSegWindow_c) && (base + bit < mSegRx.count); bit++)
+    {
+        uint16_t index = base + bit;
+
+        if (!(mSegRx.aReceived[index >> 3] & (1 << (index & 7))))
+        {
+            pFrame->aData[CUSTOM_CMD_SEG_MISSING + (bit >> 3)] |= (uint8_t)(1 << (bit & 7));
+        }
+    }
+
+    CustomData_Send(GetMeshAddressFromId(mSegRx.source), pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Handles a reassembled message by the type in its first byte.
+*
+* \param[in]    source  Node ID of the sender.
+* \param[in]    pData   Message.
+* \param[in]    length  Message length.
+********************************************************************************** */
+static void CustomData_HandleMessage(uint8_t source, uint8_t* pData, uint16_t length)
+{
+    switch (pData[0])
+    {
+        case CUSTOM_CMD_LINK_REPORT:
+            LinkStats_Import(source, &pData[1], length - 1);
+            break;
+
+        case CUSTOM_CMD_HISTORY_REPORT:
+            History_Print(source, pData, length);
+            break;
+
+        default:
+            shell_printf("Unknown message %d from: %d\r\n", pData[0], source);
+            break;
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Takes the per-leaf link counters measured by a relay.
+*
+* \param[in]    reporter    Node ID of the relay.
+* \param[in]    pRecords    CUSTOM_CMD_LINK_RECORD_LEN byte records.
+* \param[in]    length      Length of pRecords.
+********************************************************************************** */
+static void LinkStats_Import(uint8_t reporter, uint8_t* pRecords, uint16_t length)
+{
+    for (; length >= CUSTOM_CMD_LINK_RECORD_LEN; length -= CUSTOM_CMD_LINK_RECORD_LEN, pRecords += CUSTOM_CMD_LINK_RECORD_LEN)
+    {
+        uint8_t node = pRecords[CUSTOM_CMD_LINK_NODE];
+
+        mLinkReporter[node] = reporter;
+        FLib_MemCpy(&mLinkStats.aReceived[node], &pRecords[CUSTOM_CMD_LINK_RX_0], sizeof(uint16_t));
+        FLib_MemCpy(&mLinkStats.aLost[node], &pRecords[CUSTOM_CMD_LINK_LOST_0], sizeof(uint16_t));
+        FLib_MemCpy(&mLinkStats.aReordered[node], &pRecords[CUSTOM_CMD_LINK_REORDER_0], sizeof(uint16_t));
+        FLib_MemCpy(&mLinkStats.aDuplicate[node], &pRecords[CUSTOM_CMD_LINK_DUP_0], sizeof(uint16_t));
+        FLib_MemCpy(&mLinkStats.aShed[node], &pRecords[CUSTOM_CMD_LINK_SHED_0], sizeof(uint16_t));
+        FLib_MemCpy(&mLinkStats.aCoalesced[node], &pRecords[CUSTOM_CMD_LINK_COALESCED_0], sizeof(uint16_t));
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Prints the readings of a leaf's CUSTOM_CMD_HISTORY_REPORT, oldest first,
+*               with their age by the leaf's clock when it answered.
+*
+* \param[in]    source  Node ID of the leaf.
+* \param[in]    pData   Message, starting with its type.
+* \param[in]    length  Message length.
+********************************************************************************** */
+static void History_Print(uint8_t source, uint8_t* pData, uint16_t length)
+{
+    uint8_t  valId = pData[CUSTOM_CMD_HISTORY_VAL_ID];
+    uint16_t offset = CUSTOM_CMD_HISTORY_ENTRIES;
+    uint32_t index;
+    uint32_t oldest;
+    uint32_t now;
+    uint32_t time_s;
+    int32_t  value = 0;
+    int32_t  aDelta[2];
+    uint8_t  len;
+    bool_t   first = TRUE;
+
+    if ((length < CUSTOM_CMD_HISTORY_ENTRIES) || (valId < 1) || (valId > CUSTOM_CMD_NUM_SENSORS))
+    {
+        shell_printf("Malformed history from: %d\r\n", source);
+        return;
+    }
+
+    FLib_MemCpy(&index, &pData[CUSTOM_CMD_HISTORY_FIRST_0], sizeof(uint32_t));
+    FLib_MemCpy(&oldest, &pData[CUSTOM_CMD_HISTORY_OLDEST_0], sizeof(uint32_t));
+    FLib_MemCpy(&now, &pData[CUSTOM_CMD_HISTORY_NOW_0], sizeof(uint32_t));
+    time_s = now;
+
+    shell_printf("\r\nHistory of %d, oldest entry held %d:\r\n  Entry   Age(s)  Value\r\n", source, oldest);
+    while (offset < length)
+    {
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            len = CustomData_DecodeValue(&pData[offset],
+                    (uint8_t)(((length - offset) < CUSTOM_CMD_VAL_MAX_LEN) ? (length - offset) : CUSTOM_CMD_VAL_MAX_LEN), &aDelta[i]);
+            offset += len;
+            if (!len || ((offset >= length) && (i == 0)))
+            {
+                shell_printf("Truncated history from: %d\r\n", source);
+                return;
+            }
+        }
+
+        /* The first entry is timed back from the leaf's clock, the rest forward;
+           its value is absolute, which adding to zero leaves unchanged */
+        time_s = first ? (now - (uint32_t)aDelta[0]) : (time_s + (uint32_t)aDelta[0]);
+        value = (int32_t)((uint32_t)value + (uint32_t)aDelta[1]);
+        first = FALSE;
+
+        shell_printf("%7d %8d  ", index, now - time_s);
+        ShellMesh_PrintValue(value, mSensorScale[valId - 1]);
+        shell_printf("\r\n");
+        index++;
+    }
+    shell_printf("Next: history %d %d %d\r\n", source, index, mHistoryDefaultCount_c);
+}
+
+/*! *********************************************************************************
+* \brief        Applies the stored configuration, if there is one of this layout.
+*
+* \return       TRUE if a record was applied.
+********************************************************************************** */
+static bool_t Settings_Load(void)
+{
+    settings_t record;
+
+    if (!Settings_Read(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        return FALSE;
+    }
+    Settings_Apply(&record);
+    return TRUE;
+}
+
+/* Stores the current configuration, after a change */
+static void Settings_Save(void)
+{
+    settings_t record;
+
+    FLib_MemSet(&record, 0, sizeof(record));
+    Settings_Capture(&record);
+    if (!Settings_Write(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        shell_printf("Settings write failed\r\n");
+    }
+}
+
+static void Settings_Capture(settings_t* pRecord)
+{
+    pRecord->dataTx = mDataTxStatus;
+    pRecord->dataPollRate = mDataPollRate;
+    pRecord->tempSenPollRate = mTempSenPollRate;
+    pRecord->lightSenPollRate = mLightSenPollRate;
+    pRecord->tempSenPollMax = mTempSenPollMax;
+    pRecord->lightSenPollMax = mLightSenPollMax;
+    pRecord->batchBudget_sec = mBatchBudget_sec;
+    pRecord->filterPeriod_ms = mFilterPeriod_ms;
+    pRecord->batchSize = mBatchSize;
+    pRecord->filterKind = mFilterKind;
+    pRecord->filterTaps = mFilterTaps;
+    pRecord->filterDecim = mFilterDecim;
+    pRecord->tempSenPowSt = mTempSenPowSt;
+    pRecord->lightSenPowSt = mLightSenPowSt;
+    pRecord->batchAcked = mBatchAcked;
+}
+
+static void Settings_Apply(settings_t* pRecord)
+{
+    mDataTxStatus = pRecord->dataTx;
+    mDataPollRate = pRecord->dataPollRate;
+    mTempSenPollRate = pRecord->tempSenPollRate;
+    mLightSenPollRate = pRecord->lightSenPollRate;
+    mTempSenPollMax = pRecord->tempSenPollMax;
+    mLightSenPollMax = pRecord->lightSenPollMax;
+    mBatchBudget_sec = pRecord->batchBudget_sec;
+    mFilterPeriod_ms = pRecord->filterPeriod_ms;
+    mBatchSize = pRecord->batchSize;
+    mFilterKind = pRecord->filterKind;
+    mFilterTaps = pRecord->filterTaps;
+    mFilterDecim = pRecord->filterDecim;
+    mTempSenPowSt = pRecord->tempSenPowSt;
+    mLightSenPowSt = pRecord->lightSenPowSt;
+    mBatchAcked = pRecord->batchAcked ? TRUE : FALSE;
+}
+
+/*! *********************************************************************************
+* \brief        Sends a configuration frame and keeps it for retransmission until the
+*               destination acknowledges it. Broadcasts are sent once, unacknowledged.
+*
+* \param[in]    destination     Mesh address of the node to configure.
+* \param[in]    pFrame          Complete configuration frame.
+********************************************************************************** */
+static void Config_Send(meshAddress_t destination, meshCustomData_t* pFrame)
+{
+    CustomData_Send(destination, pFrame);
+
+    if (pFrame->aData[CUSTOM_CMD_DEST] == CUSTOM_CMD_DEST_ALL)
+    {
+        return;
+    }
+
+    /* A newer configuration replaces one still waiting for its acknowledgement */
+    FLib_MemCpy(&mConfigPending, pFrame, sizeof(meshCustomData_t));
+    FLib_MemSet(mConfigAcked, 0, sizeof(mConfigAcked));
+    for (uint8_t i = 0; i < mTopoSetWords_c; i++)
+    {
+        mConfigExpected[i] = mRelayGroup[i] | mAggregators[i];
+    }
+    mConfigPendingDest = destination;
+    mConfigRetries = mConfigMaxRetries_c;
+    TMR_StartSingleShotTimer(mConfigRetryTimerId, mConfigRetryTimeout_ms, ConfigRetryTimerCallback, NULL);
+}
+
+static void ConfigRetryTimerCallback(void* param)
+{
+    if (!mConfigPending.dataLength)
+    {
+        return;
+    }
+
+    if (!mConfigRetries)
+    {
+        if ((mConfigPending.aData[CUSTOM_CMD_DEST] == CUSTOM_CMD_DEST_RELAYS) && !Topology_Count(mConfigExpected))
+        {
+            shell_printf("\r\nConfig %d acknowledged by %d relays\r\n",
+                    mConfigPending.aData[CUSTOM_CMD_FUNC], Topology_Count(mConfigAcked));
+        }
+        else
+        {
+            shell_printf("\r\nConfig %d to %d not acknowledged\r\n",
+                    mConfigPending.aData[CUSTOM_CMD_FUNC], mConfigPending.aData[CUSTOM_CMD_DEST]);
+        }
+        mConfigPending.dataLength = 0;
+        return;
+    }
+
+    mConfigRetries--;
+    CustomData_Send(mConfigPendingDest, &mConfigPending);
+    TMR_StartSingleShotTimer(mConfigRetryTimerId, mConfigRetryTimeout_ms, ConfigRetryTimerCallback, NULL);
+}
+
+static void CustomData_HandleConfigAck(meshCustomData_t* pFrame)
+{
+    bool_t known = (Topology_Count(mConfigExpected) != 0);
+
+    if ((pFrame->dataLength < CUSTOM_CMD_ACK_LEN) || !mConfigPending.dataLength)
+    {
+        return;
+    }
+
+    if (pFrame->aData[CUSTOM_CMD_ACK_FUNC] != mConfigPending.aData[CUSTOM_CMD_FUNC])
+    {
+        return;
+    }
+
+    /* A group configuration is resent until every relay known to be in the group
+       has it. With none known when it was sent, all retries go out, since the
+       first acknowledgement cannot tell whether other relays missed it. */
+    if (mConfigPending.aData[CUSTOM_CMD_DEST] == CUSTOM_CMD_DEST_RELAYS)
+    {
+        Topology_Add(mConfigAcked, pFrame->aData[CUSTOM_CMD_SOURCE]);
+        Topology_Add(mRelayGroup, pFrame->aData[CUSTOM_CMD_SOURCE]);
+        for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+        {
+            if (!known || (Topology_Has(mConfigExpected, (uint8_t)id) && !Topology_Has(mConfigAcked, (uint8_t)id)))
+            {
+                shell_printf("\r\nConfig %d acknowledged by %d\r\n",
+                        pFrame->aData[CUSTOM_CMD_ACK_FUNC], pFrame->aData[CUSTOM_CMD_SOURCE]);
+                return;
+            }
+        }
+    }
+    else if (pFrame->aData[CUSTOM_CMD_SOURCE] != mConfigPending.aData[CUSTOM_CMD_DEST])
+    {
+        return;
+    }
+
+    TMR_StopTimer(mConfigRetryTimerId);
+    mConfigPending.dataLength = 0;
+    shell_printf("\r\nConfig %d acknowledged by %d\r\n",
+            pFrame->aData[CUSTOM_CMD_ACK_FUNC], pFrame->aData[CUSTOM_CMD_SOURCE]);
+}
+
+/*! *********************************************************************************
+* \brief        Records a reading in the node store.
+*
+* \param[in]    id      Node ID that produced the reading.
+* \param[in]    valId   Sensor type (CUSTOM_CMD_TEMP_ID / CUSTOM_CMD_LIGHT_ID).
+* \param[in]    value   Reading.
+* \param[in]    seq     Sequence number the producing node gave the reading.
+* \param[in]    time_ms Mesh time the reading was taken.
+********************************************************************************** */
+static void NodeStore_Update(uint8_t id, uint8_t valId, int32_t value, uint8_t seq, uint32_t time_ms)
+{
+    uint8_t bit;
+
+    if ((valId == 0) || (valId > CUSTOM_CMD_NUM_SENSORS))
+    {
+        return;
+    }
+    bit = (uint8_t)(1 << (valId - 1));
+
+    if (mNodeStore.aPacketCount[id] != 0)
+    {
+        int8_t diff = (int8_t)(seq - mNodeStore.aLastSeq[id]);
+
+        /* A sample already recorded adds nothing, but readings of other sensors
+           taken with it share its sequence number */
+        if (diff == 0)
+        {
+            if (!(mNodeStore.aSeqMask[id] & bit))
+            {
+                mNodeStore.aLatest[valId - 1][id] = value;
+                mNodeStore.aSensorMask[id] |= bit;
+                mNodeStore.aSeqMask[id] |= bit;
+            }
+            return;
+        }
+        if (diff > 1)
+        {
+            mNodeStore.aGapCount[id] += (uint16_t)(diff - 1);
+        }
+    }
+
+    mNodeStore.aLatest[valId - 1][id] = value;
+    mNodeStore.aSensorMask[id] |= bit;
+    mNodeStore.aSeqMask[id] = bit;
+    mNodeStore.aTimestamp_ms[id] = time_ms;
+    mNodeStore.aLastSeq[id] = seq;
+    mNodeStore.aPacketCount[id]++;
+}
+
+/*! *********************************************************************************
+* \brief        Floods a time beacon carrying the mesh time, which on the Comm is its
+*               own uptime. Relays repeat it and the nodes discipline their clocks to it.
+********************************************************************************** */
+static void TimeSync_Send(void)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameTimeSync_c];
+    uint32_t now_ms = OSA_TimeGetMsec();
+
+    /* CUSTOM_CMD_TIME_HOPS stays 0 from Frame_Init; relays count it up */
+    pFrame->aData[CUSTOM_CMD_TIME_EPOCH] = mTimeEpoch++;
+    FLib_MemCpy(&pFrame->aData[CUSTOM_CMD_TIME_MS_0], &now_ms, sizeof(now_ms));
+    CustomData_Send(gBroadcastAddress_c, pFrame);
+}
+
+static void TimeSyncTimerCallback(void* param)
+{
+    Mem_TrackTimerTask();
+    Mem_Sample();
+    TimeSync_Send();
+}
+
+/*! *********************************************************************************
+* \brief        Expands a reading timestamp to the latest mesh time not in the future
+*               that matches it, so stamps stay unambiguous for 2^16 units.
+*
+* \param[in]    stamp   CUSTOM_CMD_STAMP_0 field of a data frame.
+*
+* \return       Mesh time in ms; the arrival time for CUSTOM_CMD_STAMP_NONE.
+********************************************************************************** */
+static uint32_t TimeSync_Resolve(uint16_t stamp)
+{
+    uint32_t now_ms = OSA_TimeGetMsec();
+    uint16_t age;
+
+    if (stamp == CUSTOM_CMD_STAMP_NONE)
+    {
+        return now_ms;
+    }
+
+    age = (uint16_t)(now_ms / CUSTOM_CMD_STAMP_UNIT_ms - stamp);
+    return now_ms - (uint32_t)age * CUSTOM_CMD_STAMP_UNIT_ms;
+}
+
+static void CustomData_HandleMemReport(meshCustomData_t* pFrame)
+{
+    if (pFrame->dataLength < CUSTOM_CMD_MEM_POOLS)
+    {
+        return;
+    }
+    Mem_Print(pFrame->aData[CUSTOM_CMD_SOURCE], pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Prints a node's memory statistics and the PoolsDetails_c they suggest:
+*               the most blocks seen in use plus one spare, so a pool that was never
+*               used keeps one block.
+*
+* \param[in]    id      Node ID, 0 for the Comm.
+* \param[in]    pFrame  CUSTOM_CMD_MEM_REPORT frame.
+********************************************************************************** */
+static void Mem_Print(uint8_t id, meshCustomData_t* pFrame)
+{
+    uint8_t* pPool;
+
+    shell_printf("\r\nNode %d: main stack %d B used, timer stack %d B used, %d app allocations failed",
+            id,
+            pFrame->aData[CUSTOM_CMD_MEM_MAIN_0] | (pFrame->aData[CUSTOM_CMD_MEM_MAIN_1] << 8),
+            pFrame->aData[CUSTOM_CMD_MEM_TMR_0] | (pFrame->aData[CUSTOM_CMD_MEM_TMR_1] << 8),
+            pFrame->aData[CUSTOM_CMD_MEM_FAILS]);
+    shell_printf("\r\n Block  Count  Peak  Suggest");
+    for (pPool = &pFrame->aData[CUSTOM_CMD_MEM_POOLS];
+         pPool + CUSTOM_CMD_MEM_POOL_LEN <= &pFrame->aData[pFrame->dataLength];
+         pPool += CUSTOM_CMD_MEM_POOL_LEN)
+    {
+        shell_printf("\r\n %5d  %5d  %4d  %7d", pPool[0] * 4, pPool[1], pPool[2], pPool[2] + 1);
+    }
+
+    shell_printf("\r\n#define PoolsDetails_c \\");
+    for (pPool = &pFrame->aData[CUSTOM_CMD_MEM_POOLS];
+         pPool + CUSTOM_CMD_MEM_POOL_LEN <= &pFrame->aData[pFrame->dataLength];
+         pPool += CUSTOM_CMD_MEM_POOL_LEN)
+    {
+        shell_printf("\r\n         _block_size_ %3d  _number_of_blocks_ %4d _eol_%s", pPool[0] * 4, pPool[2] + 1,
+                (pPool + 2 * CUSTOM_CMD_MEM_POOL_LEN <= &pFrame->aData[pFrame->dataLength]) ? "  \\" : "");
+    }
+    shell_printf("\r\n");
+}
+
+static void CustomData_HandleEnergyReport(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t first = pFrame->aData[CUSTOM_CMD_ENERGY_FIRST];
+    uint8_t* pVal = &pFrame->aData[CUSTOM_CMD_ENERGY_VAL];
+    uint8_t index;
+    uint8_t freeIndex = mEnergyTableSize_c;
+
+    if ((pFrame->dataLength < CUSTOM_CMD_ENERGY_VAL) || (source == 0))
+    {
+        return;
+    }
+
+    for (index = 0; index < mEnergyTableSize_c; index++)
+    {
+        if (mEnergyTable.aId[index] == source)
+        {
+            break;
+        }
+        if ((mEnergyTable.aId[index] == 0) && (freeIndex == mEnergyTableSize_c))
+        {
+            freeIndex = index;
+        }
+    }
+    if (index == mEnergyTableSize_c)
+    {
+        if (freeIndex == mEnergyTableSize_c)
+        {
+            shell_printf("\r\nEnergy table full, dropped: %d ", source);
+            return;
+        }
+        index = freeIndex;
+        mEnergyTable.aId[index] = source;
+        FLib_MemSet(mEnergyTable.aCounters[index], 0, sizeof(mEnergyTable.aCounters[index]));
+    }
+
+    for (uint8_t i = first; (i < CUSTOM_CMD_ENERGY_COUNTERS) && (pVal + 4 <= &pFrame->aData[pFrame->dataLength]); i++)
+    {
+        mEnergyTable.aCounters[index][i] = (uint32_t)(pVal[0] | (pVal[1] << 8) | (pVal[2] << 16) | ((uint32_t)pVal[3] << 24));
+        pVal += 4;
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Prints one row of energy counters with the awake share and the energy
+*               per reading that the mEnergy* model gives for them.
+*
+* \param[in]    id          Node ID.
+* \param[in]    pCounters   Counters in CUSTOM_CMD_ENERGY_* order.
+********************************************************************************** */
+static void Energy_Print(uint8_t id, uint32_t* pCounters)
+{
+    uint32_t awake_s = pCounters[CUSTOM_CMD_ENERGY_AWAKE_S];
+    uint32_t asleep_s = pCounters[CUSTOM_CMD_ENERGY_ASLEEP_S];
+    uint32_t readings = pCounters[CUSTOM_CMD_ENERGY_READINGS];
+    uint64_t total_uJ;
+    uint32_t awake_pm;
+    uint32_t perReading_uJ;
+
+    total_uJ = (uint64_t)pCounters[CUSTOM_CMD_ENERGY_SENDS] * mEnergyPerSend_uJ +
+               (uint64_t)pCounters[CUSTOM_CMD_ENERGY_TX_BYTES] * mEnergyPerTxByte_nJ / 1000 +
+               (uint64_t)pCounters[CUSTOM_CMD_ENERGY_UART_BYTES] * mEnergyPerUartByte_nJ / 1000 +
+               (uint64_t)awake_s * mEnergyAwake_uW +
+               (uint64_t)asleep_s * mEnergyAsleep_uW;
+    awake_pm = (awake_s + asleep_s) ? (uint32_t)((uint64_t)awake_s * 1000 / (awake_s + asleep_s)) : 1000;
+    perReading_uJ = readings ? (uint32_t)(total_uJ / readings) : 0;
+
+    shell_printf("\r\n%3d %6d %7d %6d %6d %7d %7d %7d %3d.%d%%",
+                 id, pCounters[CUSTOM_CMD_ENERGY_SENDS], pCounters[CUSTOM_CMD_ENERGY_TX_BYTES],
+                 pCounters[CUSTOM_CMD_ENERGY_RX_FRAMES], readings, pCounters[CUSTOM_CMD_ENERGY_UART_BYTES],
+                 awake_s, asleep_s, awake_pm / 10, awake_pm % 10);
+    if (readings)
+    {
+        shell_printf(" %5d.%03d", perReading_uJ / 1000, perReading_uJ % 1000);
+    }
+    else
+    {
+        shell_printf("         -");
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Prints one node store entry as a table row.
+*
+* \param[in]    id      Node ID.
+********************************************************************************** */
+static void NodeStore_Print(uint8_t id)
+{
+    uint32_t age_sec = (OSA_TimeGetMsec() - mNodeStore.aTimestamp_ms[id]) / 1000;
+
+    shell_printf("\r\n%3d", id);
+    for (uint8_t i = 0; i < CUSTOM_CMD_NUM_SENSORS; i++)
+    {
+        if (mNodeStore.aSensorMask[id] & (1 << i))
+        {
+            shell_printf(" ");
+            ShellMesh_PrintValue(mNodeStore.aLatest[i][id], mSensorScale[i]);
+        }
+        else
+        {
+            shell_printf("        -");
+        }
+    }
+    shell_printf(" %7d %6d %6d", age_sec, mNodeStore.aPacketCount[id], mNodeStore.aGapCount[id]);
+}
+
+/*! *********************************************************************************
+* \brief        Streams every populated node store entry on the binary telemetry
+*               channel. Each record is little endian:
+*               id(1) temp(4) light(4) rxTimestamp_ms(4) packets(2) gaps(2).
+*
+********************************************************************************** */
+static void NodeStore_Export(void)
+{
+    uint16_t count = 0;
+    uint8_t  aRecord[mNodeSnapshotRecordSize_c];
+
+    for (uint16_t id = 0; id < mNodeStoreSize_c; id++)
+    {
+        if (mNodeStore.aPacketCount[id])
+        {
+            count++;
+        }
+    }
+
+    Telemetry_Begin(mTelemetryNodeSnapshot_c, count * mNodeSnapshotRecordSize_c);
+    for (uint16_t id = 0; id < mNodeStoreSize_c; id++)
+    {
+        if (!mNodeStore.aPacketCount[id])
+        {
+            continue;
+        }
+        aRecord[0] = (uint8_t)id;
+        FLib_MemCpy(&aRecord[1], &mNodeStore.aLatest[CUSTOM_CMD_TEMP_ID - 1][id], sizeof(int32_t));
+        FLib_MemCpy(&aRecord[5], &mNodeStore.aLatest[CUSTOM_CMD_LIGHT_ID - 1][id], sizeof(int32_t));
+        FLib_MemCpy(&aRecord[9], &mNodeStore.aTimestamp_ms[id], sizeof(uint32_t));
+        FLib_MemCpy(&aRecord[13], &mNodeStore.aPacketCount[id], sizeof(uint16_t));
+        FLib_MemCpy(&aRecord[15], &mNodeStore.aGapCount[id], sizeof(uint16_t));
+        Telemetry_Write(aRecord, sizeof(aRecord));
+    }
+    Telemetry_End();
+}
+
+static uint16_t LinkStats_LossPermille(uint8_t id)
+{
+    uint32_t expected = (uint32_t)mLinkStats.aReceived[id] + mLinkStats.aLost[id];
+
+    if (!expected)
+    {
+        return 0;
+    }
+    return (uint16_t)((1000 * (uint32_t)mLinkStats.aLost[id]) / expected);
+}
+
+/*! *********************************************************************************
+* \brief        Prints a fixed-point reading right aligned in 8 columns.
+*
+* \param[in]    value   Reading as transported.
+* \param[in]    scale   Decimal digits after the point.
+********************************************************************************** */
+static void ShellMesh_PrintValue(int32_t value, uint8_t scale)
+{
+    char     aText[12];
+    uint32_t divisor = 1;
+    uint32_t magnitude = (value < 0) ? (uint32_t)(-value) : (uint32_t)value;
+
+    if (!scale)
+    {
+        shell_printf("%8d", value);
+        return;
+    }
+
+    for (uint8_t i = 0; i < scale; i++)
+    {
+        divisor *= 10;
+    }
+    snprintf(aText, sizeof(aText), "%s%u.%0*u", (value < 0) ? "-" : "",
+             magnitude / divisor, scale, magnitude % divisor);
+    shell_printf("%8s", aText);
+}
+
+/*! *********************************************************************************
+* \brief        Starts a binary telemetry frame on the shell serial interface.
+*               Frame layout: SOF(1) type(1) length(2, LE) payload checksum(1),
+*               where checksum is the XOR of type, length and payload bytes.
+*
+* \param[in]    type    Frame type.
+* \param[in]    length  Number of payload bytes that will follow.
+********************************************************************************** */
+static void Telemetry_Begin(uint8_t type, uint16_t length)
+{
+    uint8_t aHeader[4];
+
+    aHeader[0] = mTelemetrySof_c;
+    aHeader[1] = type;
+    aHeader[2] = (uint8_t)(length & 0xFF);
+    aHeader[3] = (uint8_t)((length >> 8) & 0xFF);
+    shell_writeN((char*)aHeader, sizeof(aHeader));
+    mTelemetryChecksum = aHeader[1] ^ aHeader[2] ^ aHeader[3];
+}
+
+static void Telemetry_Write(uint8_t* pData, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+    {
+        mTelemetryChecksum ^= pData[i];
+    }
+    shell_writeN((char*)pData, length);
+}
+
+static void Telemetry_End(void)
+{
+    shell_writeN((char*)&mTelemetryChecksum, 1);
+}
+
+int8_t ShellMesh_Publish(uint8_t argc, char * argv[])
+{
+    if (argc > 4 || argc < 3)
+    {
+        return CMD_RET_USAGE;
+    }
+    
+    meshResult_t result;
+    if (argc == 3)
+    {
+        if (strcmp(argv[1], "get"))
+        {
+            return CMD_RET_USAGE;
+        }
+        int8_t id = atoi(argv[2]);
+        meshAddress_t destination = GetMeshAddressFromId(id);
+        result = MeshConfigClient_GetPublishAddress(destination, gMeshProfileLighting_c);
+        if (result == gMeshSuccess_c)
+        {
+            shell_printf("< Publish Get command sent to ID %d >", id);
+       }
+        else
+        {
+            shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+        }
+    }
+    else /* argc == 4 */
+    {
+        if (!strcmp(argv[1], "set"))
+        {
+            int8_t id = atoi(argv[2]);
+            int16_t add = atoi(argv[3]);
+            meshAddress_t destination = GetMeshAddressFromId(id);
+            result = MeshConfigClient_SetPublishAddress(destination, gMeshProfileLighting_c, add);
+            if (result == gMeshSuccess_c)
+            {
+                shell_printf("< Publish Set command sent to ID %d >", id);
+            }
+            else
+            {
+                shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+            }
+        }
+        else
+        {
+            return CMD_RET_USAGE;
+        }
+    }
+    
+    if (result == gMeshSuccess_c)
+    {
+        return CMD_RET_SUCCESS;
+    }
+    else
+    {
+        return CMD_RET_FAILURE;
+    }
+}
+
+int8_t ShellMesh_Subscribe(uint8_t argc, char * argv[])
+{
+        if (argc > 4 || argc < 3)
+    {
+        return CMD_RET_USAGE;
+    }
+    
+    meshResult_t result;
+    if (argc == 3)
+    {
+        if (strcmp(argv[1], "get"))
+        {
+            return CMD_RET_USAGE;
+        }
+        int8_t id = atoi(argv[2]);
+        meshAddress_t destination = GetMeshAddressFromId(id);
+        result = MeshConfigClient_GetSubscriptionList(destination, gMeshProfileLighting_c);
+        if (result == gMeshSuccess_c)
+        {
+            shell_printf("< Subscription List Get command sent to %d >", id);
+        }
+        else
+        {
+            shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+        }
+    }
+    else /* argc == 4 */
+    {
+        if (!strcmp(argv[1], "add"))
+        {
+            int8_t id = atoi(argv[2]);
+            int16_t add = atoi(argv[3]);
+            if (id != 0)
+            {
+                meshAddress_t destination = GetMeshAddressFromId(id);
+                result = MeshConfigClient_Subscribe(destination, gMeshProfileLighting_c, add);
+                if (result == gMeshSuccess_c)
+                {
+                    shell_printf("< Subscribe command sent to ID %d >", id);
+                }
+                else
+                {
+                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+                }
+            }
+            else
+            {
+                result = Mesh_Subscribe(gMeshProfileLighting_c, add);
+                if (result == gMeshSuccess_c)
+                {
+                    shell_printf("< Subscribed local node to 0x%04X >", add);
+                }
+                else
+                {
+                    shell_printf("< Could not subscribe local node - Error code: 0x%04x >", result);
+                }
+            }
+            
+        }
+        else if (!strcmp(argv[1], "rem"))
+        {
+            int8_t id = atoi(argv[2]);
+            int16_t add = atoi(argv[3]);
+            if (id != 0)
+            {
+                meshAddress_t destination = GetMeshAddressFromId(id);
+                result = MeshConfigClient_Unsubscribe(destination, gMeshProfileLighting_c, add);
+                if (result == gMeshSuccess_c)
+                {
+                    shell_printf("< Unsubscribe command sent to ID %d >", id);
+                }
+                else
+                {
+                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+                }
+            }
+            else
+            {
+                result = Mesh_Unsubscribe(gMeshProfileLighting_c, add);
+                if (result == gMeshSuccess_c)
+                {
+                    shell_printf("< Unsubscribed local node from 0x%04X >", add);
+                }
+                else
+                {
+                    shell_printf("< Could not unsubscribe local node - Error code: 0x%04x >", result);
+                }
+            }            
+        }
+        else
+        {
+            return CMD_RET_USAGE;
+        }
+    }
+    
+    if (result == gMeshSuccess_c)
+    {
+        return CMD_RET_SUCCESS;
+    }
+    else
+    {
+        return CMD_RET_FAILURE;
+    }
+}
+
+int8_t ShellMesh_Relay(uint8_t argc, char * argv[])
+{
+    if ((argc >= 2) && !strcmp(argv[1], "auto"))
+    {
+        if ((argc == 3) && !strcmp(argv[2], "off"))
+        {
+            /* Give every relay-capable node its role back */
+            mRelayPlan.bAuto = FALSE;
+            TMR_StopTimer(mTopologyTimerId);
+            FLib_MemCpy(mTopology.aRelays, mTopology.aCanRelay, sizeof(mTopology.aRelays));
+            mRelayPlan.next = 1;
+            mTopology.state = mTopoApply_c;
+            TopologyTimerCallback(NULL);
+            return CMD_RET_SUCCESS;
+        }
+        if (argc != 2)
+        {
+            return CMD_RET_USAGE;
+        }
+        if (!Topology_Discover(TRUE))
+        {
+            return CMD_RET_FAILURE;
+        }
+        mRelayPlan.bAuto = TRUE;
+        return CMD_RET_SUCCESS;
+    }
+
+    if (argc > 4 || argc < 3)
+    {
+        return CMD_RET_USAGE;
     }
     
     meshResult_t result;
     if (argc == 3)
     {
-        if (strcmp(argv[1], "get"))
+        if (strcmp(argv[1], "get"))
+        {
+            return CMD_RET_USAGE;
+        }
+        int8_t id = atoi(argv[2]);
+        if (id != 0)
+        {
+            meshAddress_t destination = GetMeshAddressFromId(id);
+            result = MeshConfigClient_GetRelayState(destination);
+            if (result == gMeshSuccess_c)
+            {
+                shell_printf("< Relay Get command sent to %d >", id);
+            }
+            else
+            {
+                shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+            }
+        }
+        else
+        {
+            bool_t relayEnabled;
+            Mesh_GetRelayState(&relayEnabled);
+            shell_printf("< Commissioner has relay state %d >", relayEnabled);
+            result = gMeshSuccess_c;
+        }
+    }
+    else /* argc == 4 */
+    {
+        if (!strcmp(argv[1], "set"))
+        {
+            int8_t id = atoi(argv[2]);
+            uint8_t state = atoi(argv[3]);
+            if (state > 1)
+            {
+                shell_printf("< Please use Relay state value 1 for ON and 0 for OFF >");
+                return CMD_RET_FAILURE;
+            }
+            if (id != 0)
+            {
+                meshAddress_t destination = GetMeshAddressFromId(id);
+                result = MeshConfigClient_EnableRelay(destination, state);
+                if (result == gMeshSuccess_c)
+                {
+                    shell_printf("< Relay Set command sent to ID %d >", id);
+                }
+                else
+                {
+                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+                }
+            }
+            else
+            {
+                Mesh_SetRelayState(state);
+                shell_printf("< Commissioner's relay state set to %d >", state);
+                result = gMeshSuccess_c;
+            }
+        }
+        else
+        {
+            return CMD_RET_USAGE;
+        }
+    }
+    
+    if (result == gMeshSuccess_c)
+    {
+        return CMD_RET_SUCCESS;
+    }
+    else
+    {
+        return CMD_RET_FAILURE;
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Starts a neighbor discovery round. The query is flooded to every node
+*               with the number of node slots per hello cycle, and the Comm sends its
+*               own hellos in slot 0.
+*
+* \param[in]    plan    Choose and apply relays when the round is over.
+*
+* \return       FALSE when a round is already running.
+********************************************************************************** */
+static bool_t Topology_Discover(bool_t plan)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameNeighbor_c];
+    uint8_t round = mTopology.round + 1;
+    uint8_t slots = mHelloMinSlots_c;
+
+    if (mTopology.state != mTopoIdle_c)
+    {
+        shell_printf("< Topology discovery already running >");
+        return FALSE;
+    }
+
+    for (uint16_t id = slots; id < mNodeStoreSize_c; id++)
+    {
+        if (Topology_Has(mRelayPlan.aHeard, (uint8_t)id))
+        {
+            slots = (uint8_t)id;
+        }
+    }
+
+    FLib_MemSet(&mTopology, 0, sizeof(mTopology));
+    mTopology.round = round;
+    mTopology.slots = slots;
+    mTopology.bPlan = plan;
+    Topology_Add(mTopology.aNodes, 0);
+
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_NEIGHBOR_QUERY;
+    pFrame->aData[CUSTOM_CMD_NBR_ROUND] = round;
+    pFrame->aData[CUSTOM_CMD_NBR_SLOTS] = slots;
+    pFrame->dataLength = CUSTOM_CMD_NEIGHBOR_QUERY_LEN;
+    CustomData_Send(gBroadcastAddress_c, pFrame);
+
+    shell_printf("< Discovering neighbors, about %d s >",
+            ((slots + 1) * mHelloSlot_ms * mHelloRepeats_c + slots * mNeighborReportSlot_ms +
+             mNeighborReportMargin_ms) / 1000);
+    mTopology.state = mTopoHello_c;
+    Topology_SendHello();
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Sends one of the Comm's hellos with TTL 0 and times the next step.
+********************************************************************************** */
+static void Topology_SendHello(void)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameNeighbor_c];
+    uint32_t cycle_ms = (uint32_t)(mTopology.slots + 1) * mHelloSlot_ms;
+    uint8_t ttl;
+
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_HELLO;
+    pFrame->aData[CUSTOM_CMD_NBR_ROUND] = mTopology.round;
+    pFrame->dataLength = CUSTOM_CMD_HELLO_LEN;
+    Mesh_GetTtl(&ttl);
+    Mesh_SetTtl(0);
+    CustomData_Send(gBroadcastAddress_c, pFrame);
+    Mesh_SetTtl(ttl);
+
+    if (++mTopology.hellosSent < mHelloRepeats_c)
+    {
+        TMR_StartSingleShotTimer(mTopologyTimerId, cycle_ms, TopologyTimerCallback, NULL);
+        return;
+    }
+
+    mTopology.state = mTopoCollect_c;
+    TMR_StartSingleShotTimer
+    (
+        mTopologyTimerId,
+        cycle_ms + (uint32_t)mTopology.slots * mNeighborReportSlot_ms + mNeighborReportMargin_ms,
+        TopologyTimerCallback,
+        NULL
+    );
+}
+
+/*! *********************************************************************************
+* \brief        Moves discovery on: the Comm's next hello, the graph once the reports
+*               are in, then for relay planning one relay state set per tick, and in
+*               automatic mode the next periodic round.
+********************************************************************************** */
+static void TopologyTimerCallback(void* param)
+{
+    switch (mTopology.state)
+    {
+        case mTopoHello_c:
+            Topology_SendHello();
+            break;
+
+        case mTopoCollect_c:
+            for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+            {
+                if (mTopology.aHelloHeard[id])
+                {
+                    Topology_AddEdge(0, (uint8_t)id, (uint8_t)((100 * mTopology.aHelloHeard[id]) / mHelloRepeats_c));
+                }
+            }
+            shell_printf("\r\nTopology: %d nodes, %d links", Topology_Count(mTopology.aNodes), mTopology.edgeCount);
+            if (mTopology.edgesDropped)
+            {
+                shell_printf(", %d links dropped", mTopology.edgesDropped);
+            }
+            shell_printf("\r\n");
+
+            if (!mTopology.bPlan)
+            {
+                mTopology.state = mTopoIdle_c;
+                shell_refresh();
+                break;
+            }
+
+            RelayPlan_Compute();
+            shell_printf("Relay plan: %d of %d relay-capable nodes relay\r\n",
+                    Topology_Count(mTopology.aRelays) - 1, Topology_Count(mTopology.aCanRelay));
+            for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+            {
+                if (Topology_Has(mTopology.aUncovered, (uint8_t)id))
+                {
+                    shell_printf("Node %d is out of reach of every relay\r\n", id);
+                }
+            }
+            mRelayPlan.next = 1;
+            mTopology.state = mTopoApply_c;
+            /* fall through */
+
+        case mTopoApply_c:
+            if (RelayPlan_Apply())
+            {
+                TMR_StartSingleShotTimer(mTopologyTimerId, mRelaySetInterval_ms, TopologyTimerCallback, NULL);
+                break;
+            }
+            mTopology.state = mTopoIdle_c;
+            shell_refresh();
+            if (mRelayPlan.bAuto)
+            {
+                TMR_StartSingleShotTimer(mTopologyTimerId, mRelayPlanPeriod_ms, TopologyTimerCallback, NULL);
+            }
+            break;
+
+        default:
+            /* Periodic or join-triggered rediscovery */
+            if (mRelayPlan.bAuto)
+            {
+                Topology_Discover(TRUE);
+            }
+            break;
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Records that node from heard node to. Both become part of the graph.
+*
+* \param[in]    from    Node that heard the hellos.
+* \param[in]    to      Node that sent them.
+* \param[in]    quality Percentage of the hellos heard.
+********************************************************************************** */
+static void Topology_AddEdge(uint8_t from, uint8_t to, uint8_t quality)
+{
+    Topology_Add(mTopology.aNodes, from);
+    Topology_Add(mTopology.aNodes, to);
+
+    if (mTopology.edgeCount == mTopoMaxEdges_c)
+    {
+        mTopology.edgesDropped++;
+        return;
+    }
+    mTopology.aFrom[mTopology.edgeCount] = from;
+    mTopology.aTo[mTopology.edgeCount] = to;
+    mTopology.aQuality[mTopology.edgeCount] = quality;
+    mTopology.edgeCount++;
+}
+
+/*! *********************************************************************************
+* \brief        Collects the neighbors of a node, counting a link heard in either
+*               direction.
+*
+* \param[in]    id      Node ID.
+* \param[out]   pSet    Node set of mTopoSetWords_c words.
+********************************************************************************** */
+static void Topology_Neighbors(uint8_t id, uint32_t* pSet)
+{
+    FLib_MemSet(pSet, 0, mTopoSetWords_c * sizeof(uint32_t));
+    for (uint16_t i = 0; i < mTopology.edgeCount; i++)
+    {
+        if (mTopology.aFrom[i] == id)
         {
-            return CMD_RET_USAGE;
+            Topology_Add(pSet, mTopology.aTo[i]);
         }
-        int8_t id = atoi(argv[2]);
-        if (id != 0)
+        else if (mTopology.aTo[i] == id)
         {
-            meshAddress_t destination = GetMeshAddressFromId(id);
-            result = MeshConfigClient_GetRelayState(destination);
-            if (result == gMeshSuccess_c)
-            {
-                shell_printf("< Relay Get command sent to %d >", id);
-            }
-            else
+            Topology_Add(pSet, mTopology.aFrom[i]);
+        }
+    }
+}
+
+static bool_t Topology_Has(uint32_t* pSet, uint8_t id)
+{
+    return (pSet[id / 32] & (1UL << (id % 32))) ? TRUE : FALSE;
+}
+
+static void Topology_Add(uint32_t* pSet, uint8_t id)
+{
+    pSet[id / 32] |= 1UL << (id % 32);
+}
+
+static uint16_t Topology_Count(uint32_t* pSet)
+{
+    uint16_t count = 0;
+
+    for (uint8_t w = 0; w < mTopoSetWords_c; w++)
+    {
+        for (uint32_t bits = pSet[w]; bits; bits &= bits - 1)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*! *********************************************************************************
+* \brief        Prints the neighbor graph of the last discovery round, one node per
+*               line with the nodes it heard and the percentage of their hellos.
+*               Role: C the Comm, R* a chosen relay, R relay-capable, ! out of reach.
+********************************************************************************** */
+static void Topology_Print(void)
+{
+    if (!mTopology.round)
+    {
+        shell_printf("\r\nNo topology yet, run topo scan");
+        return;
+    }
+
+    shell_printf("\r\n ID Role Heard (%% of hellos)");
+    for (uint16_t id = 0; id < mNodeStoreSize_c; id++)
+    {
+        if (!Topology_Has(mTopology.aNodes, (uint8_t)id))
+        {
+            continue;
+        }
+        shell_printf("\r\n%3d %-4s", id,
+                (id == 0) ? "C" :
+                Topology_Has(mTopology.aUncovered, (uint8_t)id) ? "!" :
+                Topology_Has(mTopology.aRelays, (uint8_t)id) ? "R*" :
+                Topology_Has(mTopology.aCanRelay, (uint8_t)id) ? "R" : "-");
+        for (uint16_t i = 0; i < mTopology.edgeCount; i++)
+        {
+            if (mTopology.aFrom[i] == id)
             {
-                shell_printf("< Cannot send command - Error code: 0x%04x >", result);
+                shell_printf(" %d(%d)", mTopology.aTo[i], mTopology.aQuality[i]);
             }
         }
-        else
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Streams the neighbor graph on the binary telemetry channel, little
+*               endian: nodes(2), then per node id(1) flags(1) with bit 0 relay-capable,
+*               bit 1 chosen relay and bit 2 out of reach, then per link from(1) to(1)
+*               quality(1) up to the end of the frame.
+********************************************************************************** */
+static void Topology_Export(void)
+{
+    uint16_t nodes = Topology_Count(mTopology.aNodes);
+    uint8_t  aRecord[3];
+
+    Telemetry_Begin(mTelemetryTopology_c, sizeof(nodes) + 2 * nodes + 3 * mTopology.edgeCount);
+    Telemetry_Write((uint8_t*)&nodes, sizeof(nodes));
+    for (uint16_t id = 0; id < mNodeStoreSize_c; id++)
+    {
+        if (!Topology_Has(mTopology.aNodes, (uint8_t)id))
         {
-            bool_t relayEnabled;
-            Mesh_GetRelayState(&relayEnabled);
-            shell_printf("< Commissioner has relay state %d >", relayEnabled);
-            result = gMeshSuccess_c;
+            continue;
         }
+        aRecord[0] = (uint8_t)id;
+        aRecord[1] = (Topology_Has(mTopology.aCanRelay, (uint8_t)id) ? 0x01 : 0) |
+                     (Topology_Has(mTopology.aRelays, (uint8_t)id) ? 0x02 : 0) |
+                     (Topology_Has(mTopology.aUncovered, (uint8_t)id) ? 0x04 : 0);
+        Telemetry_Write(aRecord, 2);
     }
-    else /* argc == 4 */
+    for (uint16_t i = 0; i < mTopology.edgeCount; i++)
     {
-        if (!strcmp(argv[1], "set"))
+        aRecord[0] = mTopology.aFrom[i];
+        aRecord[1] = mTopology.aTo[i];
+        aRecord[2] = mTopology.aQuality[i];
+        Telemetry_Write(aRecord, sizeof(aRecord));
+    }
+    Telemetry_End();
+}
+
+/*! *********************************************************************************
+* \brief        Notes a frame from a node. In automatic mode the first frame from a
+*               node brings the next discovery round forward; nodes that leave drop
+*               out of the graph at the next periodic round.
+*
+* \param[in]    id      Node ID the frame came from.
+********************************************************************************** */
+static void RelayPlan_Seen(uint8_t id)
+{
+    if (Topology_Has(mRelayPlan.aHeard, id))
+    {
+        return;
+    }
+    Topology_Add(mRelayPlan.aHeard, id);
+
+    if (mRelayPlan.bAuto && (mTopology.state == mTopoIdle_c))
+    {
+        TMR_StartSingleShotTimer(mTopologyTimerId, mRelayPlanJoinDelay_ms, TopologyTimerCallback, NULL);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Chooses the relays: a connected dominating set grown greedily from the
+*               Comm. Each step gives the relay role to the relay-capable node next to
+*               the set that reaches the most nodes not covered yet, so the relays stay
+*               connected to the Comm and every reachable node hears one of them.
+********************************************************************************** */
+static void RelayPlan_Compute(void)
+{
+    uint32_t aCovered[mTopoSetWords_c];
+    uint32_t aNeighbors[mTopoSetWords_c];
+    uint16_t best;
+    uint16_t bestGain;
+    uint16_t gain;
+
+    FLib_MemSet(mTopology.aRelays, 0, sizeof(mTopology.aRelays));
+    Topology_Add(mTopology.aRelays, 0);
+    Topology_Neighbors(0, aCovered);
+    Topology_Add(aCovered, 0);
+
+    do
+    {
+        bestGain = 0;
+        best = 0;
+        for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
         {
-            int8_t id = atoi(argv[2]);
-            uint8_t state = atoi(argv[3]);
-            if (state > 1)
+            /* Covered but not chosen: next to a chosen node, so the set stays connected */
+            if (!Topology_Has(mTopology.aCanRelay, (uint8_t)id) || Topology_Has(mTopology.aRelays, (uint8_t)id) ||
+                !Topology_Has(aCovered, (uint8_t)id))
             {
-                shell_printf("< Please use Relay state value 1 for ON and 0 for OFF >");
-                return CMD_RET_FAILURE;
+                continue;
             }
-            if (id != 0)
+            Topology_Neighbors((uint8_t)id, aNeighbors);
+            for (uint8_t w = 0; w < mTopoSetWords_c; w++)
             {
-                meshAddress_t destination = GetMeshAddressFromId(id);
-                result = MeshConfigClient_EnableRelay(destination, state);
-                if (result == gMeshSuccess_c)
-                {
-                    shell_printf("< Relay Set command sent to ID %d >", id);
-                }
-                else
-                {
-                    shell_printf("< Cannot send command - Error code: 0x%04x >", result);
-                }
+                aNeighbors[w] &= ~aCovered[w];
             }
-            else
+            gain = Topology_Count(aNeighbors);
+            if (gain > bestGain)
             {
-                Mesh_SetRelayState(state);
-                shell_printf("< Commissioner's relay state set to %d >", state);
-                result = gMeshSuccess_c;
+                bestGain = gain;
+                best = id;
+            }
+        }
+        if (bestGain)
+        {
+            Topology_Add(mTopology.aRelays, (uint8_t)best);
+            Topology_Neighbors((uint8_t)best, aNeighbors);
+            for (uint8_t w = 0; w < mTopoSetWords_c; w++)
+            {
+                aCovered[w] |= aNeighbors[w];
             }
         }
+    } while (bestGain);
+
+    for (uint8_t w = 0; w < mTopoSetWords_c; w++)
+    {
+        mTopology.aUncovered[w] = mTopology.aNodes[w] & ~aCovered[w];
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Sets the relay state of the next relay-capable node whose planned role
+*               differs from the one it was last given.
+*
+* \return       TRUE when a state was set, FALSE when every node is up to date.
+********************************************************************************** */
+static bool_t RelayPlan_Apply(void)
+{
+    bool_t relay;
+
+    for (; mRelayPlan.next < mNodeStoreSize_c; mRelayPlan.next++)
+    {
+        uint8_t id = (uint8_t)mRelayPlan.next;
+
+        if (!Topology_Has(mTopology.aCanRelay, id))
+        {
+            continue;
+        }
+        relay = Topology_Has(mTopology.aRelays, id);
+        if (Topology_Has(mRelayPlan.aRelayKnown, id) && (Topology_Has(mRelayPlan.aRelayOn, id) == relay))
+        {
+            continue;
+        }
+
+        MeshConfigClient_EnableRelay(GetMeshAddressFromId(id), relay);
+        shell_printf("Node %d: relay %s\r\n", id, relay ? "on" : "off");
+        Topology_Add(mRelayPlan.aRelayKnown, id);
+        if (relay)
+        {
+            Topology_Add(mRelayPlan.aRelayOn, id);
+        }
         else
         {
-            return CMD_RET_USAGE;
+            mRelayPlan.aRelayOn[id / 32] &= ~(1UL << (id % 32));
         }
+        mRelayPlan.next++;
+        return TRUE;
     }
-    
-    if (result == gMeshSuccess_c)
+    return FALSE;
+}
+
+static void CustomData_HandleHello(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+
+    /* A node in the first slot may beat the Comm's own hello */
+    if ((pFrame->dataLength < CUSTOM_CMD_HELLO_LEN) ||
+        ((mTopology.state != mTopoHello_c) && (mTopology.state != mTopoCollect_c)) ||
+        (pFrame->aData[CUSTOM_CMD_NBR_ROUND] != mTopology.round))
     {
-        return CMD_RET_SUCCESS;
+        return;
     }
-    else
+
+    if (mTopology.aHelloHeard[source] < mHelloRepeats_c)
     {
-        return CMD_RET_FAILURE;
+        mTopology.aHelloHeard[source]++;
+    }
+}
+
+static void CustomData_HandleNeighborReport(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+
+    if ((pFrame->dataLength < CUSTOM_CMD_NBR_ENTRIES) ||
+        ((mTopology.state != mTopoHello_c) && (mTopology.state != mTopoCollect_c)) ||
+        (pFrame->aData[CUSTOM_CMD_NBR_ROUND] != mTopology.round))
+    {
+        return;
+    }
+
+    Topology_Add(mTopology.aNodes, source);
+    if (pFrame->aData[CUSTOM_CMD_NBR_FLAGS] & CUSTOM_CMD_NBR_CAN_RELAY)
+    {
+        Topology_Add(mTopology.aCanRelay, source);
+    }
+    if (pFrame->aData[CUSTOM_CMD_NBR_FLAGS] & CUSTOM_CMD_NBR_AGGREGATES)
+    {
+        Topology_Add(mRelayGroup, source);
+    }
+
+    for (uint8_t i = CUSTOM_CMD_NBR_ENTRIES; i + CUSTOM_CMD_NBR_ENTRY_LEN <= pFrame->dataLength; i += CUSTOM_CMD_NBR_ENTRY_LEN)
+    {
+        Topology_AddEdge(source, pFrame->aData[i], pFrame->aData[i + 1]);
     }
 }
 
 int8_t ShellMesh_Ttl(uint8_t argc, char * argv[])
 {
+    if ((argc == 2) && !strcmp(argv[1], "auto"))
+    {
+        return TtlTune_Start() ? CMD_RET_SUCCESS : CMD_RET_FAILURE;
+    }
+
         if (argc > 4 || argc < 3)
     {
         return CMD_RET_USAGE;
@@ -983,20 +2704,204 @@ int8_t ShellMesh_Ttl(uint8_t argc, char * argv[])
                 result = gMeshSuccess_c;
             }
         }
-        else
+        else
+        {
+            return CMD_RET_USAGE;
+        }
+    }
+    
+    if (result == gMeshSuccess_c)
+    {
+        return CMD_RET_SUCCESS;
+    }
+    else
+    {
+        return CMD_RET_FAILURE;
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Starts measuring the hop distance of every node heard from so far. The
+*               Comm probes with TTL 0, 2, 3, ... up to mTtlProbeMax_c; the first round a
+*               node answers in gives its distance.
+*
+* \return       FALSE when a run is already in progress or no node is known.
+********************************************************************************** */
+static bool_t TtlTune_Start(void)
+{
+    uint16_t targets = 0;
+
+    if (mTtlTune.bRunning)
+    {
+        shell_printf("< TTL tuning already running >");
+        return FALSE;
+    }
+
+    for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+    {
+        mTtlTune.aHops[id] = 0;
+        if (mNodeStore.aPacketCount[id] || mLinkStats.aReceived[id])
+        {
+            mTtlTune.aHops[id] = mTtlUnknown_c;
+            targets++;
+        }
+    }
+
+    if (!targets)
+    {
+        shell_printf("< No nodes heard from yet >");
+        return FALSE;
+    }
+
+    Mesh_GetTtl(&mTtlTune.savedTtl);
+    mTtlTune.probeTtl = 0;
+    mTtlTune.bRunning = TRUE;
+    mTtlTune.bProbing = TRUE;
+    shell_printf("< Probing hop distance of %d nodes >", targets);
+    TtlTune_Probe();
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Sends one probe round with the current probe TTL to every node that
+*               has not answered yet. Only the probes go out with that TTL; other
+*               traffic sent while the round waits for echoes keeps the Comm's own.
+********************************************************************************** */
+static void TtlTune_Probe(void)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameProbe_c];
+    uint8_t ttl;
+
+    pFrame->aData[CUSTOM_CMD_PROBE_TTL] = mTtlTune.probeTtl;
+
+    Mesh_GetTtl(&ttl);
+    Mesh_SetTtl(mTtlTune.probeTtl);
+    for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+    {
+        if (mTtlTune.aHops[id] == mTtlUnknown_c)
+        {
+            pFrame->aData[CUSTOM_CMD_DEST] = (uint8_t)id;
+            CustomData_Send(GetMeshAddressFromId(id), pFrame);
+        }
+    }
+    Mesh_SetTtl(ttl);
+    TMR_StartSingleShotTimer(mTtlTuneTimerId, mTtlProbeWait_ms, TtlTuneTimerCallback, NULL);
+}
+
+/*! *********************************************************************************
+* \brief        Moves the tuning run on: the next probe round, or once every node has
+*               answered or the last round is over, one TTL set per tick, and finally
+*               the Comm's own TTL, which has to reach the farthest node.
+********************************************************************************** */
+static void TtlTuneTimerCallback(void* param)
+{
+    uint8_t maxTtl = 0;
+    uint16_t id;
+
+    if (mTtlTune.bProbing)
+    {
+        for (id = 1; id < mNodeStoreSize_c; id++)
+        {
+            if (mTtlTune.aHops[id] == mTtlUnknown_c)
+            {
+                break;
+            }
+        }
+
+        if ((id < mNodeStoreSize_c) && (mTtlTune.probeTtl < mTtlProbeMax_c))
+        {
+            /* TTL 1 reaches no further than TTL 0 */
+            mTtlTune.probeTtl = mTtlTune.probeTtl ? (mTtlTune.probeTtl + 1) : 2;
+            TtlTune_Probe();
+            return;
+        }
+
+        mTtlTune.bProbing = FALSE;
+        mTtlTune.nextId = 1;
+        shell_printf("\r\nHop distance measured, setting TTLs:\r\n");
+    }
+
+    for (id = mTtlTune.nextId; id < mNodeStoreSize_c; id++)
+    {
+        if (mTtlTune.aHops[id] == mTtlUnknown_c)
+        {
+            shell_printf("Node %d: no answer, TTL unchanged\r\n", id);
+        }
+        else if (mTtlTune.aHops[id])
+        {
+            uint8_t ttl = mTtlTune.aHops[id] + mTtlMargin_c;
+
+            MeshConfigClient_SetTtl(GetMeshAddressFromId(id), ttl);
+            shell_printf("Node %d: %d hops, TTL %d\r\n", id, mTtlTune.aHops[id], ttl);
+            mTtlTune.nextId = id + 1;
+            TMR_StartSingleShotTimer(mTtlTuneTimerId, mTtlSetInterval_ms, TtlTuneTimerCallback, NULL);
+            shell_refresh();
+            return;
+        }
+    }
+
+    for (id = 1; id < mNodeStoreSize_c; id++)
+    {
+        if ((mTtlTune.aHops[id] != mTtlUnknown_c) && (mTtlTune.aHops[id] + mTtlMargin_c > maxTtl))
         {
-            return CMD_RET_USAGE;
+            maxTtl = mTtlTune.aHops[id] + mTtlMargin_c;
         }
     }
-    
-    if (result == gMeshSuccess_c)
+    if (maxTtl)
     {
-        return CMD_RET_SUCCESS;
+        Mesh_SetTtl(maxTtl);
+        shell_printf("Commissioner: TTL %d (was %d)\r\n", maxTtl, mTtlTune.savedTtl);
+    }
+    mTtlTune.bRunning = FALSE;
+    shell_refresh();
+}
+
+/*! *********************************************************************************
+* \brief        Records the hop distance of a node echoing a probe. A late echo of an
+*               earlier round still carries that round's lower TTL.
+*
+* \param[in]    pFrame  Echoed CUSTOM_CMD_HOP_PROBE frame.
+********************************************************************************** */
+static void CustomData_HandleHopProbe(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t ttl = pFrame->aData[CUSTOM_CMD_PROBE_TTL];
+
+    if ((pFrame->dataLength < CUSTOM_CMD_HOP_PROBE_LEN) || !mTtlTune.bProbing ||
+        (mTtlTune.aHops[source] != mTtlUnknown_c))
+    {
+        return;
+    }
+
+    /* TTL 0 is never relayed, and TTL n is relayed until it has taken n hops */
+    mTtlTune.aHops[source] = (ttl < 2) ? 1 : ttl;
+}
+
+int8_t ShellMesh_Topo(uint8_t argc, char * argv[])
+{
+    if (argc > 2)
+    {
+        return CMD_RET_USAGE;
+    }
+
+    if (argc == 1)
+    {
+        Topology_Print();
+    }
+    else if (!strcmp(argv[1], "scan"))
+    {
+        return Topology_Discover(FALSE) ? CMD_RET_SUCCESS : CMD_RET_FAILURE;
+    }
+    else if (!strcmp(argv[1], "export"))
+    {
+        Topology_Export();
     }
     else
     {
-        return CMD_RET_FAILURE;
+        return CMD_RET_USAGE;
     }
+
+    return CMD_RET_SUCCESS;
 }
 
 int8_t ShellMesh_Light(uint8_t argc, char * argv[])
@@ -1107,24 +3012,16 @@ int8_t ShellMesh_DataTransfer(uint8_t argc, char * argv[])
         {
 			if (!strcmp(argv[2], "start"))
 			{
+				if (mDataTxStatus)
+				{
+					shell_printf("\r\nData transfer is ONGOING ");
+					return CMD_RET_SUCCESS;
+				}
 
-				meshAddress_t destination = GetMeshAddressFromId(22);
-				meshCustomData_t CustomData;
-				CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
-				CustomData.aData[CUSTOM_CMD_DEST] = 22;
-
-				CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_START_DATA;
-
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mDataPollRate & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mDataPollRate >> 8) & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mDataPollRate >> 16) & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mDataPollRate >> 24) & 0xFF);
-
-				CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_AWAKE;
-				CustomData.dataLength = 8;
-				Mesh_SendCustomData(destination,&CustomData);
+				CustomData_SendStartData();
 
 				mDataTxStatus = TRUE;
+				Settings_Save();
 				shell_printf("\r\nData transfer Started ");
 
 
@@ -1132,24 +3029,19 @@ int8_t ShellMesh_DataTransfer(uint8_t argc, char * argv[])
 			}
 			else if (!strcmp(argv[2], "stop"))
 			{
+				if (!mDataTxStatus)
+				{
+					shell_printf("\r\nData transfer is STOPPED ");
+					return CMD_RET_SUCCESS;
+				}
 
-				meshAddress_t destination = GetMeshAddressFromId(22);
-				meshCustomData_t CustomData;
-				CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
-				CustomData.aData[CUSTOM_CMD_DEST] = 22;
-
-				CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_STOP_DATA;
-				/*
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mDataPollRate & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mDataPollRate >> 8) & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mDataPollRate >> 16) & 0xFF);
-				CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mDataPollRate >> 24) & 0xFF);
-				*/
-				CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_SLEEP;
-				CustomData.dataLength = 8;
-				Mesh_SendCustomData(destination,&CustomData);
+				meshCustomData_t* pFrame = &mFrames[mFrameConfig_c];
+				pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_STOP_DATA;
+				pFrame->dataLength = CUSTOM_CMD_FUNC + 1;
+				Config_Send(CUSTOM_CMD_RELAY_GROUP, pFrame);
 
 				mDataTxStatus = FALSE;
+				Settings_Save();
 				shell_printf("\r\nData transfer Stopped ");
 
 
@@ -1170,7 +3062,6 @@ int8_t ShellMesh_DataTransfer(uint8_t argc, char * argv[])
         return CMD_RET_USAGE;
     }
 
-
     if (result == gMeshSuccess_c)
     {
         return CMD_RET_SUCCESS;
@@ -1183,7 +3074,7 @@ int8_t ShellMesh_DataTransfer(uint8_t argc, char * argv[])
 
 int8_t ShellMesh_SenPollRate(uint8_t argc, char * argv[])
 {
-    if (argc > 4 || argc < 3)
+    if (argc > 5 || argc < 3)
     {
         return CMD_RET_USAGE;
     }
@@ -1196,12 +3087,14 @@ int8_t ShellMesh_SenPollRate(uint8_t argc, char * argv[])
             if (!strcmp(argv[2], "temp"))
             {
             	shell_printf("\r\nTemp Sensor poll rate is %d ",mTempSenPollRate);
-            	//get data from relay
+            	if (mTempSenPollMax > mTempSenPollRate)
+            		shell_printf("adapting up to %d ",mTempSenPollMax);
             }
             else if (!strcmp(argv[2], "light"))
             {
             	shell_printf("\r\nLight Sensor poll rate is %d ",mLightSenPollRate);
-            	//get data from relay
+            	if (mLightSenPollMax > mLightSenPollRate)
+            		shell_printf("adapting up to %d ",mLightSenPollMax);
             }
             else
             {
@@ -1215,21 +3108,41 @@ int8_t ShellMesh_SenPollRate(uint8_t argc, char * argv[])
             return CMD_RET_USAGE;
         }
     }
-    else if (argc == 4)
+    else if (argc >= 4)
     {
         if (!strcmp(argv[1], "set"))
         {
+            int32_t min_sec = atoi(argv[3]);
+            int32_t max_sec = (argc == 5) ? atoi(argv[4]) : 0;
+
+            if ((min_sec < 1) || (min_sec > 0xFFFF) || (max_sec < 0) || (max_sec > 0xFFFF))
+            {
+                shell_printf("\r\nPoll rates must be 1 to 65535 seconds ");
+                return CMD_RET_FAILURE;
+            }
+            result = gMeshSuccess_c;
+
             if (!strcmp(argv[2], "temp"))
             {
-            	mTempSenPollRate = (uint32_t)(atoi(argv[3]));
+            	if ((mTempSenPollRate != (uint32_t)min_sec) || (mTempSenPollMax != (uint32_t)max_sec))
+            	{
+            		CustomData_SendIntervalConfig(CUSTOM_CMD_TEMP_ID, min_sec, max_sec);
+            		mTempSenPollRate = (uint32_t)min_sec;
+            		mTempSenPollMax = (uint32_t)max_sec;
+            		Settings_Save();
+            	}
             	shell_printf("\r\nTemp Sensor poll rate set to %d ",mTempSenPollRate);
-            	//get data from relay
             }
             else if (!strcmp(argv[2], "light"))
             {
-            	mLightSenPollRate = (uint32_t)(atoi(argv[3]));
+            	if ((mLightSenPollRate != (uint32_t)min_sec) || (mLightSenPollMax != (uint32_t)max_sec))
+            	{
+            		CustomData_SendIntervalConfig(CUSTOM_CMD_LIGHT_ID, min_sec, max_sec);
+            		mLightSenPollRate = (uint32_t)min_sec;
+            		mLightSenPollMax = (uint32_t)max_sec;
+            		Settings_Save();
+            	}
             	shell_printf("\r\nLight Sensor poll rate set to %d ",mLightSenPollRate);
-            	//get data from relay
             }
             else
             {
@@ -1247,7 +3160,6 @@ int8_t ShellMesh_SenPollRate(uint8_t argc, char * argv[])
         return CMD_RET_USAGE;
     }
 
-
     if (result == gMeshSuccess_c)
     {
         return CMD_RET_SUCCESS;
@@ -1282,25 +3194,25 @@ int8_t ShellMesh_DataPollRate(uint8_t argc, char * argv[])
     {
         if (!strcmp(argv[1], "set"))
         {
-        	mDataPollRate = (uint32_t)(atoi(argv[2]));
-
-			meshAddress_t destination = GetMeshAddressFromId(22);
-			meshCustomData_t CustomData;
-			CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
-			CustomData.aData[CUSTOM_CMD_DEST] = 22;
-
-			CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_START_DATA;
-
-			CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mDataPollRate & 0xFF);
-			CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mDataPollRate >> 8) & 0xFF);
-			CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mDataPollRate >> 16) & 0xFF);
-			CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mDataPollRate >> 24) & 0xFF);
-
-			//CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_AWAKE;
-			CustomData.dataLength = 8;
-			Mesh_SendCustomData(destination,&CustomData);
+        	uint32_t pollRate = (uint32_t)(atoi(argv[2]));
+
+        	if (!pollRate)
+        	{
+        		return CMD_RET_USAGE;
+        	}
+
+        	/* The relay only hears about the rate when it changes and data is flowing */
+        	if (pollRate != mDataPollRate)
+        	{
+        		mDataPollRate = pollRate;
+        		if (mDataTxStatus)
+        		{
+        			CustomData_SendStartData();
+        		}
+        		Settings_Save();
+        	}
+        	result = gMeshSuccess_c;
 
-        	//Start Reset Timer here
         	shell_printf("\r\nData Poll rate Set to: %d ",mDataPollRate);
         }
         else
@@ -1313,7 +3225,6 @@ int8_t ShellMesh_DataPollRate(uint8_t argc, char * argv[])
         return CMD_RET_USAGE;
     }
 
-
     if (result == gMeshSuccess_c)
     {
         return CMD_RET_SUCCESS;
@@ -1373,15 +3284,23 @@ int8_t ShellMesh_SenPower(uint8_t argc, char * argv[])
             {
                 if (!strcmp(argv[3], "wake"))
                 {
-                	mTempSenPowSt = TRUE;
+                	if (!mTempSenPowSt)
+                	{
+                		CustomData_SendPowerConfig(CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_SYS_AWAKE);
+                		mTempSenPowSt = TRUE;
+                		Settings_Save();
+                	}
                 	shell_printf("\r\nTemp Sensor is in WAKE mode ");
-                	//set data to relay
                 }
                 else if (!strcmp(argv[3], "sleep"))
                 {
-                	mTempSenPowSt = FALSE;
+                	if (mTempSenPowSt)
+                	{
+                		CustomData_SendPowerConfig(CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_SYS_SLEEP);
+                		mTempSenPowSt = FALSE;
+                		Settings_Save();
+                	}
                 	shell_printf("\r\nTemp Sensor is in SLEEP mode ");
-                	//set data to relay
                 }
                 else
                 {
@@ -1393,15 +3312,23 @@ int8_t ShellMesh_SenPower(uint8_t argc, char * argv[])
             {
                 if (!strcmp(argv[3], "wake"))
                 {
-                	mLightSenPowSt = TRUE;
+                	if (!mLightSenPowSt)
+                	{
+                		CustomData_SendPowerConfig(CUSTOM_CMD_LIGHT_ID, CUSTOM_CMD_SYS_AWAKE);
+                		mLightSenPowSt = TRUE;
+                		Settings_Save();
+                	}
                 	shell_printf("\r\nLight Sensor is in WAKE mode ");
-                	//set data to relay
                 }
                 else if (!strcmp(argv[3], "sleep"))
                 {
-                	mLightSenPowSt = FALSE;
+                	if (mLightSenPowSt)
+                	{
+                		CustomData_SendPowerConfig(CUSTOM_CMD_LIGHT_ID, CUSTOM_CMD_SYS_SLEEP);
+                		mLightSenPowSt = FALSE;
+                		Settings_Save();
+                	}
                 	shell_printf("\r\nLight Sensor is in SLEEP mode ");
-                	//set data to relay
                 }
                 else
                 {
@@ -1425,7 +3352,6 @@ int8_t ShellMesh_SenPower(uint8_t argc, char * argv[])
         return CMD_RET_USAGE;
     }
 
-
     if (result == gMeshSuccess_c)
     {
         return CMD_RET_SUCCESS;
@@ -1435,6 +3361,450 @@ int8_t ShellMesh_SenPower(uint8_t argc, char * argv[])
         return CMD_RET_FAILURE;
     }
 }
+int8_t ShellMesh_Stats(uint8_t argc, char * argv[])
+{
+    if (argc > 2)
+    {
+        return CMD_RET_USAGE;
+    }
+
+    if ((argc == 1) || !strcmp(argv[1], "all"))
+    {
+        shell_printf("\r\n ID     Temp    Light  Age(s)   Pkts   Gaps");
+        for (uint16_t id = 0; id < mNodeStoreSize_c; id++)
+        {
+            if (mNodeStore.aPacketCount[id])
+            {
+                NodeStore_Print((uint8_t)id);
+            }
+        }
+    }
+    else if (!strcmp(argv[1], "export"))
+    {
+        NodeStore_Export();
+    }
+    else
+    {
+        int16_t id = atoi(argv[1]);
+
+        if ((id < 0) || (id >= mNodeStoreSize_c))
+        {
+            return CMD_RET_USAGE;
+        }
+        if (!mNodeStore.aPacketCount[id])
+        {
+            shell_printf("\r\nNo data received from ID %d ", id);
+        }
+        else
+        {
+            shell_printf("\r\n ID     Temp    Light  Age(s)   Pkts   Gaps");
+            NodeStore_Print((uint8_t)id);
+        }
+    }
+
+    return CMD_RET_SUCCESS;
+}
+int8_t ShellMesh_Links(uint8_t argc, char * argv[])
+{
+    static uint8_t aOrder[mLinkStatsSize_c];
+    uint16_t count = 0;
+
+    if (argc > 2)
+    {
+        return CMD_RET_USAGE;
+    }
+
+    if (argc == 2)
+    {
+        if (strcmp(argv[1], "refresh"))
+        {
+            return CMD_RET_USAGE;
+        }
+
+        meshAddress_t destination = CUSTOM_CMD_RELAY_GROUP;
+        meshCustomData_t CustomData;
+        CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
+        CustomData.aData[CUSTOM_CMD_DEST] = CUSTOM_CMD_DEST_RELAYS;
+        CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_LINK_QUERY;
+        CustomData.dataLength = 3;
+        CustomData_Send(destination,&CustomData);
+        shell_printf("\r\nLink query sent to the relays ");
+        return CMD_RET_SUCCESS;
+    }
+
+    /* Insertion sort, worst loss rate first */
+    for (uint16_t id = 0; id < mLinkStatsSize_c; id++)
+    {
+        uint16_t pos = count;
+
+        if (!mLinkStats.aReceived[id])
+        {
+            continue;
+        }
+        while (pos && (LinkStats_LossPermille(aOrder[pos - 1]) < LinkStats_LossPermille((uint8_t)id)))
+        {
+            aOrder[pos] = aOrder[pos - 1];
+            pos--;
+        }
+        aOrder[pos] = (uint8_t)id;
+        count++;
+    }
+
+    shell_printf("\r\n ID  Via     Rx   Lost  Reord    Dup   Shed  Coal.   Loss");
+    for (uint16_t i = 0; i < count; i++)
+    {
+        uint8_t id = aOrder[i];
+        uint16_t loss = LinkStats_LossPermille(id);
+
+        if (mLinkReporter[id] == mLinkStatsLocal_c)
+        {
+            shell_printf("\r\n%3d    -", id);
+        }
+        else
+        {
+            shell_printf("\r\n%3d  %3d", id, mLinkReporter[id]);
+        }
+        shell_printf(" %6d %6d %6d %6d %6d %6d %3d.%d%%", mLinkStats.aReceived[id], mLinkStats.aLost[id],
+                     mLinkStats.aReordered[id], mLinkStats.aDuplicate[id], mLinkStats.aShed[id],
+                     mLinkStats.aCoalesced[id], loss / 10, loss % 10);
+    }
+
+    return CMD_RET_SUCCESS;
+}
+
+/*! *********************************************************************************
+* \brief        Starts relay reports at mDataPollRate, or moves them to a new rate.
+********************************************************************************** */
+static void CustomData_SendStartData(void)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameConfig_c];
+
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_START_DATA;
+
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mDataPollRate & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mDataPollRate >> 8) & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mDataPollRate >> 16) & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mDataPollRate >> 24) & 0xFF);
+    pFrame->dataLength = CUSTOM_CMD_START_DATA_LEN;
+    Config_Send(CUSTOM_CMD_RELAY_GROUP, pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Asks the relay to put one kind of leaf to sleep between reports or
+*               to keep it awake. The relay passes it on as each leaf next reports.
+*
+* \param[in]    valId   CUSTOM_CMD_TEMP_ID or CUSTOM_CMD_LIGHT_ID.
+* \param[in]    state   CUSTOM_CMD_SYS_AWAKE or CUSTOM_CMD_SYS_SLEEP.
+********************************************************************************** */
+static void CustomData_SendPowerConfig(uint8_t valId, uint8_t state)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameConfig_c];
+
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_POWER_CONFIG;
+    pFrame->aData[CUSTOM_CMD_POWER_TARGET] = valId;
+    pFrame->aData[CUSTOM_CMD_POWER_STATE] = state;
+    pFrame->dataLength = CUSTOM_CMD_POWER_CONFIG_LEN;
+    Config_Send(CUSTOM_CMD_RELAY_GROUP, pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Sends report interval bounds for one kind of leaf to the relay, which
+*               passes them on as each leaf next reports.
+*
+* \param[in]    valId       CUSTOM_CMD_TEMP_ID or CUSTOM_CMD_LIGHT_ID.
+* \param[in]    min_sec     Shortest report interval, also the adaptive sampling period.
+* \param[in]    max_sec     Longest report interval, 0 for a fixed one.
+********************************************************************************** */
+static void CustomData_SendIntervalConfig(uint8_t valId, uint32_t min_sec, uint32_t max_sec)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameConfig_c];
+
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_INTERVAL_CONFIG;
+    pFrame->aData[CUSTOM_CMD_INTERVAL_TARGET] = valId;
+    Frame_PutU16(pFrame, CUSTOM_CMD_INTERVAL_MIN_0, (uint16_t)min_sec);
+    Frame_PutU16(pFrame, CUSTOM_CMD_INTERVAL_MAX_0, (uint16_t)max_sec);
+    pFrame->dataLength = CUSTOM_CMD_INTERVAL_CONFIG_LEN;
+    Config_Send(CUSTOM_CMD_RELAY_GROUP, pFrame);
+}
+
+int8_t ShellMesh_Mem(uint8_t argc, char * argv[])
+{
+    meshCustomData_t CustomData;
+    uint8_t id;
+
+    if (argc == 1)
+    {
+        Mem_FillReport(&CustomData);
+        Mem_Print(0, &CustomData);
+        return CMD_RET_SUCCESS;
+    }
+
+    /* A sleeping leaf only hears it inside the listen window after one of its reports */
+    id = (uint8_t)atoi(argv[1]);
+    CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
+    CustomData.aData[CUSTOM_CMD_DEST] = id;
+    CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_MEM_QUERY;
+    CustomData.dataLength = 3;
+    CustomData_Send(GetMeshAddressFromId(id), &CustomData);
+    shell_printf("\r\nMemory query sent to %d ", id);
+    return CMD_RET_SUCCESS;
+}
+
+int8_t ShellMesh_Energy(uint8_t argc, char * argv[])
+{
+    meshCustomData_t CustomData;
+    uint32_t aLocal[CUSTOM_CMD_ENERGY_COUNTERS];
+
+    if (argc == 1)
+    {
+        /* The Comm never sleeps and its shell output is not counted */
+        aLocal[CUSTOM_CMD_ENERGY_SENDS] = gEnergyStats.sends;
+        aLocal[CUSTOM_CMD_ENERGY_TX_BYTES] = gEnergyStats.txBytes;
+        aLocal[CUSTOM_CMD_ENERGY_RX_FRAMES] = gEnergyStats.rxFrames;
+        aLocal[CUSTOM_CMD_ENERGY_READINGS] = gEnergyStats.readings;
+        aLocal[CUSTOM_CMD_ENERGY_UART_BYTES] = 0;
+        aLocal[CUSTOM_CMD_ENERGY_AWAKE_S] = OSA_TimeGetMsec() / 1000;
+        aLocal[CUSTOM_CMD_ENERGY_ASLEEP_S] = 0;
+
+        shell_printf("\r\n ID  Sends  TxByte     Rx  Reads  UartByte  Awake(s) Sleep(s)  Awake   mJ/read");
+        Energy_Print(0, aLocal);
+        for (uint8_t index = 0; index < mEnergyTableSize_c; index++)
+        {
+            if (mEnergyTable.aId[index])
+            {
+                Energy_Print(mEnergyTable.aId[index], mEnergyTable.aCounters[index]);
+            }
+        }
+        return CMD_RET_SUCCESS;
+    }
+
+    if ((argc > 3) || strcmp(argv[1], "refresh"))
+    {
+        return CMD_RET_USAGE;
+    }
+
+    CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
+    CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_ENERGY_QUERY;
+    CustomData.dataLength = 3;
+
+    if (argc == 3)
+    {
+        uint8_t id = (uint8_t)atoi(argv[2]);
+
+        CustomData.aData[CUSTOM_CMD_DEST] = id;
+        CustomData_Send(GetMeshAddressFromId(id), &CustomData);
+        shell_printf("\r\nEnergy query sent to %d ", id);
+        return CMD_RET_SUCCESS;
+    }
+
+    /* The relays and every leaf that has reported; a sleeping leaf only hears it
+       inside the listen window after one of its reports */
+    CustomData.aData[CUSTOM_CMD_DEST] = CUSTOM_CMD_DEST_RELAYS;
+    CustomData_Send(CUSTOM_CMD_RELAY_GROUP, &CustomData);
+    for (uint16_t id = 1; id < mNodeStoreSize_c; id++)
+    {
+        if (mNodeStore.aPacketCount[id] && !Topology_Has(mAggregators, (uint8_t)id))
+        {
+            CustomData.aData[CUSTOM_CMD_DEST] = (uint8_t)id;
+            CustomData_Send(GetMeshAddressFromId((uint8_t)id), &CustomData);
+        }
+    }
+    shell_printf("\r\nEnergy query sent to the relays and reporting leaves ");
+    return CMD_RET_SUCCESS;
+}
+
+int8_t ShellMesh_Batch(uint8_t argc, char * argv[])
+{
+    uint8_t dest = CUSTOM_CMD_DEST_ALL;
+    int32_t samples;
+    int32_t budget;
+
+    if ((argc == 2) && !strcmp(argv[1], "get"))
+    {
+        shell_printf("\r\nBatch size is %d samples, budget %d seconds, reports %sacknowledged ",
+                mBatchSize, mBatchBudget_sec, mBatchAcked ? "" : "not ");
+        return CMD_RET_SUCCESS;
+    }
+
+    if (((argc == 3) || (argc == 4)) && !strcmp(argv[1], "ack"))
+    {
+        if (strcmp(argv[2], "on") && strcmp(argv[2], "off"))
+        {
+            return CMD_RET_USAGE;
+        }
+        mBatchAcked = strcmp(argv[2], "on") ? FALSE : TRUE;
+        if (argc == 4)
+        {
+            dest = (uint8_t)atoi(argv[3]);
+        }
+        CustomData_SendBatchConfig(dest);
+        Settings_Save();
+        shell_printf("\r\nAcknowledged reports %s ", mBatchAcked ? "on" : "off");
+        return CMD_RET_SUCCESS;
+    }
+
+    if (((argc != 4) && (argc != 5)) || strcmp(argv[1], "set"))
+    {
+        return CMD_RET_USAGE;
+    }
+
+    samples = atoi(argv[2]);
+    budget = atoi(argv[3]);
+    if ((samples < 1) || (samples > mBatchMaxSamples_c) || (budget < 0) || (budget > 0xFFFF))
+    {
+        shell_printf("\r\nSamples must be 1 to %d, budget 0 to 65535 ", mBatchMaxSamples_c);
+        return CMD_RET_FAILURE;
+    }
+    if (argc == 5)
+    {
+        dest = (uint8_t)atoi(argv[4]);
+    }
+    else if ((samples == mBatchSize) && (budget == mBatchBudget_sec))
+    {
+        shell_printf("\r\nBatch settings unchanged ");
+        return CMD_RET_SUCCESS;
+    }
+
+    mBatchSize = (uint8_t)samples;
+    mBatchBudget_sec = (uint16_t)budget;
+    CustomData_SendBatchConfig(dest);
+    Settings_Save();
+    shell_printf("\r\nBatch size set to %d samples, budget %d seconds ", mBatchSize, mBatchBudget_sec);
+    return CMD_RET_SUCCESS;
+}
+
+/*! *********************************************************************************
+* \brief        Sends the batch size, budget and acknowledged mode to leaves directly.
+*
+* \param[in]    dest    Node ID of one leaf, or CUSTOM_CMD_DEST_ALL.
+********************************************************************************** */
+static void CustomData_SendBatchConfig(uint8_t dest)
+{
+    meshAddress_t destination = (dest == CUSTOM_CMD_DEST_ALL) ? gBroadcastAddress_c : GetMeshAddressFromId(dest);
+    meshCustomData_t* pFrame = &mFrames[mFrameLeafConfig_c];
+
+    pFrame->aData[CUSTOM_CMD_DEST] = dest;
+    pFrame->aData[CUSTOM_CMD_BATCH_SIZE] = mBatchSize;
+    Frame_PutU16(pFrame, CUSTOM_CMD_BATCH_BUDGET_0, mBatchBudget_sec);
+    pFrame->aData[CUSTOM_CMD_BATCH_FLAGS] = mBatchAcked ? CUSTOM_CMD_BATCH_ACKED : 0;
+    Config_Send(destination, pFrame);
+}
+
+int8_t ShellMesh_Filter(uint8_t argc, char * argv[])
+{
+    static const char* aFilterName[] = { "none", "avg", "median" };
+    uint8_t dest = CUSTOM_CMD_DEST_ALL;
+    uint8_t kind;
+    int32_t taps;
+    int32_t period_ms;
+    int32_t decim;
+
+    if ((argc == 2) && !strcmp(argv[1], "get"))
+    {
+        shell_printf("\r\nFilter %s, %d taps every %d ms, decimation %d ",
+                     aFilterName[mFilterKind], mFilterTaps, mFilterPeriod_ms, mFilterDecim);
+        return CMD_RET_SUCCESS;
+    }
+
+    if (((argc != 6) && (argc != 7)) || strcmp(argv[1], "set"))
+    {
+        return CMD_RET_USAGE;
+    }
+
+    for (kind = 0; kind <= CUSTOM_CMD_FILTER_MEDIAN; kind++)
+    {
+        if (!strcmp(argv[2], aFilterName[kind]))
+        {
+            break;
+        }
+    }
+    taps = atoi(argv[3]);
+    period_ms = atoi(argv[4]);
+    decim = atoi(argv[5]);
+    if ((kind > CUSTOM_CMD_FILTER_MEDIAN) || (taps < 1) || (taps > mFilterMaxTaps_c) ||
+        (period_ms < mFilterMinPeriod_ms) || (period_ms > 0xFFFF) || (period_ms % mSchedTick_ms) ||
+        (decim < 1) || (decim > 0xFF))
+    {
+        shell_printf("\r\nTaps must be 1 to %d, period a multiple of %d ms up to 65535, decimation 1 to 255 ",
+                     mFilterMaxTaps_c, mSchedTick_ms);
+        return CMD_RET_FAILURE;
+    }
+    if (argc == 7)
+    {
+        dest = (uint8_t)atoi(argv[6]);
+    }
+    else if ((kind == mFilterKind) && (taps == mFilterTaps) && (period_ms == mFilterPeriod_ms) && (decim == mFilterDecim))
+    {
+        shell_printf("\r\nFilter settings unchanged ");
+        return CMD_RET_SUCCESS;
+    }
+
+    meshAddress_t destination = (dest == CUSTOM_CMD_DEST_ALL) ? gBroadcastAddress_c : GetMeshAddressFromId(dest);
+    meshCustomData_t CustomData;
+    CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
+    CustomData.aData[CUSTOM_CMD_DEST] = dest;
+    CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_FILTER_CONFIG;
+    CustomData.aData[CUSTOM_CMD_FILTER_KIND] = kind;
+    CustomData.aData[CUSTOM_CMD_FILTER_TAPS] = (uint8_t)taps;
+    CustomData.aData[CUSTOM_CMD_FILTER_PERIOD_0] = (uint8_t)(period_ms & 0xFF);
+    CustomData.aData[CUSTOM_CMD_FILTER_PERIOD_1] = (uint8_t)((period_ms >> 8) & 0xFF);
+    CustomData.aData[CUSTOM_CMD_FILTER_DECIM] = (uint8_t)decim;
+    CustomData.dataLength = CUSTOM_CMD_FILTER_CONFIG_LEN;
+    Config_Send(destination,&CustomData);
+
+    mFilterKind = kind;
+    mFilterTaps = (uint8_t)taps;
+    mFilterPeriod_ms = (uint16_t)period_ms;
+    mFilterDecim = (uint8_t)decim;
+    Settings_Save();
+    shell_printf("\r\nFilter set to %s, %d taps every %d ms, decimation %d ",
+                 aFilterName[mFilterKind], mFilterTaps, mFilterPeriod_ms, mFilterDecim);
+    return CMD_RET_SUCCESS;
+}
+
+int8_t ShellMesh_History(uint8_t argc, char * argv[])
+{
+    meshCustomData_t CustomData;
+    uint32_t from = CUSTOM_CMD_HISTORY_NEWEST;
+    int32_t count = mHistoryDefaultCount_c;
+    uint8_t id;
+
+    if ((argc < 2) || (argc > 4))
+    {
+        return CMD_RET_USAGE;
+    }
+
+    id = (uint8_t)atoi(argv[1]);
+    if (argc == 3)
+    {
+        count = atoi(argv[2]);
+    }
+    else if (argc == 4)
+    {
+        from = (uint32_t)atoi(argv[2]);
+        count = atoi(argv[3]);
+    }
+    if ((count < 1) || (count > 0xFFFF))
+    {
+        shell_printf("\r\nCount must be 1 to 65535 ");
+        return CMD_RET_FAILURE;
+    }
+
+    /* A sleeping leaf only hears the query inside the listen window after a report */
+    CustomData.aData[CUSTOM_CMD_SOURCE] = 0;
+    CustomData.aData[CUSTOM_CMD_DEST] = id;
+    CustomData.aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_HISTORY_QUERY;
+    CustomData.aData[CUSTOM_CMD_HISTORY_FROM_0] = (uint8_t)(from & 0xFF);
+    CustomData.aData[CUSTOM_CMD_HISTORY_FROM_1] = (uint8_t)((from >> 8) & 0xFF);
+    CustomData.aData[CUSTOM_CMD_HISTORY_FROM_2] = (uint8_t)((from >> 16) & 0xFF);
+    CustomData.aData[CUSTOM_CMD_HISTORY_FROM_3] = (uint8_t)((from >> 24) & 0xFF);
+    CustomData.aData[CUSTOM_CMD_HISTORY_COUNT_0] = (uint8_t)(count & 0xFF);
+    CustomData.aData[CUSTOM_CMD_HISTORY_COUNT_1] = (uint8_t)((count >> 8) & 0xFF);
+    CustomData.dataLength = CUSTOM_CMD_HISTORY_QUERY_LEN;
+    CustomData_Send(GetMeshAddressFromId(id), &CustomData);
+    shell_printf("\r\nHistory query sent to %d ", id);
+    return CMD_RET_SUCCESS;
+}
 /*! *********************************************************************************
 * @}
 ********************************************************************************** */
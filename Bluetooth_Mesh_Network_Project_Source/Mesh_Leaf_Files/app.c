@@ -0,0 +1,2017 @@
+/*! *********************************************************************************
+* \addtogroup Temperature Sensor
+* @{
+********************************************************************************** */
+/*!
+* Copyright (c) 2015, Freescale Semiconductor, Inc.
+* All rights reserved.
+* \file app.c
+* This file is the source file for the Temperature Sensor application
+*
+* Both leaf projects build this file, each with app.h and app_preinclude.h from its
+* own folder (Mesh_Leaf_Temp_Files, Mesh_Leaf_Light_Files) and with node_common.c.
+*
+* Redistribution and use in source and binary forms, with or without modification,
+* are permitted provided that the following conditions are met:
+*
+* o Redistributions of source code must retain the above copyright notice, this list
+*   of conditions and the following disclaimer.
+*
+* o Redistributions in binary form must reproduce the above copyright notice, this
+*   list of conditions and the following disclaimer in the documentation and/or
+*   other materials provided with the distribution.
+*
+* o Neither the name of Freescale Semiconductor, Inc. nor the names of its
+*   contributors may be used to endorse or promote products derived from this
+*   software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/************************************************************************************
+*************************************************************************************
+* Include
+*************************************************************************************
+************************************************************************************/
+/* Framework / Drivers */
+#include "RNG_Interface.h"
+#include "Keyboard.h"
+#include "LED.h"
+#include "TimersManager.h"
+#include "PWR_Interface.h"
+#include "FunctionLib.h"
+#include "Flash_Adapter.h"
+#include "fsl_os_abstraction.h"
+#ifdef FSL_RTOS_FREE_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+#include "Panic.h"
+#include "app.h"
+#include "board.h"
+#include "fsl_adc16.h"
+#include "ApplMain.h"
+
+#include "mesh_interface.h"
+
+#if gAppLightBulb_d
+#include "mesh_light_server.h"
+#elif gAppLightSwitch_d
+#include "mesh_light_client.h"
+#endif
+
+#if gAppTempSensor_d
+#include "mesh_temperature_server.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "SerialManager.h"
+#include "MemManager.h"
+
+#include "node_common.h"
+
+#include "fsl_i2c.h"
+#include "pin_mux.h"
+
+#include "fsl_common.h"
+#include "fsl_port.h"
+
+
+
+
+/************************************************************************************
+*************************************************************************************
+* Private macros
+*************************************************************************************
+************************************************************************************/
+#define ADDRESS 9000
+#define SHELL_MAX_COMMANDS            20
+
+/* The reading this leaf role samples and reports, set by gAppLeafSensor_d */
+#if gAppLeafSensor_d == gAppLeafSensorLight_c
+#define mLeafValId_c					CUSTOM_CMD_LIGHT_ID
+#define mLeafScale_c					CUSTOM_CMD_LIGHT_SCALE
+#define mLeafName_c						"Light"
+#elif gAppLeafSensor_d == gAppLeafSensorTemp_c
+#define mLeafValId_c					CUSTOM_CMD_TEMP_ID
+#define mLeafScale_c					CUSTOM_CMD_TEMP_SCALE
+#define mLeafName_c						"Temp"
+#else
+#error "gAppLeafSensor_d names no leaf sensor"
+#endif
+
+#if gAppLeafDieTemp_d && (!gAppTempSensor_d || (mLeafValId_c == CUSTOM_CMD_TEMP_ID))
+#error "The on-chip temperature needs gAppTempSensor_d and a leaf reporting another reading"
+#endif
+
+/* The on-chip temperature is reported on every this many report ticks */
+#define mDieTempEvery_c					4
+
+/* Largest window of the oversampling filter, see CUSTOM_CMD_FILTER_CONFIG. Samples are
+   taken by the scheduler, so the period is a whole number of its ticks. */
+#define mFilterMaxTaps_c				8
+#define mFilterMinPeriod_ms				mSchedTick_ms
+
+/* Adaptive reports: EWMA weight is 1/2^mAdaptShift_c, mean and variance carry
+   mAdaptFrac_c fraction bits. Above mAdaptVarHigh_c (one squared sensor unit) reports
+   fall back to the minimum interval, below mAdaptVarLow_c the interval backs off. */
+#define mAdaptShift_c					3
+#define mAdaptFrac_c					4
+#define mAdaptVarHigh_c					(1 << mAdaptFrac_c)
+#define mAdaptVarLow_c					(mAdaptVarHigh_c / 4)
+
+/* Time the radio stays up after a report so the relay can reach a sleeping leaf */
+#define mSleepListenWindow_ms			200
+
+/* A beacon further off than this steps the mesh time offset instead of slewing it */
+#define mTimeSyncStep_ms				1000
+
+/* Aggregating relays a leaf may report to, kept in ID order. Relays are learned from
+   the time beacons they repeat; mRelayDefaultId_c is used until one is heard. */
+#define mRelayDefaultId_c				22
+#define mRelayMaxCandidates_c			4
+/* Reports in a row a relay leaves unacknowledged before the leaf moves to another */
+#define mRelayFailLimit_c				3
+
+/* Acknowledged reports: sent frames held for resending, resends per frame after each
+   report, and the wait before the second resend, doubled for every one after it */
+#define mRetxSlots_c					4
+#define mRetxMaxTries_c					3
+#define mRetxBackoff_ms					200
+
+/* Outgoing frames kept from one send to the next, see Frame_Init */
+#define mFrameData_c					0	/* sensor readings to the relay */
+#define mFrameSlots_c					1
+
+/* Reading history log in program flash, at mHistoryFlashStart_c (see node_common.h).
+   Sectors are reused in turn, so each one is erased once per mHistorySectors_c fills. */
+#define mHistorySectorSize_c			mFlashSectorSize_c
+#define mHistoryMagic_c					0x4853
+#define mHistoryPerSector_c				((mHistorySectorSize_c - sizeof(historyHeader_t)) / sizeof(historyEntry_t))
+/* Entries collected in RAM and programmed with one flash write */
+#define mHistoryBatch_c					8
+
+/* Layout of the leaf's settings_t record, see Settings_Read */
+#define mSettingsVersion_c				2	/* bump when settings_t changes layout */
+
+#define LIGHT_I2C_ADDR					(uint8_t)(0x88)
+
+#define BOARD_ACCEL_I2C_BASEADDR I2C1
+
+/************************************************************************************
+*************************************************************************************
+* Private type definitions
+*************************************************************************************
+************************************************************************************/
+/* Start of every history sector in use; an erased sector has no valid magic */
+typedef struct historyHeader_tag
+{
+    uint16_t    magic;
+    uint16_t    eraseCount;
+    uint32_t    firstIndex;     /* log index of the sector's first entry */
+} historyHeader_t;
+
+/* One logged reading, a flash program phrase long; erased slots read time_s 0xFFFFFFFF */
+typedef struct historyEntry_tag
+{
+    uint32_t    time_s;         /* leaf clock, kept increasing across resets */
+    int32_t     value;
+} historyEntry_t;
+
+/* Reporting configuration kept across resets */
+typedef struct settings_tag
+{
+    settingsHeader_t header;
+    uint8_t     streaming;          /* reports were running */
+    uint32_t    reportInterval_sec;
+    uint16_t    reportMax_sec;
+    uint16_t    batchBudget_sec;
+    uint16_t    filterPeriod_ms;
+    uint8_t     batchSize;
+    uint8_t     filterKind;
+    uint8_t     filterTaps;
+    uint8_t     filterDecim;
+    uint8_t     powerCtrl;
+    uint8_t     ackMode;
+} settings_t;
+
+/* Reads one sensor, in its fixed-point scale; FALSE when it has no reading yet */
+typedef bool_t (*pfSensorSample_t)(int32_t* pValue);
+
+/* One entry of the sensor registry */
+typedef struct sensorDriver_tag
+{
+    pfSensorSample_t    sample;
+    uint8_t             valId;      /* CUSTOM_CMD_VAL_ID its readings are reported as */
+    uint8_t             scale;      /* decimal digits after the point, CUSTOM_CMD_xxx_SCALE */
+    uint8_t             every;      /* sampled on every this many report ticks */
+} sensorDriver_t;
+
+/* Handles one received custom data frame, selected by its CUSTOM_CMD_FUNC */
+typedef void (*pfCustomDataHandler_t)(meshCustomData_t* pFrame);
+
+/************************************************************************************
+*************************************************************************************
+* Private memory declarations
+*************************************************************************************
+************************************************************************************/
+bool_t IsTimerStarted = FALSE;
+static bool_t mResumeReports = FALSE;        /* reports were running before the reset */
+static bool_t mFirstReportSent = FALSE;
+
+static uint32_t     mCustomReportInterval_sec;
+static uint16_t     mCustomReportMax_sec = 0;
+
+static uint32_t     mAdaptInterval_sec;
+static uint32_t     mAdaptElapsed_sec;
+static int32_t      mAdaptMean;
+static int32_t      mAdaptVar;
+static bool_t       mAdaptPrimed = FALSE;
+static uint8_t      mCustomReportSeq = 0;
+static uint8_t      mCustomSampleSeq = 0;
+
+static int32_t      mBatchSamples[mBatchMaxSamples_c];
+static uint8_t      mBatchCount = 0;
+static uint8_t      mBatchFirstSeq = 0;
+static uint16_t     mBatchStamp = CUSTOM_CMD_STAMP_NONE;	/* of the newest held sample */
+static uint8_t      mBatchSize = 1;
+static uint16_t     mBatchBudget_sec = 0;
+
+static int32_t      mFilterWindow[mFilterMaxTaps_c];
+static int32_t      mFilterSum;
+static int32_t      mFilterOut;
+static uint16_t     mFilterPeriod_ms = 500;
+static uint8_t      mFilterKind = CUSTOM_CMD_FILTER_NONE;
+static uint8_t      mFilterTaps = 1;
+static uint8_t      mFilterDecim = 1;
+static uint8_t      mFilterCount;
+static uint8_t      mFilterNext;
+static uint8_t      mFilterPhase;
+static bool_t       mFilterValid = FALSE;
+
+static tmrTimerID_t mListenTimerId;
+static uint8_t      mPowerCtrl = CUSTOM_CMD_SYS_AWAKE;
+static bool_t       mListening = FALSE;
+static bool_t       mSleepLocked = FALSE;
+static uint32_t     mPowerSince_ms = 0;
+
+static int32_t      mTimeOffset_ms;             /* mesh time minus local uptime */
+static uint8_t      mTimeEpoch;
+static bool_t       mTimeSynced = FALSE;
+
+static uint8_t      mRelayIds[mRelayMaxCandidates_c] = {mRelayDefaultId_c};
+static uint8_t      mRelayMisses[mRelayMaxCandidates_c];    /* unacknowledged reports in a row */
+static uint8_t      mRelayCount = 1;
+static uint8_t      mRelayCurrent;              /* index of the relay reports go to */
+static uint8_t      mRelayAckSeq;               /* hop sequence of the last frame of the last report */
+static bool_t       mRelayAckPending = FALSE;
+
+static bool_t           mAckMode = FALSE;
+static meshCustomData_t mRetxFrames[mRetxSlots_c];  /* oldest first */
+static uint8_t          mRetxTries[mRetxSlots_c];
+static uint8_t          mRetxCount;
+static uint16_t         mRetxWait_ms;
+
+static meshCustomData_t mFrames[mFrameSlots_c];
+
+static historyEntry_t mHistoryBuffer[mHistoryBatch_c];
+static uint8_t      mHistoryBuffered = 0;
+static uint8_t      mHistorySector;             /* sector being filled */
+static uint16_t     mHistorySlot;               /* its next free entry */
+static uint32_t     mHistoryNext;               /* log index of the next reading */
+static uint32_t     mHistoryTimeBase_s;         /* clock at boot, from the newest entry found */
+
+static int32_t      mUartReading;               /* latest line from the sensor UART */
+
+i2c_master_handle_t g_m_handle;
+volatile bool completionFlag = false;
+volatile bool nakFlag = false;
+
+osaEventId_t          mAppEvent;
+
+static uint32_t UartIpBuffCount = 0;
+static uint8_t UartIpData[10];
+
+/************************************************************************************
+*************************************************************************************
+* Private functions prototypes
+*************************************************************************************
+************************************************************************************/
+static void AppConfig();
+
+static meshResult_t MeshGenericCallback
+(
+    meshGenericEvent_t* pEvent
+);
+
+static void CustomReportTimerCallback(void* param);
+static void Report_Hold(int32_t value);
+static void Report_SendMulti(uint8_t due, int32_t* pValues);
+static meshAddress_t Report_Relay(void);
+static void Report_Listen(uint8_t hopSeq);
+static void Report_Start(void);
+static void Report_Stop(void);
+static void Report_StartTimer(void);
+static bool_t Adapt_Sample(int32_t value);
+static void Sample_Start(void);
+static void SampleTimerCallback(void* param);
+static bool_t Sample_Value(int32_t* pValue);
+#if gAppLeafDieTemp_d
+static bool_t DieTemp_Sample(int32_t* pValue);
+#endif
+static void Filter_Push(int32_t value);
+static int32_t Filter_Median(void);
+static int32_t Filter_Divide(int32_t sum, int32_t count);
+static void BatchBudgetTimerCallback(void* param);
+static void Batch_Flush(void);
+static void ListenTimerCallback(void* param);
+static void CustomData_Dispatch(meshCustomData_t* pFrame);
+static void CustomData_HandleReportConfig(meshCustomData_t* pFrame);
+static void CustomData_HandleBatchConfig(meshCustomData_t* pFrame);
+static void CustomData_HandleFilterConfig(meshCustomData_t* pFrame);
+static void CustomData_HandleHistoryQuery(meshCustomData_t* pFrame);
+static void CustomData_HandleTimeSync(meshCustomData_t* pFrame);
+static void CustomData_HandleDataAck(meshCustomData_t* pFrame);
+static void Relay_Heard(uint8_t id);
+static void Relay_Select(void);
+static bool_t DataAck_Covers(meshCustomData_t* pFrame, uint8_t seq);
+static void Retx_Hold(meshCustomData_t* pFrame);
+static void Retx_Remove(uint8_t index);
+static bool_t Retx_Resend(void);
+static uint32_t TimeSync_Now(void);
+static uint16_t TimeSync_Stamp(void);
+static bool_t Settings_Load(void);
+static void Settings_Save(void);
+static void Settings_Capture(settings_t* pRecord);
+static void Settings_Apply(settings_t* pRecord);
+static void History_Init(void);
+static historyHeader_t* History_Sector(uint8_t sector);
+static uint32_t History_Now(void);
+static void History_Append(int32_t value);
+static void History_Flush(void);
+static void History_Rotate(void);
+static uint32_t History_Oldest(void);
+static bool_t History_Read(uint32_t index, historyEntry_t* pEntry);
+
+static const pfCustomDataHandler_t mCustomDataHandlers[CUSTOM_CMD_FUNC_COUNT] =
+{
+    [CUSTOM_CMD_BATCH_CONFIG] = CustomData_HandleBatchConfig,
+    [CUSTOM_CMD_REPORT_CONFIG] = CustomData_HandleReportConfig,
+    [CUSTOM_CMD_ENERGY_QUERY] = CustomData_HandleEnergyQuery,
+    [CUSTOM_CMD_MEM_QUERY] = CustomData_HandleMemQuery,
+    [CUSTOM_CMD_FILTER_CONFIG] = CustomData_HandleFilterConfig,
+    [CUSTOM_CMD_SEG_STATUS] = CustomData_HandleSegStatus,
+    [CUSTOM_CMD_HISTORY_QUERY] = CustomData_HandleHistoryQuery,
+    [CUSTOM_CMD_TIME_SYNC] = CustomData_HandleTimeSync,
+    [CUSTOM_CMD_HOP_PROBE] = CustomData_HandleHopProbe,
+    [CUSTOM_CMD_NEIGHBOR_QUERY] = CustomData_HandleNeighborQuery,
+    [CUSTOM_CMD_HELLO] = CustomData_HandleHello,
+    [CUSTOM_CMD_DATA_ACK] = CustomData_HandleDataAck,
+};
+
+uint8_t gState;
+
+/* Sensors this leaf reports, the first being the one that is filtered and logged. With
+   one sensor readings are batched; with several, the readings of all sensors due on a
+   report tick are sent together in one frame. */
+static const sensorDriver_t mSensorDrivers[] =
+{
+    { Sample_Value, mLeafValId_c, mLeafScale_c, 1 },
+#if gAppLeafDieTemp_d
+    { DieTemp_Sample, CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_TEMP_SCALE, mDieTempEvery_c },
+#endif
+};
+
+#define mSensorCount_c					(sizeof(mSensorDrivers) / sizeof(mSensorDrivers[0]))
+
+/* Report ticks until each sensor is next sampled */
+static uint8_t mSensorWait[mSensorCount_c];
+
+/************************************************************************************
+*************************************************************************************
+* Public functions
+*************************************************************************************
+************************************************************************************/
+
+
+static void UartRxCallBack(void *pData)
+{
+    uint8_t pressedKey;
+    uint16_t count;
+    uint16_t byte_count;
+
+	Serial_RxBufferByteCount(gAppSerialId, &count);
+
+    if(count > sizeof(UartIpData) - UartIpBuffCount)
+    {
+        /* Line longer than any valid reading, drop it */
+        count = sizeof(UartIpData) - UartIpBuffCount;
+    }
+    Serial_Read(gAppSerialId, &UartIpData[UartIpBuffCount], count, &byte_count);
+
+   // for(int i=UartIpBuffCount;i<count+UartIpBuffCount;i++)
+    	//debug_printf("%d %x %c\r\n",UartIpData[i],UartIpData[i],UartIpData[i]);
+
+    UartIpBuffCount+=count;
+
+    if((UartIpBuffCount >= 2) && (UartIpData[UartIpBuffCount-1] == 0x0A))
+    {
+    	int32_t sum=0;
+    	int32_t mult=10;
+    	sum+=(UartIpData[UartIpBuffCount-2]-48);
+    	//debug_printf("0 sum = %d\r\n",sum);
+    	for(int i=UartIpBuffCount-3;i>=0;i--)
+    	{
+    		//for(int j=UartIpBuffCount-3;j>i;mult*=10,j--);
+    		if(UartIpData[i] == '-')
+    		{
+    			sum = -sum;
+    			break;
+    		}
+    		sum+=((UartIpData[i]-48) * mult);
+    		mult*=10;
+    		//debug_printf("%d %d sum = %d mult = %d\r\n",i,(UartIpData[i]-48),sum,mult);
+    	}
+    	mUartReading = sum;
+    	UartIpBuffCount = 0;
+    }
+    else if(UartIpBuffCount == sizeof(UartIpData))
+    {
+    	UartIpBuffCount = 0;
+    }
+
+    //debug_printf("UartRxCallBack ++ Temp = %d count  = %d Datacount %d\r\n",Temp_Read_Val,count,UartIpBuffCount);
+    debug_printf("UartRxCallBack ++ " mLeafName_c " Read val = %d\r\n",mUartReading);
+
+}
+
+void BleApp_Init(void)
+{    
+    Mem_TrackMainTask();
+    BOARD_InitAdc();
+#if gAppTempSensor_d
+    EnableIRQ(ADC0_IRQn);
+#endif
+    
+    RNG_Init();
+    
+    SerialManager_Init();
+
+    Serial_InitInterface(&gAppSerialId, APP_SERIAL_INTERFACE_TYPE, APP_SERIAL_INTERFACE_INSTANCE);
+    Serial_SetBaudRate(gAppSerialId, gUARTBaudRate115200_c);
+    Serial_SetRxCallBack(gAppSerialId, UartRxCallBack, NULL);
+
+    uint8_t rngSeed[20] = { BD_ADDR_ID };
+    RNG_SetPseudoRandomNoSeed(rngSeed);
+    mCustomReportInterval_sec = 5;
+
+    /* Stay awake until the relay asks for CUSTOM_CMD_SYS_SLEEP */
+    mPowerSince_ms = OSA_TimeGetMsec();
+    Power_Update();
+
+    //I2C_MasterTransferCreateHandle(BOARD_ACCEL_I2C_BASEADDR, &g_m_handle, i2c_master_callback, NULL);
+
+    debug_printf("BLE Light Switch ID: %d Multicast Addr: %d - 0x%x\n\r", BD_ADDR_ID,ADDRESS,(uint32_t)(ADDRESS));
+
+}
+
+void BleApp_GenericCallback (gapGenericEvent_t* pGenericEvent)
+{
+    switch (pGenericEvent->eventType)
+    {
+        case gInitializationComplete_c:    
+        {
+            AppConfig();
+        }
+        break;        
+
+        case gInternalError_c:
+        {
+            Led2On();
+            panic(0,0,0,0);
+        }
+        break;
+
+        default: 
+            break;
+    }
+}
+
+void BleApp_HandleKeys(key_event_t events)
+{
+    switch (events)
+    {       
+        case gKBD_EventPressPB1_c:
+            /* Fallthrough */
+        //case gKBD_EventPressPB2_c:
+        {
+        	debug_printf("Switch Pressed: 4\n\r");
+
+/*
+#if gAppLightBulb_d
+            mLightState = !mLightState;
+            UpdateLightUI(mLightState);
+            MeshLightServer_PublishState(mLightState);
+#elif gAppLightSwitch_d
+            MeshLightClient_PublishToggleLight();
+#endif
+            meshAddress_t destination = GetMeshAddressFromId(11);
+            meshCustomData_t CustomData;
+            CustomData.aData[0] = 0xFD;
+            CustomData.aData[1] = 0xFC;
+            CustomData.dataLength = 2;
+            Mesh_SendCustomData(destination,&CustomData);
+
+*/
+
+		    Report_Start();
+
+        }
+        break;
+
+        //case gKBD_EventPressPB3_c:
+            /* Fallthrough */
+        //case gKBD_EventPressPB4_c:
+        case gKBD_EventPressPB2_c:
+        {
+        	debug_printf("Switch Pressed: 3\n\r");
+		    Report_Stop();
+#if 0
+#if gAppTempSensor_d
+            int16_t tempCelsius = BOARD_GetTemperature();
+            MeshTemperatureServer_PublishTemperature(tempCelsius);
+#endif            
+#endif
+		}
+        break;
+        
+        default:
+            break;
+    }
+}
+
+/*
+#define CUSTOM_CMD_SOURCE				0
+#define CUSTOM_CMD_DEST					1
+#define CUSTOM_CMD_POLL_ITVL_0			2
+#define CUSTOM_CMD_POLL_ITVL_1			3
+#define CUSTOM_CMD_POLL_ITVL_2			4
+#define CUSTOM_CMD_POLL_ITVL_3			5
+#define CUSTOM_CMD_POWER_CTRL			6
+#define CUSTOM_CMD_VAL_ID				7
+#define CUSTOM_CMD_VAL_0				8
+#define CUSTOM_CMD_VAL_1				9
+#define CUSTOM_CMD_VAL_2				10
+#define CUSTOM_CMD_VAL_3				11
+
+#define CUSTOM_CMD_TEMP_ID				1
+#define CUSTOM_CMD_LIGHT_ID				2
+#define CUSTOM_CMD_SYS_AWAKE			1
+#define CUSTOM_CMD_SYS_SLEEP			2
+ */
+
+static void CustomReportTimerCallback(void* param)
+{
+    int32_t aValues[mSensorCount_c];
+    uint8_t due = 0;
+
+    for (uint8_t i = 0; i < mSensorCount_c; i++)
+    {
+        if (mSensorWait[i])
+        {
+            mSensorWait[i]--;
+            continue;
+        }
+        mSensorWait[i] = mSensorDrivers[i].every - 1;
+        if (mSensorDrivers[i].sample(&aValues[i]))
+        {
+            due |= (uint8_t)(1 << i);
+        }
+    }
+
+    if (mSensorCount_c == 1)
+    {
+        if (due)
+        {
+            Report_Hold(aValues[0]);
+        }
+    }
+    else if (due)
+    {
+        Report_SendMulti(due, aValues);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Holds a reading of the only sensor for the next batch, subject to
+*               adaptive reporting, and sends the batch once it is full.
+*
+* \param[in]    value   Reading in the sensor's fixed-point scale.
+********************************************************************************** */
+static void Report_Hold(int32_t value)
+{
+    /* Every tick takes a sample, adaptive mode only reports some of them */
+    if (!Adapt_Sample(value))
+    {
+        return;
+    }
+
+    if (mBatchCount == 0)
+    {
+        mBatchFirstSeq = mCustomSampleSeq;
+    }
+    mBatchSamples[mBatchCount++] = value;
+    mBatchStamp = TimeSync_Stamp();
+    mCustomSampleSeq++;
+    gEnergyStats.readings++;
+    /* Logged whether or not the report gets through, for backfill */
+    History_Append(value);
+
+    if (mBatchCount >= mBatchSize)
+    {
+        Sched_Stop(mSchedBatch_c);
+        Batch_Flush();
+    }
+    else if ((mBatchCount == 1) && (mBatchBudget_sec != 0))
+    {
+        /* The oldest held sample bounds how long a reading may be delayed */
+        Sched_Start(mSchedBatch_c, BatchBudgetTimerCallback, 1000 * (uint32_t)mBatchBudget_sec, 0);
+    }
+}
+
+static void Report_Start(void)
+{
+    if (IsTimerStarted)
+    {
+        return;
+    }
+    Report_StartTimer();
+    Sample_Start();
+    IsTimerStarted = TRUE;
+    debug_printf("Start report timer interval: %d\n\r",mCustomReportInterval_sec);
+    Settings_Save();
+}
+
+static void Report_Stop(void)
+{
+    if (!IsTimerStarted)
+    {
+        return;
+    }
+    Sched_Stop(mSchedReport_c);
+    Sched_Stop(mSchedSample_c);
+    Sched_Stop(mSchedBatch_c);
+    Batch_Flush();
+    IsTimerStarted = FALSE;
+    debug_printf("Stop report timer\n\r");
+    Power_Update();
+    debug_printf("Awake %d s asleep %d s\n\r",
+            (uint32_t)(gEnergyStats.awake_ms / 1000), (uint32_t)(gEnergyStats.asleep_ms / 1000));
+    Settings_Save();
+}
+
+/*! *********************************************************************************
+* \brief        (Re)starts the sampling timer at mCustomReportInterval_sec and starts
+*               adaptive reporting over from the minimum interval.
+********************************************************************************** */
+static void Report_StartTimer(void)
+{
+    mAdaptInterval_sec = mCustomReportInterval_sec;
+    mAdaptElapsed_sec = 0;
+    mAdaptPrimed = FALSE;
+    FLib_MemSet(mSensorWait, 0, sizeof(mSensorWait));
+
+    Sched_Start
+    (
+        mSchedReport_c,
+        CustomReportTimerCallback,
+        1000 * mCustomReportInterval_sec, // 1000 * reqd seconds
+        1000 * mCustomReportInterval_sec
+    );
+}
+
+/*! *********************************************************************************
+* \brief        Tracks an exponentially weighted mean and variance of the samples and
+*               decides whether this one is reported. A changing signal brings the
+*               report interval down to mCustomReportInterval_sec at once; a flat one
+*               lets it grow by a quarter per report up to mCustomReportMax_sec.
+*
+* \param[in]    value   Sample in the sensor's fixed-point scale.
+*
+* \return       TRUE if the sample is due for reporting.
+********************************************************************************** */
+static bool_t Adapt_Sample(int32_t value)
+{
+    int32_t diff;
+    int64_t square;
+    uint32_t step;
+
+    if (mCustomReportMax_sec <= mCustomReportInterval_sec)
+    {
+        return TRUE;
+    }
+
+    if (!mAdaptPrimed)
+    {
+        mAdaptMean = value * (1 << mAdaptFrac_c);
+        mAdaptVar = 0;
+        mAdaptPrimed = TRUE;
+    }
+
+    diff = value * (1 << mAdaptFrac_c) - mAdaptMean;
+    mAdaptMean += diff >> mAdaptShift_c;
+    square = ((int64_t)diff * diff) >> mAdaptFrac_c;
+    if (square > INT32_MAX)
+    {
+        square = INT32_MAX;
+    }
+    mAdaptVar += ((int32_t)square - mAdaptVar) >> mAdaptShift_c;
+
+    if (mAdaptVar > mAdaptVarHigh_c)
+    {
+        mAdaptInterval_sec = mCustomReportInterval_sec;
+    }
+
+    mAdaptElapsed_sec += mCustomReportInterval_sec;
+    if (mAdaptElapsed_sec < mAdaptInterval_sec)
+    {
+        return FALSE;
+    }
+    mAdaptElapsed_sec = 0;
+
+    if (mAdaptVar < mAdaptVarLow_c)
+    {
+        step = mAdaptInterval_sec / 4;
+        mAdaptInterval_sec += (step != 0) ? step : 1;
+        if (mAdaptInterval_sec > mCustomReportMax_sec)
+        {
+            mAdaptInterval_sec = mCustomReportMax_sec;
+        }
+    }
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Starts the oversampling timer over with an empty filter window, or
+*               stops it when no filter is configured.
+********************************************************************************** */
+static void Sample_Start(void)
+{
+    mFilterSum = 0;
+    mFilterCount = 0;
+    mFilterNext = 0;
+    mFilterPhase = 0;
+    mFilterValid = FALSE;
+
+    if (mFilterKind != CUSTOM_CMD_FILTER_NONE)
+    {
+        Sched_Start(mSchedSample_c, SampleTimerCallback, mFilterPeriod_ms, mFilterPeriod_ms);
+    }
+    else
+    {
+        Sched_Stop(mSchedSample_c);
+    }
+}
+
+#if gAppLeafDieTemp_d
+/*! *********************************************************************************
+* \brief        On-chip temperature driver: returns the last conversion and starts the
+*               next one, so the reading is at most one sampling period old. Until the
+*               first conversion completes there is no reading to report.
+********************************************************************************** */
+static bool_t DieTemp_Sample(int32_t* pValue)
+{
+    int16_t celsius;
+
+    TempSensor_Request();
+    if (!TempSensor_Get(&celsius))
+    {
+        return FALSE;
+    }
+    *pValue = celsius;
+    return TRUE;
+}
+#endif
+
+static void SampleTimerCallback(void* param)
+{
+    Filter_Push(mUartReading);
+}
+
+/*! *********************************************************************************
+* \brief        Returns the value to report: the latest filter output, or the raw
+*               reading when no filter is configured or none has been produced yet.
+********************************************************************************** */
+static bool_t Sample_Value(int32_t* pValue)
+{
+    if ((mFilterKind == CUSTOM_CMD_FILTER_NONE) || !mFilterValid)
+    {
+        *pValue = mUartReading;
+    }
+    else
+    {
+        *pValue = mFilterOut;
+    }
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Adds a raw sample to the filter window and, once every mFilterDecim
+*               samples, computes a new output from the samples in the window.
+*
+* \param[in]    value   Raw reading in the sensor's fixed-point scale.
+********************************************************************************** */
+static void Filter_Push(int32_t value)
+{
+    if (mFilterCount == mFilterTaps)
+    {
+        mFilterSum -= mFilterWindow[mFilterNext];
+    }
+    else
+    {
+        mFilterCount++;
+    }
+    mFilterWindow[mFilterNext] = value;
+    mFilterSum += value;
+    mFilterNext = (mFilterNext + 1 < mFilterTaps) ? (mFilterNext + 1) : 0;
+
+    if (++mFilterPhase < mFilterDecim)
+    {
+        return;
+    }
+    mFilterPhase = 0;
+
+    mFilterOut = (mFilterKind == CUSTOM_CMD_FILTER_MEDIAN) ?
+            Filter_Median() : Filter_Divide(mFilterSum, mFilterCount);
+    mFilterValid = TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Median of the samples in the window by insertion sort, which costs
+*               less than a selection algorithm at mFilterMaxTaps_c samples. An even
+*               count gives the rounded mean of the two middle samples.
+********************************************************************************** */
+static int32_t Filter_Median(void)
+{
+    int32_t aSorted[mFilterMaxTaps_c];
+    int32_t value;
+    uint8_t j;
+
+    for (uint8_t i = 0; i < mFilterCount; i++)
+    {
+        value = mFilterWindow[i];
+        for (j = i; (j > 0) && (aSorted[j - 1] > value); j--)
+        {
+            aSorted[j] = aSorted[j - 1];
+        }
+        aSorted[j] = value;
+    }
+
+    if (mFilterCount & 1)
+    {
+        return aSorted[mFilterCount / 2];
+    }
+    return Filter_Divide(aSorted[mFilterCount / 2 - 1] + aSorted[mFilterCount / 2], 2);
+}
+
+/* Division rounded to nearest, halves away from zero */
+static int32_t Filter_Divide(int32_t sum, int32_t count)
+{
+    return (sum >= 0) ? ((sum + count / 2) / count) : ((sum - count / 2) / count);
+}
+
+static void BatchBudgetTimerCallback(void* param)
+{
+    Batch_Flush();
+}
+
+/*! *********************************************************************************
+* \brief        Sends every held sample to the relay, using as many frames as the
+*               custom data payload requires.
+********************************************************************************** */
+static void Batch_Flush(void)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameData_c];
+    meshAddress_t destination;
+    uint16_t stamp;
+    uint8_t packed;
+
+    if (!mBatchCount)
+    {
+        return;
+    }
+
+    destination = Report_Relay();
+    pFrame->aData[CUSTOM_CMD_DEST] = GetIdFromMeshAddress(destination);
+    pFrame->aData[CUSTOM_CMD_VAL_ID] = mLeafValId_c;
+
+    while (mBatchCount)
+    {
+        pFrame->aData[CUSTOM_CMD_SEQ] = mBatchFirstSeq;
+        pFrame->aData[CUSTOM_CMD_HOP_SEQ] = mCustomReportSeq++;
+        packed = CustomData_PackSamples(pFrame, mBatchSamples, mBatchCount);
+        /* Only the frame carrying the newest sample has a known time */
+        stamp = (packed == mBatchCount) ? mBatchStamp : CUSTOM_CMD_STAMP_NONE;
+        Frame_PutU16(pFrame, CUSTOM_CMD_STAMP_0, stamp);
+
+        CustomData_Send(destination, pFrame);
+        if (mAckMode)
+        {
+            Retx_Hold(pFrame);
+        }
+        debug_printf("Custom data Sent to: %d samples: %d\n\r",GetIdFromMeshAddress(destination),packed);
+        debug_printf("Data is: ");
+        for(int i = 0; i<pFrame->dataLength && i<gMeshMaxAppCustomDataSize_c;
+        		i++)
+        {
+        	debug_printf("0x%x ", pFrame->aData[i]);
+        }
+        debug_printf("\r\n");
+
+        mBatchCount -= packed;
+        mBatchFirstSeq += packed;
+        for (uint8_t i = 0; i < mBatchCount; i++)
+        {
+            mBatchSamples[i] = mBatchSamples[i + packed];
+        }
+    }
+    Report_Listen(pFrame->aData[CUSTOM_CMD_HOP_SEQ]);
+}
+
+/*! *********************************************************************************
+* \brief        Sends the readings of the sensors due on this report tick in one
+*               frame. Only readings too long to share it spill into another.
+*
+* \param[in]    due         Bit n set when mSensorDrivers[n] returned a reading.
+* \param[in]    pValues     Reading of each sampled sensor, by registry index.
+********************************************************************************** */
+static void Report_SendMulti(uint8_t due, int32_t* pValues)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameData_c];
+    meshAddress_t destination = Report_Relay();
+    uint8_t aValue[CUSTOM_CMD_VAL_MAX_LEN];
+    uint16_t stamp = TimeSync_Stamp();
+    uint8_t seq = mCustomSampleSeq++;
+    uint8_t len;
+
+    pFrame->aData[CUSTOM_CMD_DEST] = GetIdFromMeshAddress(destination);
+    pFrame->aData[CUSTOM_CMD_SEQ] = seq;
+    pFrame->aData[CUSTOM_CMD_VAL_ID] = CUSTOM_CMD_MULTI_ID;
+    Frame_PutU16(pFrame, CUSTOM_CMD_STAMP_0, stamp);
+    pFrame->dataLength = 0;
+    for (uint8_t i = 0; i < mSensorCount_c; i++)
+    {
+        if (!(due & (1 << i)))
+        {
+            continue;
+        }
+
+        len = CustomData_EncodeValue(aValue, pValues[i]);
+        if (pFrame->dataLength + 1 + len > gMeshMaxAppCustomDataSize_c)
+        {
+            CustomData_Send(destination, pFrame);
+            if (mAckMode)
+            {
+                Retx_Hold(pFrame);
+            }
+            pFrame->dataLength = 0;
+        }
+
+        if (!pFrame->dataLength)
+        {
+            pFrame->aData[CUSTOM_CMD_HOP_SEQ] = mCustomReportSeq++;
+            pFrame->dataLength = CUSTOM_CMD_VAL;
+        }
+
+        pFrame->aData[pFrame->dataLength++] = mSensorDrivers[i].valId;
+        FLib_MemCpy(&pFrame->aData[pFrame->dataLength], aValue, len);
+        pFrame->dataLength += len;
+        gEnergyStats.readings++;
+    }
+
+    CustomData_Send(destination, pFrame);
+    if (mAckMode)
+    {
+        Retx_Hold(pFrame);
+    }
+    debug_printf("Custom data Sent to: %d sensors: 0x%x\n\r", GetIdFromMeshAddress(destination), due);
+
+    if (due & 1)
+    {
+        History_Append(pValues[0]);
+    }
+    Report_Listen(pFrame->aData[CUSTOM_CMD_HOP_SEQ]);
+}
+
+/*! *********************************************************************************
+* \brief        Picks the relay for a report, failing over when the current one left
+*               too many reports unacknowledged, and gives frames still held for
+*               resending another round after it.
+*
+* \return       Mesh address of the relay.
+********************************************************************************** */
+static meshAddress_t Report_Relay(void)
+{
+    /* The previous report's listen window has closed without an acknowledgement */
+    if (mRelayAckPending)
+    {
+        mRelayAckPending = FALSE;
+        if (mRelayMisses[mRelayCurrent] < 0xFF)
+        {
+            mRelayMisses[mRelayCurrent]++;
+        }
+        if (mRelayMisses[mRelayCurrent] == mRelayFailLimit_c)
+        {
+            uint8_t failed = mRelayIds[mRelayCurrent];
+
+            Relay_Select();
+            debug_printf("Relay %d not acknowledging, reporting to %d\r\n",
+                    failed, mRelayIds[mRelayCurrent]);
+        }
+    }
+
+    /* Frames still held get another round of resends after this report */
+    for (uint8_t i = 0; i < mRetxCount; i++)
+    {
+        mRetxTries[i] = 0;
+    }
+    mRetxWait_ms = mRetxBackoff_ms;
+
+    return GetMeshAddressFromId(mRelayIds[mRelayCurrent]);
+}
+
+/*! *********************************************************************************
+* \brief        Opens the listen window that follows a report, and marks the first
+*               report sent whichever path sent it.
+*
+* \param[in]    hopSeq  CUSTOM_CMD_HOP_SEQ of the report's last frame.
+********************************************************************************** */
+static void Report_Listen(uint8_t hopSeq)
+{
+    if (!mFirstReportSent)
+    {
+        mFirstReportSent = TRUE;
+        debug_printf("First report %d ms after boot\r\n", OSA_TimeGetMsec());
+    }
+
+    mRelayAckSeq = hopSeq;
+    mRelayAckPending = TRUE;
+
+    /* A relay holding configuration for a sleeping leaf sends it on this report */
+    mListening = TRUE;
+    Power_Update();
+    TMR_StartLowPowerTimer
+    (
+        mListenTimerId,
+        gTmrLowPowerSingleShotMillisTimer_c,
+        mSleepListenWindow_ms,
+        ListenTimerCallback,
+        NULL
+    );
+}
+
+static void ListenTimerCallback(void* param)
+{
+    /* The radio stays up while unacknowledged frames are resent */
+    if (mAckMode && Retx_Resend())
+    {
+        TMR_StartLowPowerTimer
+        (
+            mListenTimerId,
+            gTmrLowPowerSingleShotMillisTimer_c,
+            mRetxWait_ms,
+            ListenTimerCallback,
+            NULL
+        );
+        mRetxWait_ms *= 2;
+        return;
+    }
+
+    mListening = FALSE;
+    Power_Update();
+}
+
+/*! *********************************************************************************
+* \brief        Keeps the device out of deep sleep while it is told to stay awake or
+*               a listen window is open, and accounts the time spent in each state.
+*               The sleep lock is taken and released once per transition so the
+*               PWR module's counter stays balanced.
+********************************************************************************** */
+void Power_Update(void)
+{
+    bool_t   awake = (mPowerCtrl != CUSTOM_CMD_SYS_SLEEP) || mListening || Segment_IsBusy() || Neighbor_IsBusy();
+    uint32_t now = OSA_TimeGetMsec();
+
+    if (mSleepLocked)
+    {
+        gEnergyStats.awake_ms += now - mPowerSince_ms;
+    }
+    else
+    {
+        gEnergyStats.asleep_ms += now - mPowerSince_ms;
+    }
+    mPowerSince_ms = now;
+
+    if (awake && !mSleepLocked)
+    {
+        PWR_DisallowDeviceToSleep();
+    }
+    else if (!awake && mSleepLocked)
+    {
+        PWR_AllowDeviceToSleep();
+    }
+    mSleepLocked = awake;
+}
+
+/*! *********************************************************************************
+* \brief        Hands a received frame addressed to this node to the handler of its
+*               function code.
+*
+* \param[in]    pFrame  Received custom data.
+********************************************************************************** */
+static void CustomData_Dispatch(meshCustomData_t* pFrame)
+{
+    uint8_t func = pFrame->aData[CUSTOM_CMD_FUNC];
+
+    Mem_Sample();
+
+    if ((pFrame->dataLength <= CUSTOM_CMD_FUNC) || (pFrame->dataLength > gMeshMaxAppCustomDataSize_c))
+    {
+        return;
+    }
+
+    if ((pFrame->aData[CUSTOM_CMD_DEST] != BD_ADDR_ID) && (pFrame->aData[CUSTOM_CMD_DEST] != CUSTOM_CMD_DEST_ALL))
+    {
+        return;
+    }
+
+    if ((func < CUSTOM_CMD_FUNC_COUNT) && mCustomDataHandlers[func])
+    {
+        mCustomDataHandlers[func](pFrame);
+    }
+}
+
+static void CustomData_HandleReportConfig(meshCustomData_t* pFrame)
+{
+    if (pFrame->dataLength < CUSTOM_CMD_REPORT_CONFIG_LEN)
+    {
+        return;
+    }
+
+    mCustomReportInterval_sec = (uint32_t)(
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_0]));
+    mCustomReportMax_sec = (uint16_t)(
+            (pFrame->aData[CUSTOM_CMD_POLL_MAX_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_POLL_MAX_0]));
+
+    if ((pFrame->aData[CUSTOM_CMD_POWER_CTRL] == CUSTOM_CMD_SYS_AWAKE) ||
+        (pFrame->aData[CUSTOM_CMD_POWER_CTRL] == CUSTOM_CMD_SYS_SLEEP))
+    {
+        mPowerCtrl = pFrame->aData[CUSTOM_CMD_POWER_CTRL];
+    }
+
+    debug_printf("\r\nSource: %d Dest: %d Poll Time: %d Max: %d Power: %d\r\n",
+            pFrame->aData[CUSTOM_CMD_SOURCE], pFrame->aData[CUSTOM_CMD_DEST],
+            mCustomReportInterval_sec, mCustomReportMax_sec, mPowerCtrl);
+
+    if (IsTimerStarted)
+    {
+        Report_StartTimer();
+    }
+
+    Settings_Save();
+
+    /* The acknowledgement goes out inside the listen window, sleep follows it */
+    CustomData_SendAck(pFrame);
+    Power_Update();
+}
+
+static void CustomData_HandleBatchConfig(meshCustomData_t* pFrame)
+{
+    if (pFrame->dataLength < CUSTOM_CMD_BATCH_CONFIG_LEN)
+    {
+        return;
+    }
+
+    mBatchSize = pFrame->aData[CUSTOM_CMD_BATCH_SIZE];
+    if (mBatchSize == 0)
+    {
+        mBatchSize = 1;
+    }
+    else if (mBatchSize > mBatchMaxSamples_c)
+    {
+        mBatchSize = mBatchMaxSamples_c;
+    }
+    mBatchBudget_sec = (uint16_t)(
+            (pFrame->aData[CUSTOM_CMD_BATCH_BUDGET_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_BATCH_BUDGET_0]));
+    mAckMode = (pFrame->aData[CUSTOM_CMD_BATCH_FLAGS] & CUSTOM_CMD_BATCH_ACKED) ? TRUE : FALSE;
+    if (!mAckMode)
+    {
+        mRetxCount = 0;
+    }
+
+    debug_printf("\r\nBatch size: %d budget: %d acknowledged: %d\r\n", mBatchSize, mBatchBudget_sec, mAckMode);
+
+    /* Apply the new size from the next sample on */
+    Sched_Stop(mSchedBatch_c);
+    Batch_Flush();
+    Settings_Save();
+
+    /* Every leaf answering a broadcast at once would only congest the mesh */
+    if (pFrame->aData[CUSTOM_CMD_DEST] != CUSTOM_CMD_DEST_ALL)
+    {
+        CustomData_SendAck(pFrame);
+    }
+}
+
+static void CustomData_HandleFilterConfig(meshCustomData_t* pFrame)
+{
+    uint8_t kind = pFrame->aData[CUSTOM_CMD_FILTER_KIND];
+    uint8_t taps = pFrame->aData[CUSTOM_CMD_FILTER_TAPS];
+    uint8_t decim = pFrame->aData[CUSTOM_CMD_FILTER_DECIM];
+    uint16_t period_ms = (uint16_t)(
+            (pFrame->aData[CUSTOM_CMD_FILTER_PERIOD_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_FILTER_PERIOD_0]));
+
+    if ((pFrame->dataLength < CUSTOM_CMD_FILTER_CONFIG_LEN) || (kind > CUSTOM_CMD_FILTER_MEDIAN) ||
+        (taps == 0) || (taps > mFilterMaxTaps_c) || (decim == 0) || (period_ms < mFilterMinPeriod_ms) ||
+        (period_ms % mSchedTick_ms))
+    {
+        return;
+    }
+
+    mFilterKind = kind;
+    mFilterTaps = taps;
+    mFilterDecim = decim;
+    mFilterPeriod_ms = period_ms;
+    debug_printf("\r\nFilter %d taps: %d period: %d ms decimation: %d\r\n", kind, taps, period_ms, decim);
+
+    if (IsTimerStarted)
+    {
+        Sample_Start();
+    }
+    Settings_Save();
+
+    /* Every leaf answering a broadcast at once would only congest the mesh */
+    if (pFrame->aData[CUSTOM_CMD_DEST] != CUSTOM_CMD_DEST_ALL)
+    {
+        CustomData_SendAck(pFrame);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Disciplines the mesh time offset to a time beacon. Only the first copy
+*               of each beacon is used, later copies took a longer path. The first
+*               beacon or a large error steps the offset; otherwise it is slewed by a
+*               quarter of the error, which averages out the jitter of the hops.
+*
+* \param[in]    pFrame  CUSTOM_CMD_TIME_SYNC frame.
+********************************************************************************** */
+static void CustomData_HandleTimeSync(meshCustomData_t* pFrame)
+{
+    uint32_t now_ms = OSA_TimeGetMsec();
+    uint8_t epoch = pFrame->aData[CUSTOM_CMD_TIME_EPOCH];
+    uint32_t mesh_ms;
+    int32_t error;
+
+    if (pFrame->dataLength < CUSTOM_CMD_TIME_SYNC_LEN)
+    {
+        return;
+    }
+
+    /* Only aggregating relays repeat beacons, so every repeated copy names one */
+    if (pFrame->aData[CUSTOM_CMD_TIME_HOPS])
+    {
+        Relay_Heard(pFrame->aData[CUSTOM_CMD_SOURCE]);
+    }
+
+    if (mTimeSynced && (epoch == mTimeEpoch))
+    {
+        return;
+    }
+
+    FLib_MemCpy(&mesh_ms, &pFrame->aData[CUSTOM_CMD_TIME_MS_0], sizeof(mesh_ms));
+    mesh_ms += mTimeSyncHopDelay_ms;
+    error = (int32_t)(mesh_ms - now_ms) - mTimeOffset_ms;
+
+    if (!mTimeSynced || (error > mTimeSyncStep_ms) || (error < -mTimeSyncStep_ms))
+    {
+        mTimeOffset_ms += error;
+    }
+    else
+    {
+        mTimeOffset_ms += error / 4;
+    }
+    mTimeEpoch = epoch;
+    mTimeSynced = TRUE;
+
+    debug_printf("Time beacon %d hops: %d error: %d ms\r\n",
+            epoch, pFrame->aData[CUSTOM_CMD_TIME_HOPS], error);
+}
+
+/*! *********************************************************************************
+* \brief        Releases the held frames an acknowledgement covers, and clears the miss
+*               count of the current relay once it has the last report.
+*
+* \param[in]    pFrame  CUSTOM_CMD_DATA_ACK frame.
+********************************************************************************** */
+static void CustomData_HandleDataAck(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t index = 0;
+
+    if (pFrame->dataLength < CUSTOM_CMD_DATA_ACK_LEN)
+    {
+        return;
+    }
+
+    /* A frame a relay has is delivered, even if that relay has been given up on */
+    while (index < mRetxCount)
+    {
+        if (DataAck_Covers(pFrame, mRetxFrames[index].aData[CUSTOM_CMD_HOP_SEQ]))
+        {
+            Retx_Remove(index);
+        }
+        else
+        {
+            index++;
+        }
+    }
+
+    if (!mRelayAckPending || (source != mRelayIds[mRelayCurrent]) || !DataAck_Covers(pFrame, mRelayAckSeq))
+    {
+        return;
+    }
+
+    mRelayAckPending = FALSE;
+    mRelayMisses[mRelayCurrent] = 0;
+}
+
+/*! *********************************************************************************
+* \brief        Adds a relay heard repeating a time beacon to the candidates. A relay
+*               given up on is tried again once it is heard, since it is evidently up.
+*
+* \param[in]    id  Node ID of the relay.
+********************************************************************************** */
+static void Relay_Heard(uint8_t id)
+{
+    uint8_t current = mRelayIds[mRelayCurrent];
+    uint8_t pos;
+
+    for (pos = 0; pos < mRelayCount; pos++)
+    {
+        if (mRelayIds[pos] == id)
+        {
+            if (mRelayMisses[pos] < mRelayFailLimit_c)
+            {
+                return;
+            }
+            mRelayMisses[pos] = 0;
+            Relay_Select();
+            return;
+        }
+        if (mRelayIds[pos] > id)
+        {
+            break;
+        }
+    }
+
+    /* The default relay is only a placeholder until a real one is heard */
+    if ((mRelayCount == 1) && (mRelayIds[0] == mRelayDefaultId_c) && !mRelayMisses[0] &&
+        !mFirstReportSent)
+    {
+        mRelayIds[0] = id;
+        return;
+    }
+
+    if (mRelayCount == mRelayMaxCandidates_c)
+    {
+        return;
+    }
+
+    for (uint8_t i = mRelayCount; i > pos; i--)
+    {
+        mRelayIds[i] = mRelayIds[i - 1];
+        mRelayMisses[i] = mRelayMisses[i - 1];
+    }
+    mRelayIds[pos] = id;
+    mRelayMisses[pos] = 0;
+    mRelayCount++;
+    if (mRelayCurrent >= pos)
+    {
+        mRelayCurrent++;
+    }
+
+    Relay_Select();
+    if (mRelayIds[mRelayCurrent] != current)
+    {
+        /* An acknowledgement from the old relay no longer counts */
+        mRelayAckPending = FALSE;
+        debug_printf("Relay %d heard, reporting to %d\r\n", id, mRelayIds[mRelayCurrent]);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Picks the relay reports go to. Leaves spread over the relays that are
+*               still acknowledging by their own ID, so every leaf with the same
+*               candidates makes the same choice and each relay aggregates a share.
+*               With none acknowledging, the one with the fewest misses is tried.
+********************************************************************************** */
+static void Relay_Select(void)
+{
+    uint8_t healthy = 0;
+    uint8_t best = 0;
+
+    for (uint8_t i = 0; i < mRelayCount; i++)
+    {
+        if (mRelayMisses[i] < mRelayFailLimit_c)
+        {
+            healthy++;
+        }
+        if (mRelayMisses[i] < mRelayMisses[best])
+        {
+            best = i;
+        }
+    }
+
+    if (!healthy)
+    {
+        mRelayCurrent = best;
+        return;
+    }
+
+    healthy = BD_ADDR_ID % healthy;
+    for (uint8_t i = 0; i < mRelayCount; i++)
+    {
+        if (mRelayMisses[i] < mRelayFailLimit_c)
+        {
+            if (!healthy)
+            {
+                mRelayCurrent = i;
+                return;
+            }
+            healthy--;
+        }
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Tells whether an acknowledgement covers a hop sequence number.
+*
+* \param[in]    pFrame  CUSTOM_CMD_DATA_ACK frame.
+* \param[in]    seq     CUSTOM_CMD_HOP_SEQ of a frame sent.
+*
+* \return       TRUE if the relay has received that frame.
+********************************************************************************** */
+static bool_t DataAck_Covers(meshCustomData_t* pFrame, uint8_t seq)
+{
+    uint8_t age = (uint8_t)(pFrame->aData[CUSTOM_CMD_DATA_ACK_SEQ] - seq);
+    uint16_t map = (uint16_t)(
+            (pFrame->aData[CUSTOM_CMD_DATA_ACK_MAP_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_DATA_ACK_MAP_0]));
+
+    return ((age < 16) && (map & (1 << age))) ? TRUE : FALSE;
+}
+
+/*! *********************************************************************************
+* \brief        Keeps a sent report frame until a relay acknowledges it. With every
+*               slot taken the oldest frame is given up on.
+*
+* \param[in]    pFrame  Frame just sent.
+********************************************************************************** */
+static void Retx_Hold(meshCustomData_t* pFrame)
+{
+    if (mRetxCount == mRetxSlots_c)
+    {
+        debug_printf("Report %d never acknowledged, dropped\r\n", mRetxFrames[0].aData[CUSTOM_CMD_HOP_SEQ]);
+        Retx_Remove(0);
+    }
+
+    FLib_MemCpy(&mRetxFrames[mRetxCount], pFrame, sizeof(meshCustomData_t));
+    mRetxTries[mRetxCount] = 0;
+    mRetxCount++;
+}
+
+static void Retx_Remove(uint8_t index)
+{
+    mRetxCount--;
+    for (uint8_t i = index; i < mRetxCount; i++)
+    {
+        FLib_MemCpy(&mRetxFrames[i], &mRetxFrames[i + 1], sizeof(meshCustomData_t));
+        mRetxTries[i] = mRetxTries[i + 1];
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Resends the held frames that have resends left, oldest first, to the
+*               relay reports currently go to.
+*
+* \return       TRUE if anything was sent.
+********************************************************************************** */
+static bool_t Retx_Resend(void)
+{
+    uint8_t relay = mRelayIds[mRelayCurrent];
+    bool_t sent = FALSE;
+
+    for (uint8_t i = 0; i < mRetxCount; i++)
+    {
+        if (mRetxTries[i] < mRetxMaxTries_c)
+        {
+            mRetxTries[i]++;
+            mRetxFrames[i].aData[CUSTOM_CMD_DEST] = relay;
+            CustomData_Send(GetMeshAddressFromId(relay), &mRetxFrames[i]);
+            sent = TRUE;
+        }
+    }
+    return sent;
+}
+
+/*! *********************************************************************************
+* \brief        Current mesh time: local uptime corrected by the Comm's time beacons.
+*
+* \return       Mesh time in milliseconds.
+********************************************************************************** */
+static uint32_t TimeSync_Now(void)
+{
+    return OSA_TimeGetMsec() + (uint32_t)mTimeOffset_ms;
+}
+
+/*! *********************************************************************************
+* \brief        Timestamp for a reading taken now, see CUSTOM_CMD_STAMP_0.
+*
+* \return       Timestamp, or CUSTOM_CMD_STAMP_NONE before the first time beacon.
+********************************************************************************** */
+static uint16_t TimeSync_Stamp(void)
+{
+    uint16_t stamp = (uint16_t)(TimeSync_Now() / CUSTOM_CMD_STAMP_UNIT_ms);
+
+    if (!mTimeSynced)
+    {
+        return CUSTOM_CMD_STAMP_NONE;
+    }
+    /* One unit early rather than unknown */
+    return (stamp == CUSTOM_CMD_STAMP_NONE) ? (uint16_t)(stamp - 1) : stamp;
+}
+
+/*! *********************************************************************************
+* \brief        Applies the stored configuration, if there is one of this layout.
+*
+* \return       TRUE if a record was applied.
+********************************************************************************** */
+static bool_t Settings_Load(void)
+{
+    settings_t record;
+
+    if (!Settings_Read(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        return FALSE;
+    }
+    Settings_Apply(&record);
+    return TRUE;
+}
+
+/* Stores the current configuration, after a change */
+static void Settings_Save(void)
+{
+    settings_t record;
+
+    FLib_MemSet(&record, 0, sizeof(record));
+    Settings_Capture(&record);
+    if (!Settings_Write(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        debug_printf("Settings write failed\r\n");
+    }
+}
+
+static void Settings_Capture(settings_t* pRecord)
+{
+    pRecord->streaming = IsTimerStarted;
+    pRecord->reportInterval_sec = mCustomReportInterval_sec;
+    pRecord->reportMax_sec = mCustomReportMax_sec;
+    pRecord->batchBudget_sec = mBatchBudget_sec;
+    pRecord->filterPeriod_ms = mFilterPeriod_ms;
+    pRecord->batchSize = mBatchSize;
+    pRecord->filterKind = mFilterKind;
+    pRecord->filterTaps = mFilterTaps;
+    pRecord->filterDecim = mFilterDecim;
+    pRecord->powerCtrl = mPowerCtrl;
+    pRecord->ackMode = mAckMode;
+}
+
+static void Settings_Apply(settings_t* pRecord)
+{
+    mResumeReports = pRecord->streaming;
+    mCustomReportInterval_sec = pRecord->reportInterval_sec;
+    mCustomReportMax_sec = pRecord->reportMax_sec;
+    mBatchBudget_sec = pRecord->batchBudget_sec;
+    mFilterPeriod_ms = pRecord->filterPeriod_ms;
+    mBatchSize = pRecord->batchSize;
+    mFilterKind = pRecord->filterKind;
+    mFilterTaps = pRecord->filterTaps;
+    mFilterDecim = pRecord->filterDecim;
+    mPowerCtrl = pRecord->powerCtrl;
+    mAckMode = pRecord->ackMode ? TRUE : FALSE;
+    debug_printf("Settings restored: interval %d s, batch %d, filter %d, power %d, reports %s\r\n",
+            mCustomReportInterval_sec, mBatchSize, mFilterKind, mPowerCtrl, mResumeReports ? "on" : "off");
+}
+
+/*! *********************************************************************************
+* \brief        Finds where the history log left off: the sector with the highest
+*               first index is the one being filled, and its last entry gives the
+*               clock to continue from. Starts a new log when no sector is valid.
+********************************************************************************** */
+static void History_Init(void)
+{
+    historyHeader_t* pHeader;
+    historyEntry_t*  pEntry;
+    bool_t found = FALSE;
+    bool_t flashFree = AppFlash_IsFree();
+
+    if (!flashFree)
+    {
+        debug_printf("Image overlaps the history at 0x%x, history off\r\n", mHistoryFlashStart_c);
+    }
+
+    for (uint8_t sector = 0; flashFree && (sector < mHistorySectors_c); sector++)
+    {
+        pHeader = History_Sector(sector);
+        if ((pHeader->magic == mHistoryMagic_c) && (!found || (pHeader->firstIndex > mHistoryNext)))
+        {
+            mHistorySector = sector;
+            mHistoryNext = pHeader->firstIndex;
+            found = TRUE;
+        }
+    }
+
+    if (!found)
+    {
+        /* Rotating from the last sector opens the first one at index 0 */
+        mHistorySector = mHistorySectors_c - 1;
+        mHistorySlot = mHistoryPerSector_c;
+        mHistoryNext = 0;
+        mHistoryTimeBase_s = 0;
+        return;
+    }
+
+    pEntry = (historyEntry_t*)(History_Sector(mHistorySector) + 1);
+    for (mHistorySlot = 0; (mHistorySlot < mHistoryPerSector_c) && (pEntry[mHistorySlot].time_s != 0xFFFFFFFF); mHistorySlot++)
+    {
+    }
+    mHistoryNext += mHistorySlot;
+    mHistoryTimeBase_s = mHistorySlot ? (pEntry[mHistorySlot - 1].time_s + 1) : 0;
+    debug_printf("History resumes at entry %d, sector %d slot %d\r\n", mHistoryNext, mHistorySector, mHistorySlot);
+}
+
+/*! *********************************************************************************
+* \brief        Returns the memory mapped header of a history sector; its entries
+*               follow it.
+********************************************************************************** */
+static historyHeader_t* History_Sector(uint8_t sector)
+{
+    return (historyHeader_t*)(uintptr_t)(mHistoryFlashStart_c + (uint32_t)sector * mHistorySectorSize_c);
+}
+
+static uint32_t History_Now(void)
+{
+    return mHistoryTimeBase_s + OSA_TimeGetMsec() / 1000;
+}
+
+/*! *********************************************************************************
+* \brief        Logs a reading. Readings are collected in RAM and programmed
+*               mHistoryBatch_c at a time, so a reset loses at most that many.
+*
+* \param[in]    value   Reading in the sensor's fixed-point scale.
+********************************************************************************** */
+static void History_Append(int32_t value)
+{
+    mHistoryBuffer[mHistoryBuffered].time_s = History_Now();
+    mHistoryBuffer[mHistoryBuffered].value = value;
+    mHistoryBuffered++;
+    mHistoryNext++;
+
+    if (mHistoryBuffered >= mHistoryBatch_c)
+    {
+        History_Flush();
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Programs the readings collected in RAM, rotating to the next sector
+*               when the current one fills up.
+********************************************************************************** */
+static void History_Flush(void)
+{
+    uint16_t chunk;
+    uint32_t address;
+
+    if (!AppFlash_IsFree())
+    {
+        mHistoryBuffered = 0;
+        return;
+    }
+
+    while (mHistoryBuffered)
+    {
+        if (mHistorySlot >= mHistoryPerSector_c)
+        {
+            History_Rotate();
+        }
+
+        chunk = mHistoryPerSector_c - mHistorySlot;
+        if (chunk > mHistoryBuffered)
+        {
+            chunk = mHistoryBuffered;
+        }
+        address = (uint32_t)(uintptr_t)((historyEntry_t*)(History_Sector(mHistorySector) + 1) + mHistorySlot);
+        if (NV_FlashProgram(address, chunk * sizeof(historyEntry_t), (uint8_t*)mHistoryBuffer) != kStatus_FLASH_Success)
+        {
+            debug_printf("History write failed at 0x%x\r\n", address);
+        }
+
+        mHistorySlot += chunk;
+        mHistoryBuffered -= (uint8_t)chunk;
+        for (uint8_t i = 0; i < mHistoryBuffered; i++)
+        {
+            mHistoryBuffer[i] = mHistoryBuffer[i + chunk];
+        }
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Erases the next sector in turn, dropping the oldest entries, and opens
+*               it for the first reading still held in RAM. Its erase count carries
+*               over so wear can be read back from the header.
+********************************************************************************** */
+static void History_Rotate(void)
+{
+    uint8_t sector = (uint8_t)((mHistorySector + 1) % mHistorySectors_c);
+    historyHeader_t* pOld = History_Sector(sector);
+    uint32_t address = (uint32_t)(uintptr_t)pOld;
+    historyHeader_t header;
+
+    header.magic = mHistoryMagic_c;
+    header.eraseCount = (pOld->magic == mHistoryMagic_c) ? (uint16_t)(pOld->eraseCount + 1) : 1;
+    header.firstIndex = mHistoryNext - mHistoryBuffered;
+
+    if ((NV_FlashEraseSector(address, mHistorySectorSize_c) != kStatus_FLASH_Success) ||
+        (NV_FlashProgram(address, sizeof(header), (uint8_t*)&header) != kStatus_FLASH_Success))
+    {
+        debug_printf("History sector %d erase failed\r\n", sector);
+    }
+    debug_printf("History sector %d erased %d times, first entry %d\r\n", sector, header.eraseCount, header.firstIndex);
+
+    mHistorySector = sector;
+    mHistorySlot = 0;
+}
+
+static uint32_t History_Oldest(void)
+{
+    historyHeader_t* pHeader;
+    uint32_t oldest = mHistoryNext;
+
+    for (uint8_t sector = 0; AppFlash_IsFree() && (sector < mHistorySectors_c); sector++)
+    {
+        pHeader = History_Sector(sector);
+        if ((pHeader->magic == mHistoryMagic_c) && (pHeader->firstIndex < oldest))
+        {
+            oldest = pHeader->firstIndex;
+        }
+    }
+    return oldest;
+}
+
+/*! *********************************************************************************
+* \brief        Reads a logged reading back from flash. Readings still collected in
+*               RAM are not found; History_Flush() first.
+*
+* \param[in]    index   Log index of the reading.
+* \param[out]   pEntry  The reading.
+*
+* \return       TRUE if the reading is still held.
+********************************************************************************** */
+static bool_t History_Read(uint32_t index, historyEntry_t* pEntry)
+{
+    historyHeader_t* pHeader;
+    uint32_t slot;
+
+    for (uint8_t sector = 0; AppFlash_IsFree() && (sector < mHistorySectors_c); sector++)
+    {
+        pHeader = History_Sector(sector);
+        if ((pHeader->magic != mHistoryMagic_c) || (index < pHeader->firstIndex))
+        {
+            continue;
+        }
+        slot = index - pHeader->firstIndex;
+        if ((slot < mHistoryPerSector_c) && ((sector != mHistorySector) || (slot < mHistorySlot)))
+        {
+            FLib_MemCpy(pEntry, (historyEntry_t*)(pHeader + 1) + slot, sizeof(historyEntry_t));
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*! *********************************************************************************
+* \brief        Streams a range of logged readings back to the node that asked, as one
+*               segmented CUSTOM_CMD_HISTORY_REPORT message. Readings are delta coded,
+*               so a slowly changing signal takes about two bytes per entry; whatever
+*               does not fit is left for a query starting where this one ended.
+*
+* \param[in]    pFrame  CUSTOM_CMD_HISTORY_QUERY frame.
+********************************************************************************** */
+static void CustomData_HandleHistoryQuery(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t* pMessage;
+    uint16_t length = CUSTOM_CMD_HISTORY_ENTRIES;
+    uint32_t from;
+    uint32_t oldest;
+    uint32_t now = History_Now();
+    uint32_t previous = now;
+    int32_t  value = 0;
+    uint16_t count;
+    historyEntry_t entry;
+
+    if ((pFrame->dataLength < CUSTOM_CMD_HISTORY_QUERY_LEN) || (pFrame->aData[CUSTOM_CMD_DEST] == CUSTOM_CMD_DEST_ALL))
+    {
+        return;
+    }
+
+    pMessage = Segment_GetTxBuffer();
+    if (!pMessage)
+    {
+        debug_printf("History query from %d skipped, segment transfer busy\r\n", source);
+        return;
+    }
+
+    from = (uint32_t)(
+            (pFrame->aData[CUSTOM_CMD_HISTORY_FROM_3]<<24) |
+            (pFrame->aData[CUSTOM_CMD_HISTORY_FROM_2]<<16) |
+            (pFrame->aData[CUSTOM_CMD_HISTORY_FROM_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_HISTORY_FROM_0]));
+    count = (uint16_t)((pFrame->aData[CUSTOM_CMD_HISTORY_COUNT_1] << 8) | pFrame->aData[CUSTOM_CMD_HISTORY_COUNT_0]);
+
+    History_Flush();
+    oldest = History_Oldest();
+    if (from == CUSTOM_CMD_HISTORY_NEWEST)
+    {
+        from = ((mHistoryNext - oldest) > count) ? (mHistoryNext - count) : oldest;
+    }
+    else if (from < oldest)
+    {
+        from = oldest;
+    }
+
+    pMessage[0] = CUSTOM_CMD_HISTORY_REPORT;
+    pMessage[CUSTOM_CMD_HISTORY_VAL_ID] = mLeafValId_c;
+    FLib_MemCpy(&pMessage[CUSTOM_CMD_HISTORY_FIRST_0], &from, sizeof(uint32_t));
+    FLib_MemCpy(&pMessage[CUSTOM_CMD_HISTORY_OLDEST_0], &oldest, sizeof(uint32_t));
+    FLib_MemCpy(&pMessage[CUSTOM_CMD_HISTORY_NOW_0], &now, sizeof(uint32_t));
+
+    for (uint32_t index = from; (index < mHistoryNext) && count; index++, count--)
+    {
+        if ((length + 2 * CUSTOM_CMD_VAL_MAX_LEN > mSegMaxMessage_c) || !History_Read(index, &entry))
+        {
+            break;
+        }
+        length += CustomData_EncodeValue(&pMessage[length],
+                (index == from) ? (int32_t)(now - entry.time_s) : (int32_t)(entry.time_s - previous));
+        length += CustomData_EncodeValue(&pMessage[length],
+                (index == from) ? entry.value : (int32_t)((uint32_t)entry.value - (uint32_t)value));
+        previous = entry.time_s;
+        value = entry.value;
+    }
+
+    Segment_Send((source == 0) ? CUSTOM_CMD_COMM_ADDR : GetMeshAddressFromId(source), source, length);
+}
+
+/************************************************************************************
+*************************************************************************************
+* Private functions
+*************************************************************************************
+************************************************************************************/
+static void AppConfig()
+{      
+    Node_Init();
+    Frame_Init(&mFrames[mFrameData_c], 0, CUSTOM_CMD_SENSOR_DATA, 0);
+    mFrames[mFrameData_c].aData[CUSTOM_CMD_ORIGIN] = BD_ADDR_ID;
+    mListenTimerId = TMR_AllocateTimer();
+
+    NV_Init();
+    History_Init();
+    if (Settings_Load())
+    {
+        Power_Update();
+    }
+    
+    MeshNode_Init(MeshGenericCallback);
+}
+
+static meshResult_t MeshGenericCallback
+(
+    meshGenericEvent_t* pEvent
+)
+{
+    switch (pEvent->eventType)
+    {
+        case gMeshInitComplete_c:
+            {
+                if (!pEvent->eventData.initComplete.deviceIsCommissioned)
+                {                                       
+                    /* This will trigger this callback again, but "deviceIsCommissioned" will be TRUE. */
+                    MeshNode_Commission(&gRawCommData);
+                    debug_printf("Device Commissioned for first time: %d\n\r", pEvent->eventData.initComplete.deviceIsCommissioned);
+                }
+                else
+                {
+                	StopLed1Flashing();
+                	StopLed2Flashing();
+                	StopLed3Flashing();
+                	StopLed4Flashing();
+                	Led3On();
+#if gAppLightBulb_d
+                    Mesh_SetRelayState(TRUE);
+#else
+                    Mesh_SetRelayState(FALSE);
+                    Mesh_SetPublishAddress(gMeshProfileLighting_c,ADDRESS);
+                    debug_printf("Device Commissioned: %d\n\r", pEvent->eventData.initComplete.deviceIsCommissioned);
+#endif
+                    /* Pick up streaming where it was, without waiting for the Comm */
+                    if (mResumeReports)
+                    {
+                        mResumeReports = FALSE;
+                        Report_Start();
+                    }
+                }
+            }               
+            break;
+
+/*
+#define CUSTOM_CMD_SOURCE				0
+#define CUSTOM_CMD_DEST					1
+#define CUSTOM_CMD_POLL_ITVL_0			2
+#define CUSTOM_CMD_POLL_ITVL_1			3
+#define CUSTOM_CMD_POLL_ITVL_2			4
+#define CUSTOM_CMD_POLL_ITVL_3			5
+#define CUSTOM_CMD_POWER_CTRL			6
+#define CUSTOM_CMD_VAL_ID				7
+#define CUSTOM_CMD_VAL_0				8
+#define CUSTOM_CMD_VAL_1				9
+#define CUSTOM_CMD_VAL_2				10
+#define CUSTOM_CMD_VAL_3				11
+
+#define CUSTOM_CMD_TEMP_ID				1
+#define CUSTOM_CMD_LIGHT_ID				2
+#define CUSTOM_CMD_SYS_AWAKE			1
+#define CUSTOM_CMD_SYS_SLEEP			2
+ */
+        case gMeshCustomDataReceived_c:
+            {
+				debug_printf("\r\n -> Received Custom Data: Source: %d\r\n",
+						GetIdFromMeshAddress(pEvent->eventData.customDataReceived.source));
+				debug_printf("\r\nData is: ");
+                for(int i = 0; i<pEvent->eventData.customDataReceived.data.dataLength && i<gMeshMaxAppCustomDataSize_c;
+                		i++)
+                {
+                	debug_printf("0x%x ",pEvent->eventData.customDataReceived.data.aData[i]);
+                }
+                debug_printf("\r\n");
+
+                gEnergyStats.rxFrames++;
+                CustomData_Dispatch(&pEvent->eventData.customDataReceived.data);
+            }
+            break;
+
+        default:
+            {
+                /* Ignore */
+            }
+            break;
+
+    }
+    return gMeshSuccess_c;
+}
+
+/*
+*
+* Report handling functions
+*
+*/
+
+/*! *********************************************************************************
+* @}
+********************************************************************************** */
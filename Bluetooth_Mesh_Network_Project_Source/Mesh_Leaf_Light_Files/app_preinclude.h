@@ -67,7 +67,7 @@
          _block_size_ 512  _number_of_blocks_    4 _eol_
 
 /* Defines number of timers needed by the application */
-#define gTmrApplicationTimers_c         7
+#define gTmrApplicationTimers_c         4   /* one per TMR_AllocateTimer in app.c */
 
 /* Defines number of timers needed by the protocol stack */
 #define gTmrStackTimers_c               5
@@ -82,7 +82,7 @@
 #define gTMR_EnableLowPowerTimers       1
 
 /* Enable/Disable PowerDown functionality in PwrLib */
-#define cPWR_UsePowerDownMode           0
+#define cPWR_UsePowerDownMode           1
 
 /* Enable/Disable BLE Link Layer DSM */
 #define cPWR_BLE_LL_Enable              1
@@ -123,6 +123,33 @@
 /* Defines total heap size used by the OS */
 #define gTotalHeapSize_c        8000
            
+/*! *********************************************************************************
+ * 	Application role
+ ********************************************************************************** */
+
+/* Node role; selects the parts of Mesh_Node_Files/node_common.c that a role builds,
+   see node_common.h */
+#define gAppRoleComm_c                  0
+#define gAppRoleLeaf_c                  1
+#define gAppRoleRelay_c                 2
+#define gAppRole_d                      gAppRoleLeaf_c
+
+/* The reading a leaf samples and reports. Both leaf roles build the one leaf source
+   in Mesh_Leaf_Files, which takes app.h from its own folder, so the role is set
+   here rather than there. */
+#define gAppLeafSensorTemp_c            1
+#define gAppLeafSensorLight_c           2
+
+#ifndef gAppLeafSensor_d
+#define gAppLeafSensor_d                gAppLeafSensorLight_c
+#endif
+
+/* 1 to also report the on-chip temperature, in the same frames as the reading above;
+   needs gAppTempSensor_d and a leaf whose reading is not a temperature */
+#ifndef gAppLeafDieTemp_d
+#define gAppLeafDieTemp_d               0
+#endif
+
 /*! *********************************************************************************
  * 	BLE Stack Configuration
  ********************************************************************************** */
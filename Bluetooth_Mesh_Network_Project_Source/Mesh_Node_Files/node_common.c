@@ -0,0 +1,1792 @@
+/*! *********************************************************************************
+* \file node_common.c
+* Code the Comm, the relays and the leaves share: frame building and value coding,
+* link and memory statistics, stored settings, and on the nodes the timer wheel,
+* segmented sends, neighbor discovery, the light and temperature servers and the
+* frames every node answers alike. See node_common.h for how a role builds it.
+********************************************************************************** */
+
+/************************************************************************************
+*************************************************************************************
+* Include
+*************************************************************************************
+************************************************************************************/
+/* Framework / Drivers */
+#include "RNG_Interface.h"
+#include "TimersManager.h"
+#include "FunctionLib.h"
+#include "Flash_Adapter.h"
+#include "MemManager.h"
+#include "SerialManager.h"
+#include "fsl_os_abstraction.h"
+#ifdef FSL_RTOS_FREE_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+#include "app.h"
+#include "ApplMain.h"
+
+#include "mesh_interface.h"
+
+#if gAppRole_d != gAppRoleComm_c
+#if cPWR_UsePowerDownMode
+#include "PWR_Interface.h"
+#endif
+#include "fsl_adc16.h"
+
+#if gAppLightBulb_d
+#include "mesh_light_server.h"
+#endif
+
+#if gAppTempSensor_d
+#include "mesh_temperature_server.h"
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "node_common.h"
+
+/************************************************************************************
+*************************************************************************************
+* Private macros
+*************************************************************************************
+************************************************************************************/
+/* Pools tracked by the memory statistics; a report has room for this many */
+#define mMemPoolsMax_c					((gMeshMaxAppCustomDataSize_c - CUSTOM_CMD_MEM_POOLS) / CUSTOM_CMD_MEM_POOL_LEN)
+
+/* Runtime configuration records, appended to their own flash sector on every change
+   so a role comes back with its configuration after a reset; the newest valid record
+   wins. Each record takes a slot of its size rounded up to a flash phrase. */
+#define mSettingsSectorSize_c			mFlashSectorSize_c
+#define mSettingsMagic_c				0x5343
+#define mSettingsMaxSize_c				64
+
+#if gAppRole_d != gAppRoleComm_c
+#define mAppMaxResponseDelay_ms			500
+
+#define SHELL_CB_SIZE					128
+
+#if gAppTempSensor_d
+/* KW41 ADC16 channels of the internal temperature sensor and the 1.0 V bandgap */
+#define mTempAdcChannelTemp_c			26
+#define mTempAdcChannelBandgap_c		27
+#define mTempAdcGroup_c					0
+/* Sensor transfer function, same constants as BOARD_GetTemperature */
+#define mTempBandgap_uV					1000000
+#define mTempVtemp25_uV					716000
+#define mTempSlope_nVPerC				1620000
+/* GET requests waiting for the conversion in progress */
+#define mTempMaxPendingGets_c			4
+/* A conversion pair takes well under a millisecond; past this its interrupt was lost */
+#define mTempAdcTimeout_ms				100
+#endif
+
+/* Neighbor report chunks follow each other this far apart */
+#define mNeighborChunkGap_ms			40
+#define mNeighborMax_c					32
+#define mNeighborPerChunk_c				((gMeshMaxAppCustomDataSize_c - CUSTOM_CMD_NBR_ENTRIES) / CUSTOM_CMD_NBR_ENTRY_LEN)
+
+/* What a node offers in its neighbor reports */
+#if (gAppRole_d == gAppRoleRelay_c) && gAppLightBulb_d && gAppRelayAggregation_d
+#define mNeighborFlags_c				(CUSTOM_CMD_NBR_CAN_RELAY | CUSTOM_CMD_NBR_AGGREGATES)
+#elif gAppLightBulb_d
+#define mNeighborFlags_c				CUSTOM_CMD_NBR_CAN_RELAY
+#else
+#define mNeighborFlags_c				0
+#endif
+
+/* Periodic jobs share one low-power timer through a two-level timer wheel of
+   mSchedSlots_c slots per level. A job may run up to 1/8 of its period late, so jobs
+   falling due close together are served by a single wakeup. */
+#define mSchedSlots_c					64
+#define mSchedSlackShift_c				3
+#define mSchedNone_c					0xFF
+#define mSchedReady_c					(2 * mSchedSlots_c)
+
+/* Outgoing frames of the shared node code, set up once in Node_Init, see Frame_Init */
+#define mFrameReply_c					0	/* acknowledgements and answers to queries */
+#define mFrameNeighbor_c				1	/* hellos and neighbor report chunks */
+#define mFrameSegment_c					2	/* segments of the outgoing message */
+#define mFrameSlots_c					3
+
+/* Segments go out in bursts, and a sent message is held this many ticks for NACKs */
+#define mSegTxInterval_ms				100
+#define mSegTxBurst_c					4
+#define mSegTxHoldTicks_c				50
+#define mSegTxProbeTicks_c				10
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+/************************************************************************************
+*************************************************************************************
+* Private type definitions
+*************************************************************************************
+************************************************************************************/
+/* Block size and count of each MemManager pool, from PoolsDetails_c */
+#ifndef _block_size_
+#define _block_size_        {
+#define _number_of_blocks_  ,
+#define _eol_               },
+#endif
+
+/* Memory use seen so far: pool occupancy is sampled, the stacks are measured by
+   FreeRTOS from the fill pattern left below their deepest use */
+typedef struct memStats_tag
+{
+    uint8_t     aPeak[mMemPoolsMax_c];      /* most blocks of each pool seen in use */
+    uint8_t     allocFails;                 /* Mem_Alloc calls refused, saturating */
+} memStats_t;
+
+#if gAppRole_d != gAppRoleComm_c
+/* Timer wheel: level 0 holds jobs due within mSchedSlots_c ticks, one slot per tick,
+   level 1 one slot per mSchedSlots_c ticks. Each slot is a list linked through aNext;
+   the extra last list holds jobs taken off a slot that is being run. */
+typedef struct sched_tag
+{
+    pfTmrCallBack_t aHandler[mSchedJobs_c];
+    uint32_t        aDue[mSchedJobs_c];         /* tick the job falls due */
+    uint32_t        aPeriod[mSchedJobs_c];      /* ticks, 0 for single shot */
+    uint16_t        aSlack[mSchedJobs_c];       /* ticks the job may run late */
+    uint8_t         aNext[mSchedJobs_c];
+    uint8_t         aSlot[mSchedJobs_c];        /* mSchedNone_c when not queued */
+    uint8_t         aWheel[2 * mSchedSlots_c + 1];
+    uint32_t        now;                        /* last tick processed */
+    uint32_t        tick;                       /* current tick, counts on through ms wraps */
+    uint32_t        tickStart_ms;               /* OSA_TimeGetMsec() when the current tick began */
+} sched_t;
+
+#if mNodeSendsData_d
+/* Outgoing segmented message; aPending bit n is set while segment n still has to go out */
+typedef struct segTx_tag
+{
+    uint8_t         aData[mSegMaxMessage_c];
+    uint8_t         aPending[mSegBitmapSize_c];
+    uint16_t        length;
+    meshAddress_t   destination;
+    uint8_t         destId;
+    uint8_t         msgId;
+    uint8_t         count;
+    uint8_t         idleTicks;
+    bool_t          busy;
+} segTx_t;
+#endif
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+/************************************************************************************
+*************************************************************************************
+* Public memory declarations
+*************************************************************************************
+************************************************************************************/
+energyStats_t gEnergyStats;
+
+#if gAppRole_d != gAppRoleComm_c
+uint8_t gAppSerialId;
+#endif
+
+/************************************************************************************
+*************************************************************************************
+* Private memory declarations
+*************************************************************************************
+************************************************************************************/
+/* End of the program image in flash, code and the initial values of data, exported
+   by the linker file */
+extern uint32_t __DATA_END[];
+
+static const uint16_t mMemPools[][2] = { PoolsDetails_c };
+#define mMemPoolCount_c					(sizeof(mMemPools) / sizeof(mMemPools[0]))
+
+static memStats_t mMemStats;
+#ifdef FSL_RTOS_FREE_RTOS
+static TaskHandle_t mMainTask;
+static TaskHandle_t mTmrTask;
+#endif
+
+static uint16_t     mSettingsSlot;              /* next free record slot */
+
+#if gAppRole_d != gAppRoleComm_c
+#if gAppLightBulb_d
+static bool_t       mLightState = FALSE;
+static uint32_t     mLightReportInterval_sec;
+#endif
+
+#if gAppTempSensor_d
+static uint32_t     mTemperatureReportInterval_sec;
+/* Asynchronous ADC sampling state, shared with ADC0_IRQHandler */
+static volatile uint8_t mTempAdcStage;          /* 0 idle, 1 bandgap, 2 sensor */
+static volatile uint16_t mTempAdcBandgap;
+static int16_t      mTempCached;
+static uint32_t     mTempCachedAt_ms;
+static uint32_t     mTempAdcStarted_ms;
+static bool_t       mTempSleepLocked;
+static bool_t       mTempCacheValid;
+static bool_t       mTempPublishPending;
+static meshAddress_t mTempPendingGets[mTempMaxPendingGets_c];
+static uint8_t      mTempPendingGetCount;
+#endif
+
+static sched_t      mSched;
+static tmrTimerID_t mSchedTimerId;
+
+static tmrTimerID_t mNeighborTimerId;
+static uint8_t      mNeighbors[mNeighborMax_c];
+static uint8_t      mNeighborHeard[mNeighborMax_c];     /* hellos heard from each */
+static uint8_t      mNeighborCount;
+static uint8_t      mNeighborRound;
+static uint8_t      mNeighborSlots;
+static uint8_t      mNeighborStep;              /* hellos sent, then report chunks sent */
+static bool_t       mNeighborBusy = FALSE;      /* from a query until the report is sent */
+
+static meshCustomData_t mFrames[mFrameSlots_c];
+
+#if mNodeSendsData_d
+static tmrTimerID_t mSegTxTimerId;
+static segTx_t      mSegTx;
+#endif
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+/************************************************************************************
+*************************************************************************************
+* Private functions prototypes
+*************************************************************************************
+************************************************************************************/
+static uint8_t* Settings_Slot(uint16_t slot, uint16_t slotSize);
+static uint16_t Settings_Check(settingsHeader_t* pRecord, uint16_t size);
+
+#if gAppRole_d != gAppRoleComm_c
+static void Sched_Init(void);
+static uint32_t Sched_Tick(void);
+static void Sched_Insert(uint8_t job);
+static void Sched_Remove(uint8_t job);
+static void Sched_Run(uint8_t job);
+static void Sched_Advance(uint32_t tick);
+static void Sched_Arm(void);
+static void SchedTimerCallback(void* param);
+static void NeighborTimerCallback(void* param);
+
+#if mNodeSendsData_d
+static void Segment_Done(void);
+static void SegmentTxTimerCallback(void* param);
+#endif
+
+#if gAppLightBulb_d
+static void EnableLightReports(bool_t enable);
+static void LightReportTimerCallback(void* param);
+static void RandomLightWait(uint32_t maxMs);
+static meshResult_t MeshLightServerCallback
+(
+    meshLightServerEvent_t* pEvent
+);
+#endif
+
+#if gAppTempSensor_d
+static void EnableTemperatureReports(bool_t enable);
+static void TemperatureReportTimerCallback(void* param);
+static void TempSensor_Done(appCallbackParam_t param);
+static meshResult_t MeshTemperatureServerCallback
+(
+    meshTemperatureServerEvent_t* pEvent
+);
+#endif
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+/************************************************************************************
+*************************************************************************************
+* Public functions
+*************************************************************************************
+************************************************************************************/
+/*! *********************************************************************************
+* \brief        Sends a custom data frame, counting it for energy accounting.
+*
+* \param[in]    destination     Mesh address of the receiver.
+* \param[in]    pFrame          Complete frame.
+********************************************************************************** */
+void CustomData_Send(meshAddress_t destination, meshCustomData_t* pFrame)
+{
+    gEnergyStats.sends++;
+    gEnergyStats.txBytes += pFrame->dataLength;
+    Mesh_SendCustomData(destination, pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Writes the part of an arena frame that stays the same from one send to
+*               the next and clears the rest. Senders then only patch the fields that
+*               change instead of building a whole frame on the stack.
+*
+* \param[out]   pFrame      Frame of the caller's mFrames arena.
+* \param[in]    destId      Node ID of the receiver.
+* \param[in]    func        CUSTOM_CMD_FUNC of the frame.
+* \param[in]    length      Frame length, for frames that are always the same length.
+********************************************************************************** */
+void Frame_Init(meshCustomData_t* pFrame, uint8_t destId, uint8_t func, uint8_t length)
+{
+    FLib_MemSet(pFrame, 0, sizeof(meshCustomData_t));
+#if gAppRole_d == gAppRoleComm_c
+    pFrame->aData[CUSTOM_CMD_SOURCE] = 0;
+#else
+    pFrame->aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
+#endif
+    pFrame->aData[CUSTOM_CMD_DEST] = destId;
+    pFrame->aData[CUSTOM_CMD_FUNC] = func;
+    pFrame->dataLength = length;
+}
+
+/* Stores a 16 bit field low byte first */
+void Frame_PutU16(meshCustomData_t* pFrame, uint8_t index, uint16_t value)
+{
+    pFrame->aData[index] = (uint8_t)value;
+    pFrame->aData[index + 1] = (uint8_t)(value >> 8);
+}
+
+/*! *********************************************************************************
+* \brief        Writes a reading as a zigzag varint: values within +/-63 take one
+*               byte and values within +/-8191 take two.
+*
+* \param[out]   pBuf    Destination, at least CUSTOM_CMD_VAL_MAX_LEN bytes.
+* \param[in]    value   Reading in the sensor's fixed-point scale.
+*
+* \return       Number of bytes written.
+********************************************************************************** */
+uint8_t CustomData_EncodeValue(uint8_t* pBuf, int32_t value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    uint8_t  len = 0;
+
+    while (zigzag >= 0x80)
+    {
+        pBuf[len++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    pBuf[len++] = (uint8_t)zigzag;
+    return len;
+}
+
+/*! *********************************************************************************
+* \brief        Reads a zigzag varint written by CustomData_EncodeValue.
+*
+* \param[in]    pBuf    Encoded value.
+* \param[in]    maxLen  Bytes available in pBuf.
+* \param[out]   pValue  Decoded reading.
+*
+* \return       Number of bytes consumed, 0 if the value is truncated or too long.
+********************************************************************************** */
+uint8_t CustomData_DecodeValue(uint8_t* pBuf, uint8_t maxLen, int32_t* pValue)
+{
+    uint32_t zigzag = 0;
+
+    for (uint8_t i = 0; (i < maxLen) && (i < CUSTOM_CMD_VAL_MAX_LEN); i++)
+    {
+        zigzag |= (uint32_t)(pBuf[i] & 0x7F) << (7 * i);
+        if (!(pBuf[i] & 0x80))
+        {
+            *pValue = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*! *********************************************************************************
+* \brief        Packs samples into a data frame: the first as an absolute value, the
+*               rest as deltas from it, stopping when the next one would not fit.
+*
+* \param[in]    pFrame      Frame with the header already filled in.
+* \param[in]    pSamples    Consecutive samples, oldest first.
+* \param[in]    count       Number of samples in pSamples, at least one.
+*
+* \return       Number of samples packed; the first one always fits.
+********************************************************************************** */
+uint8_t CustomData_PackSamples(meshCustomData_t* pFrame, int32_t* pSamples, uint8_t count)
+{
+    uint8_t aValue[CUSTOM_CMD_VAL_MAX_LEN];
+    uint8_t packed = 1;
+    uint8_t len;
+
+    pFrame->dataLength = CUSTOM_CMD_VAL + CustomData_EncodeValue(&pFrame->aData[CUSTOM_CMD_VAL], pSamples[0]);
+
+    while (packed < count)
+    {
+        len = CustomData_EncodeValue(aValue, (int32_t)((uint32_t)pSamples[packed] - (uint32_t)pSamples[0]));
+        if (pFrame->dataLength + len > gMeshMaxAppCustomDataSize_c)
+        {
+            break;
+        }
+        FLib_MemCpy(&pFrame->aData[pFrame->dataLength], aValue, len);
+        pFrame->dataLength += len;
+        packed++;
+    }
+    return packed;
+}
+
+/*! *********************************************************************************
+* \brief        Reads back the samples written by CustomData_PackSamples.
+*
+* \param[in]    pFrame      Received data frame.
+* \param[out]   pSamples    At least mBatchMaxSamples_c entries.
+*
+* \return       Number of samples, 0 if the frame is malformed.
+********************************************************************************** */
+uint8_t CustomData_UnpackSamples(meshCustomData_t* pFrame, int32_t* pSamples)
+{
+    uint8_t offset = CUSTOM_CMD_VAL;
+    uint8_t count = 0;
+    uint8_t len;
+
+    if (pFrame->dataLength > gMeshMaxAppCustomDataSize_c)
+    {
+        return 0;
+    }
+
+    while (offset < pFrame->dataLength)
+    {
+        if (count == mBatchMaxSamples_c)
+        {
+            return 0;
+        }
+        len = CustomData_DecodeValue(&pFrame->aData[offset], pFrame->dataLength - offset, &pSamples[count]);
+        if (!len)
+        {
+            return 0;
+        }
+        if (count)
+        {
+            pSamples[count] = (int32_t)((uint32_t)pSamples[count] + (uint32_t)pSamples[0]);
+        }
+        offset += len;
+        count++;
+    }
+    return count;
+}
+
+/*! *********************************************************************************
+* \brief        Reads the readings of a CUSTOM_CMD_MULTI_ID frame, one per sensor.
+*
+* \param[in]    pFrame      Received data frame.
+* \param[out]   pValIds     At least mBatchMaxSamples_c entries.
+* \param[out]   pValues     At least mBatchMaxSamples_c entries.
+*
+* \return       Number of readings, 0 if the frame is malformed.
+********************************************************************************** */
+uint8_t CustomData_UnpackMulti(meshCustomData_t* pFrame, uint8_t* pValIds, int32_t* pValues)
+{
+    uint8_t offset = CUSTOM_CMD_VAL;
+    uint8_t count = 0;
+    uint8_t len;
+
+    if (pFrame->dataLength > gMeshMaxAppCustomDataSize_c)
+    {
+        return 0;
+    }
+
+    while (offset < pFrame->dataLength)
+    {
+        if ((count == mBatchMaxSamples_c) || (offset + 1 >= pFrame->dataLength))
+        {
+            return 0;
+        }
+        pValIds[count] = pFrame->aData[offset++];
+        if ((pValIds[count] != CUSTOM_CMD_TEMP_ID) && (pValIds[count] != CUSTOM_CMD_LIGHT_ID))
+        {
+            return 0;
+        }
+        len = CustomData_DecodeValue(&pFrame->aData[offset], pFrame->dataLength - offset, &pValues[count]);
+        if (!len)
+        {
+            return 0;
+        }
+        offset += len;
+        count++;
+    }
+    return count;
+}
+
+/*! *********************************************************************************
+* \brief        Accounts a received sequence number for a source in O(1).
+*
+* \param[in]    pStats  Statistics to update.
+* \param[in]    id      Source node ID.
+* \param[in]    seq     Sequence number carried by the frame.
+*
+* \return       TRUE if the frame is the newest seen from this source.
+********************************************************************************** */
+bool_t LinkStats_Update(linkStats_t* pStats, uint8_t id, uint8_t seq)
+{
+    int8_t diff = (int8_t)(seq - pStats->aLastSeq[id]);
+
+    if ((pStats->aReceived[id] == 0) || (diff <= -(int8_t)mLinkStatsWindow_c))
+    {
+        /* First frame or the source restarted its sequence */
+        pStats->aLastSeq[id] = seq;
+        pStats->aWindow[id] = 1;
+        pStats->aReceived[id]++;
+        return TRUE;
+    }
+
+    if (diff > 0)
+    {
+        pStats->aLost[id] += (uint16_t)(diff - 1);
+        pStats->aWindow[id] = (diff < mLinkStatsWindow_c) ? ((pStats->aWindow[id] << diff) | 1) : 1;
+        pStats->aLastSeq[id] = seq;
+        pStats->aReceived[id]++;
+        return TRUE;
+    }
+
+    diff = -diff;
+    if (pStats->aWindow[id] & (1UL << diff))
+    {
+        pStats->aDuplicate[id]++;
+    }
+    else
+    {
+        /* A late frame was already counted as lost when the newer one arrived */
+        pStats->aWindow[id] |= (1UL << diff);
+        pStats->aReordered[id]++;
+        pStats->aReceived[id]++;
+        if (pStats->aLost[id])
+        {
+            pStats->aLost[id]--;
+        }
+    }
+    return FALSE;
+}
+
+/*! *********************************************************************************
+* \brief        MEM_BufferAlloc for the application's own buffers, counting the
+*               requests the pools refuse. Allocations made inside the stack do not
+*               come through here and are not counted.
+*
+* \param[in]    numBytes    Buffer size.
+*
+* \return       The buffer, or NULL when no pool block is free.
+********************************************************************************** */
+void* Mem_Alloc(uint32_t numBytes)
+{
+    void* pBuffer = MEM_BufferAlloc(numBytes);
+
+    if (!pBuffer && (mMemStats.allocFails < 0xFF))
+    {
+        mMemStats.allocFails++;
+    }
+    return pBuffer;
+}
+
+/* Remember the task handles so Mem_FillReport can measure their stacks */
+void Mem_TrackMainTask(void)
+{
+#ifdef FSL_RTOS_FREE_RTOS
+    mMainTask = xTaskGetCurrentTaskHandle();
+#endif
+}
+
+void Mem_TrackTimerTask(void)
+{
+#ifdef FSL_RTOS_FREE_RTOS
+    mTmrTask = xTaskGetCurrentTaskHandle();
+#endif
+}
+
+/*! *********************************************************************************
+* \brief        Records how many blocks of each pool are in use. MEM_GetAvailableBlocks
+*               counts the free blocks of every pool at least as large as asked for, so
+*               the free blocks of one pool are the difference with one byte more.
+*               Called on every received frame and scheduler wakeup, so short peaks
+*               between samples are missed.
+********************************************************************************** */
+void Mem_Sample(void)
+{
+    uint32_t used;
+
+    for (uint8_t i = 0; (i < mMemPoolCount_c) && (i < mMemPoolsMax_c); i++)
+    {
+        used = mMemPools[i][1] -
+                (MEM_GetAvailableBlocks(mMemPools[i][0]) - MEM_GetAvailableBlocks(mMemPools[i][0] + 1));
+        if (used > mMemStats.aPeak[i])
+        {
+            mMemStats.aPeak[i] = (uint8_t)used;
+        }
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Fills in everything of a CUSTOM_CMD_MEM_REPORT frame after its header.
+*
+* \param[out]   pFrame  Frame to fill; dataLength is set.
+********************************************************************************** */
+void Mem_FillReport(meshCustomData_t* pFrame)
+{
+    uint16_t mainUsed = 0;
+    uint16_t tmrUsed = 0;
+    uint8_t len = CUSTOM_CMD_MEM_POOLS;
+
+    Mem_Sample();
+#ifdef FSL_RTOS_FREE_RTOS
+    if (mMainTask)
+    {
+        mainUsed = (uint16_t)(gMainThreadStackSize_c - uxTaskGetStackHighWaterMark(mMainTask) * sizeof(StackType_t));
+    }
+    if (mTmrTask)
+    {
+        tmrUsed = (uint16_t)(gTmrTaskStackSize_c - uxTaskGetStackHighWaterMark(mTmrTask) * sizeof(StackType_t));
+    }
+#endif
+
+    pFrame->aData[CUSTOM_CMD_MEM_MAIN_0] = (uint8_t)mainUsed;
+    pFrame->aData[CUSTOM_CMD_MEM_MAIN_1] = (uint8_t)(mainUsed >> 8);
+    pFrame->aData[CUSTOM_CMD_MEM_TMR_0] = (uint8_t)tmrUsed;
+    pFrame->aData[CUSTOM_CMD_MEM_TMR_1] = (uint8_t)(tmrUsed >> 8);
+    pFrame->aData[CUSTOM_CMD_MEM_FAILS] = mMemStats.allocFails;
+    for (uint8_t i = 0; (i < mMemPoolCount_c) && (i < mMemPoolsMax_c); i++)
+    {
+        pFrame->aData[len++] = (uint8_t)(mMemPools[i][0] / 4);
+        pFrame->aData[len++] = (uint8_t)mMemPools[i][1];
+        pFrame->aData[len++] = mMemStats.aPeak[i];
+    }
+    pFrame->dataLength = len;
+}
+
+/*! *********************************************************************************
+* \brief        Copies the newest stored record of the given layout into pRecord. A
+*               record of another layout is left alone rather than misread, so the
+*               compiled defaults stay until the configuration is next changed.
+*
+* \param[out]   pRecord     Record to fill, starting with its settingsHeader_t.
+* \param[in]    size        Size of the role's record.
+* \param[in]    version     The role's record layout.
+*
+* \return       TRUE if a record was found.
+********************************************************************************** */
+bool_t Settings_Read(settingsHeader_t* pRecord, uint16_t size, uint8_t version)
+{
+    uint16_t slotSize = (size + 7) & ~7;
+    uint16_t slots = mSettingsSectorSize_c / slotSize;
+    settingsHeader_t* pSlot;
+    settingsHeader_t* pNewest = NULL;
+
+    if (!AppFlash_IsFree())
+    {
+        return FALSE;
+    }
+
+    for (mSettingsSlot = 0; mSettingsSlot < slots; mSettingsSlot++)
+    {
+        pSlot = (settingsHeader_t*)Settings_Slot(mSettingsSlot, slotSize);
+        if (pSlot->magic != mSettingsMagic_c)
+        {
+            break;
+        }
+        if ((pSlot->version == version) && (pSlot->check == Settings_Check(pSlot, size)))
+        {
+            pNewest = pSlot;
+        }
+    }
+
+    /* Records of another size leave the first unused slot half written; start over */
+    if ((mSettingsSlot < slots) && (*(uint32_t*)Settings_Slot(mSettingsSlot, slotSize) != 0xFFFFFFFF))
+    {
+        mSettingsSlot = slots;
+    }
+
+    if (!pNewest)
+    {
+        return FALSE;
+    }
+    FLib_MemCpy(pRecord, pNewest, size);
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Appends a record unless it matches the last one written. The sector is
+*               only erased once all of its slots are used.
+*
+* \param[in]    pRecord     Record to store, zeroed before the role filled it in; the
+*                           header is filled in here.
+* \param[in]    size        Size of the role's record, at most mSettingsMaxSize_c.
+* \param[in]    version     The role's record layout.
+*
+* \return       FALSE if the flash could not be erased or written.
+********************************************************************************** */
+bool_t Settings_Write(settingsHeader_t* pRecord, uint16_t size, uint8_t version)
+{
+    uint16_t slotSize = (size + 7) & ~7;
+    uint16_t slots = mSettingsSectorSize_c / slotSize;
+    uint8_t aSlot[mSettingsMaxSize_c];
+
+    if ((slotSize > sizeof(aSlot)) || !AppFlash_IsFree())
+    {
+        return FALSE;
+    }
+
+    pRecord->magic = mSettingsMagic_c;
+    pRecord->version = version;
+    pRecord->check = Settings_Check(pRecord, size);
+
+    if (mSettingsSlot && FLib_MemCmp(Settings_Slot(mSettingsSlot - 1, slotSize), pRecord, size))
+    {
+        return TRUE;
+    }
+
+    if (mSettingsSlot >= slots)
+    {
+        if (NV_FlashEraseSector(mSettingsFlashStart_c, mSettingsSectorSize_c) != kStatus_FLASH_Success)
+        {
+            return FALSE;
+        }
+        mSettingsSlot = 0;
+    }
+
+    FLib_MemSet(aSlot, 0xFF, slotSize);
+    FLib_MemCpy(aSlot, pRecord, size);
+    if (NV_FlashProgram((uint32_t)(uintptr_t)Settings_Slot(mSettingsSlot, slotSize), slotSize, aSlot) != kStatus_FLASH_Success)
+    {
+        mSettingsSlot++;
+        return FALSE;
+    }
+    mSettingsSlot++;
+    return TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Tells whether the program image ends below the flash the roles keep
+*               their records in, see mAppFlashStart_c. A linker file that does not
+*               reserve it lets a grown image run into the records, and erasing them
+*               would then erase code.
+*
+* \return       TRUE if the records may be read and written.
+********************************************************************************** */
+bool_t AppFlash_IsFree(void)
+{
+    return ((uint32_t)(uintptr_t)__DATA_END <= mAppFlashStart_c) ? TRUE : FALSE;
+}
+
+#if gAppRole_d != gAppRoleComm_c
+uint16_t debug_printf(char * format,...)
+{
+    va_list ap;
+    uint16_t n;
+    char *pStr = (char*)Mem_Alloc(SHELL_CB_SIZE);
+
+    if(!pStr)
+    {
+        return 0;
+    }
+
+    va_start(ap, format);
+    n = vsnprintf(pStr, SHELL_CB_SIZE, format, ap);
+    //va_end(ap); /* follow MISRA... */
+    Serial_SyncWrite(gAppSerialId, (uint8_t*)pStr, n);
+    gEnergyStats.uartBytes += n;
+    MEM_BufferFree(pStr);
+    return n;
+}
+
+/*! *********************************************************************************
+* \brief        Registers the servers of the node's sensors and allocates the timers
+*               of the shared node code. Called from the role's AppConfig.
+********************************************************************************** */
+void Node_Init(void)
+{
+#if gAppLightBulb_d
+    MeshLightServer_RegisterCallback(MeshLightServerCallback);
+#endif
+
+#if gAppTempSensor_d
+    MeshTemperatureServer_RegisterCallback(MeshTemperatureServerCallback);
+#endif
+
+    Sched_Init();
+    Frame_Init(&mFrames[mFrameReply_c], 0, CUSTOM_CMD_CONFIG_ACK, CUSTOM_CMD_ACK_LEN);
+    Frame_Init(&mFrames[mFrameNeighbor_c], CUSTOM_CMD_DEST_ALL, CUSTOM_CMD_HELLO, CUSTOM_CMD_HELLO_LEN);
+    mNeighborTimerId = TMR_AllocateTimer();
+#if mNodeSendsData_d
+    Frame_Init(&mFrames[mFrameSegment_c], 0, CUSTOM_CMD_SEGMENT, 0);
+    mSegTxTimerId = TMR_AllocateTimer();
+#endif
+}
+
+/*! *********************************************************************************
+* \brief        (Re)starts a job. It may run up to 1/8 of its period, or of its delay
+*               for a single shot, late to share a wakeup with other jobs.
+*
+* \param[in]    job         mSchedXxx_c job.
+* \param[in]    handler     Called when the job falls due.
+* \param[in]    delay_ms    Time to the first run.
+* \param[in]    period_ms   Time between runs, 0 to run once.
+********************************************************************************** */
+void Sched_Start(uint8_t job, pfTmrCallBack_t handler, uint32_t delay_ms, uint32_t period_ms)
+{
+    uint32_t span;
+
+    Sched_Remove(job);
+
+    mSched.aHandler[job] = handler;
+    mSched.aPeriod[job] = (period_ms + mSchedTick_ms - 1) / mSchedTick_ms;
+    mSched.aDue[job] = Sched_Tick() + (delay_ms + mSchedTick_ms - 1) / mSchedTick_ms;
+
+    span = (period_ms ? period_ms : delay_ms) / mSchedTick_ms;
+    span >>= mSchedSlackShift_c;
+    mSched.aSlack[job] = (span < mSchedSlots_c) ? span : (mSchedSlots_c - 1);
+
+    Sched_Insert(job);
+    Sched_Arm();
+}
+
+void Sched_Stop(uint8_t job)
+{
+    Sched_Remove(job);
+    Sched_Arm();
+}
+
+bool_t Sched_IsActive(uint8_t job)
+{
+    return (mSched.aSlot[job] != mSchedNone_c);
+}
+
+/*! *********************************************************************************
+* \brief        Acknowledges a configuration frame to the node that sent it.
+*
+* \param[in]    pFrame  The configuration frame that was applied.
+********************************************************************************** */
+void CustomData_SendAck(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    meshCustomData_t* pReply = &mFrames[mFrameReply_c];
+
+    pReply->aData[CUSTOM_CMD_DEST] = source;
+    pReply->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_CONFIG_ACK;
+    pReply->aData[CUSTOM_CMD_ACK_FUNC] = pFrame->aData[CUSTOM_CMD_FUNC];
+    pReply->dataLength = CUSTOM_CMD_ACK_LEN;
+    CustomData_Send((source == 0) ? CUSTOM_CMD_COMM_ADDR : GetMeshAddressFromId(source), pReply);
+}
+
+/*! *********************************************************************************
+* \brief        Answers CUSTOM_CMD_MEM_QUERY with the memory statistics.
+********************************************************************************** */
+void CustomData_HandleMemQuery(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    meshCustomData_t* pReply = &mFrames[mFrameReply_c];
+
+    pReply->aData[CUSTOM_CMD_DEST] = source;
+    pReply->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_MEM_REPORT;
+    Mem_FillReport(pReply);
+    CustomData_Send((source == 0) ? CUSTOM_CMD_COMM_ADDR : GetMeshAddressFromId(source), pReply);
+}
+
+/*! *********************************************************************************
+* \brief        Answers CUSTOM_CMD_ENERGY_QUERY with every energy counter, as many
+*               CUSTOM_CMD_ENERGY_REPORT frames as CUSTOM_CMD_ENERGY_PER_FRAME needs.
+********************************************************************************** */
+void CustomData_HandleEnergyQuery(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint32_t aCounters[CUSTOM_CMD_ENERGY_COUNTERS];
+    meshCustomData_t* pReply = &mFrames[mFrameReply_c];
+    uint8_t len;
+
+    /* Bring the running awake or asleep period into the totals */
+    Power_Update();
+
+    aCounters[CUSTOM_CMD_ENERGY_SENDS] = gEnergyStats.sends;
+    aCounters[CUSTOM_CMD_ENERGY_TX_BYTES] = gEnergyStats.txBytes;
+    aCounters[CUSTOM_CMD_ENERGY_RX_FRAMES] = gEnergyStats.rxFrames;
+    aCounters[CUSTOM_CMD_ENERGY_READINGS] = gEnergyStats.readings;
+    aCounters[CUSTOM_CMD_ENERGY_UART_BYTES] = gEnergyStats.uartBytes;
+    aCounters[CUSTOM_CMD_ENERGY_AWAKE_S] = (uint32_t)(gEnergyStats.awake_ms / 1000);
+    aCounters[CUSTOM_CMD_ENERGY_ASLEEP_S] = (uint32_t)(gEnergyStats.asleep_ms / 1000);
+
+    pReply->aData[CUSTOM_CMD_DEST] = source;
+    pReply->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_ENERGY_REPORT;
+
+    for (uint8_t first = 0; first < CUSTOM_CMD_ENERGY_COUNTERS; first += CUSTOM_CMD_ENERGY_PER_FRAME)
+    {
+        pReply->aData[CUSTOM_CMD_ENERGY_FIRST] = first;
+        len = CUSTOM_CMD_ENERGY_VAL;
+        for (uint8_t i = first; (i < CUSTOM_CMD_ENERGY_COUNTERS) && (i < first + CUSTOM_CMD_ENERGY_PER_FRAME); i++)
+        {
+            pReply->aData[len++] = (uint8_t)(aCounters[i] & 0xFF);
+            pReply->aData[len++] = (uint8_t)((aCounters[i] >> 8) & 0xFF);
+            pReply->aData[len++] = (uint8_t)((aCounters[i] >> 16) & 0xFF);
+            pReply->aData[len++] = (uint8_t)((aCounters[i] >> 24) & 0xFF);
+        }
+        pReply->dataLength = len;
+        CustomData_Send((source == 0) ? CUSTOM_CMD_COMM_ADDR : GetMeshAddressFromId(source), pReply);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Echoes a hop probe back to its sender, which learns from the probe's
+*               TTL how far away this node is.
+*
+* \param[in]    pFrame  CUSTOM_CMD_HOP_PROBE frame, reused for the echo.
+********************************************************************************** */
+void CustomData_HandleHopProbe(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+
+    if (pFrame->dataLength < CUSTOM_CMD_HOP_PROBE_LEN)
+    {
+        return;
+    }
+
+    pFrame->aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
+    pFrame->aData[CUSTOM_CMD_DEST] = source;
+    CustomData_Send((source == 0) ? CUSTOM_CMD_COMM_ADDR : GetMeshAddressFromId(source), pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Starts a neighbor discovery round: mHelloRepeats_c hellos, one per
+*               cycle in this node's slot, then the report.
+*
+* \param[in]    pFrame  CUSTOM_CMD_NEIGHBOR_QUERY frame.
+********************************************************************************** */
+void CustomData_HandleNeighborQuery(meshCustomData_t* pFrame)
+{
+    if ((pFrame->dataLength < CUSTOM_CMD_NEIGHBOR_QUERY_LEN) || !pFrame->aData[CUSTOM_CMD_NBR_SLOTS])
+    {
+        return;
+    }
+
+    mNeighborRound = pFrame->aData[CUSTOM_CMD_NBR_ROUND];
+    mNeighborSlots = pFrame->aData[CUSTOM_CMD_NBR_SLOTS];
+    mNeighborCount = 0;
+    mNeighborStep = 0;
+    mNeighborBusy = TRUE;
+    Power_Update();
+    TMR_StartSingleShotTimer
+    (
+        mNeighborTimerId,
+        mHelloSlot_ms * (1 + BD_ADDR_ID % mNeighborSlots),
+        NeighborTimerCallback,
+        NULL
+    );
+}
+
+void CustomData_HandleHello(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t i;
+
+    if ((pFrame->dataLength < CUSTOM_CMD_HELLO_LEN) || !mNeighborBusy ||
+        (pFrame->aData[CUSTOM_CMD_NBR_ROUND] != mNeighborRound))
+    {
+        return;
+    }
+
+    for (i = 0; i < mNeighborCount; i++)
+    {
+        if (mNeighbors[i] == source)
+        {
+            break;
+        }
+    }
+    if (i == mNeighborCount)
+    {
+        if (mNeighborCount == mNeighborMax_c)
+        {
+            return;
+        }
+        mNeighbors[i] = source;
+        mNeighborHeard[i] = 0;
+        mNeighborCount++;
+    }
+    mNeighborHeard[i]++;
+}
+
+/* A node stays awake while a discovery round needs it */
+bool_t Neighbor_IsBusy(void)
+{
+    return mNeighborBusy;
+}
+
+#if mNodeSendsData_d
+/*! *********************************************************************************
+* \brief        Returns the outgoing message buffer, mSegMaxMessage_c bytes long. The
+*               first byte of a message is its CUSTOM_CMD_FUNC style type.
+*
+* \return       The buffer, or NULL while the previous message is still in flight.
+********************************************************************************** */
+uint8_t* Segment_GetTxBuffer(void)
+{
+    return mSegTx.busy ? NULL : mSegTx.aData;
+}
+
+/*! *********************************************************************************
+* \brief        Starts sending the message written into Segment_GetTxBuffer(). The
+*               leaf stays out of deep sleep until the transfer is over.
+*
+* \param[in]    destination     Mesh address of the receiver.
+* \param[in]    destId          Node ID of the receiver.
+* \param[in]    length          Message length, 1 to mSegMaxMessage_c bytes.
+********************************************************************************** */
+void Segment_Send(meshAddress_t destination, uint8_t destId, uint16_t length)
+{
+    mSegTx.length = length;
+    mSegTx.destination = destination;
+    mSegTx.destId = destId;
+    mSegTx.msgId++;
+    mSegTx.count = (uint8_t)((length + mSegPayload_c - 1) / mSegPayload_c);
+    mSegTx.idleTicks = 0;
+    mSegTx.busy = TRUE;
+    Power_Update();
+
+    mFrames[mFrameSegment_c].aData[CUSTOM_CMD_DEST] = destId;
+    mFrames[mFrameSegment_c].aData[CUSTOM_CMD_SEG_MSG_ID] = mSegTx.msgId;
+    mFrames[mFrameSegment_c].aData[CUSTOM_CMD_SEG_COUNT] = mSegTx.count;
+
+    FLib_MemSet(mSegTx.aPending, 0, sizeof(mSegTx.aPending));
+    for (uint8_t index = 0; index < mSegTx.count; index++)
+    {
+        mSegTx.aPending[index >> 3] |= (uint8_t)(1 << (index & 7));
+    }
+
+    TMR_StartIntervalTimer(mSegTxTimerId, mSegTxInterval_ms, SegmentTxTimerCallback, NULL);
+}
+
+bool_t Segment_IsBusy(void)
+{
+    return mSegTx.busy;
+}
+
+void CustomData_HandleSegStatus(meshCustomData_t* pFrame)
+{
+    uint8_t base = pFrame->aData[CUSTOM_CMD_SEG_BASE];
+    bool_t complete = TRUE;
+
+    if ((pFrame->dataLength < CUSTOM_CMD_SEG_STATUS_LEN) || !mSegTx.busy ||
+        (pFrame->aData[CUSTOM_CMD_SOURCE] != mSegTx.destId) ||
+        (pFrame->aData[CUSTOM_CMD_SEG_MSG_ID] != mSegTx.msgId))
+    {
+        return;
+    }
+
+    /* Only the segments reported missing are sent again */
+    for (uint8_t bit = 0; bit < mSegWindow_c; bit++)
+    {
+        uint16_t index = (uint16_t)base + bit;
+
+        if ((index < mSegTx.count) && (pFrame->aData[CUSTOM_CMD_SEG_MISSING + (bit >> 3)] & (1 << (bit & 7))))
+        {
+            mSegTx.aPending[index >> 3] |= (uint8_t)(1 << (index & 7));
+            complete = FALSE;
+        }
+    }
+
+    if (complete && (base >= mSegTx.count))
+    {
+        Segment_Done();
+        debug_printf("Message %d to %d confirmed\r\n", mSegTx.msgId, mSegTx.destId);
+        return;
+    }
+    mSegTx.idleTicks = 0;
+}
+#endif /* mNodeSendsData_d */
+
+#if gAppTempSensor_d
+/*! *********************************************************************************
+* \brief        Starts a temperature conversion unless one is already running. The
+*               bandgap is converted first, then the sensor; ADC0_IRQHandler chains
+*               the two and posts the result to TempSensor_Done in the app task.
+*               A conversion still running after mTempAdcTimeout_ms is restarted.
+********************************************************************************** */
+void TempSensor_Request(void)
+{
+    adc16_channel_config_t channelConfig;
+
+    if (mTempAdcStage)
+    {
+        /* A lost interrupt would otherwise leave the stage set and block every request */
+        if ((OSA_TimeGetMsec() - mTempAdcStarted_ms) < mTempAdcTimeout_ms)
+        {
+            return;
+        }
+        mTempAdcStage = 0;
+    }
+
+    if (!mTempSleepLocked)
+    {
+        /* Deep sleep stops the ADC and the conversion complete interrupt with it */
+#if cPWR_UsePowerDownMode
+        PWR_DisallowDeviceToSleep();
+#endif
+        mTempSleepLocked = TRUE;
+    }
+
+    channelConfig.channelNumber = mTempAdcChannelBandgap_c;
+    channelConfig.enableInterruptOnConversionCompleted = true;
+    channelConfig.enableDifferentialConversion = false;
+    mTempAdcStarted_ms = OSA_TimeGetMsec();
+    mTempAdcStage = 1;
+    ADC16_SetChannelConfig(ADC0, mTempAdcGroup_c, &channelConfig);
+}
+
+/*! *********************************************************************************
+* \brief        Returns the temperature of the last completed conversion.
+*
+* \param[out]   pCelsius    Degrees Celsius, left alone while there is none.
+*
+* \return       TRUE once a conversion has completed since boot.
+********************************************************************************** */
+bool_t TempSensor_Get(int16_t* pCelsius)
+{
+    if (mTempCacheValid)
+    {
+        *pCelsius = mTempCached;
+    }
+    return mTempCacheValid;
+}
+
+void ADC0_IRQHandler(void)
+{
+    adc16_channel_config_t channelConfig;
+    /* Reading the result clears the conversion complete flag */
+    uint16_t result = (uint16_t)ADC16_GetChannelConversionValue(ADC0, mTempAdcGroup_c);
+
+    if (mTempAdcStage == 1)
+    {
+        mTempAdcBandgap = result;
+        channelConfig.channelNumber = mTempAdcChannelTemp_c;
+        channelConfig.enableInterruptOnConversionCompleted = true;
+        channelConfig.enableDifferentialConversion = false;
+        mTempAdcStage = 2;
+        ADC16_SetChannelConfig(ADC0, mTempAdcGroup_c, &channelConfig);
+    }
+    else if (mTempAdcStage == 2)
+    {
+        mTempAdcStage = 0;
+        App_PostCallbackMessage(TempSensor_Done, (appCallbackParam_t)(uintptr_t)(((uint32_t)mTempAdcBandgap << 16) | result));
+    }
+}
+#endif /* gAppTempSensor_d */
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+/************************************************************************************
+*************************************************************************************
+* Private functions
+*************************************************************************************
+************************************************************************************/
+static uint8_t* Settings_Slot(uint16_t slot, uint16_t slotSize)
+{
+    return (uint8_t*)(uintptr_t)(mSettingsFlashStart_c + (uint32_t)slot * slotSize);
+}
+
+/*! *********************************************************************************
+* \brief        Rotating sum over the record after its header; a torn write leaves
+*               erased bytes behind and fails it.
+********************************************************************************** */
+static uint16_t Settings_Check(settingsHeader_t* pRecord, uint16_t size)
+{
+    uint8_t* pByte = (uint8_t*)pRecord + sizeof(settingsHeader_t);
+    uint16_t sum = 0;
+
+    while (pByte < (uint8_t*)pRecord + size)
+    {
+        sum = (uint16_t)(((sum << 1) | (sum >> 15)) + *pByte++);
+    }
+    return sum;
+}
+
+#if gAppRole_d != gAppRoleComm_c
+/*! *********************************************************************************
+* \brief        Empties the timer wheel and allocates the one timer that drives it.
+********************************************************************************** */
+static void Sched_Init(void)
+{
+    FLib_MemSet(mSched.aSlot, mSchedNone_c, sizeof(mSched.aSlot));
+    FLib_MemSet(mSched.aWheel, mSchedNone_c, sizeof(mSched.aWheel));
+    mSched.now = 0;
+    mSched.tick = 0;
+    mSched.tickStart_ms = OSA_TimeGetMsec();
+    mSchedTimerId = TMR_AllocateTimer();
+}
+
+/*! *********************************************************************************
+* \brief        Brings the current tick up to date with the ms elapsed since it began,
+*               carrying the part of a tick left over. Ticks are counted from these
+*               differences rather than divided out of OSA_TimeGetMsec(), so they run
+*               on without a jump when the 32 bit ms counter wraps after 49.7 days.
+*
+* \return       Current tick.
+********************************************************************************** */
+static uint32_t Sched_Tick(void)
+{
+    uint32_t ticks = (OSA_TimeGetMsec() - mSched.tickStart_ms) / mSchedTick_ms;
+
+    mSched.tick += ticks;
+    mSched.tickStart_ms += ticks * mSchedTick_ms;
+    return mSched.tick;
+}
+
+/*! *********************************************************************************
+* \brief        Queues a job in the slot of the last tick it may run at: level 0 when
+*               that is within mSchedSlots_c ticks, otherwise the level 1 slot of its
+*               block, from where it is moved down when the block begins. Jobs beyond
+*               the level 1 range wait in its farthest slot and are filed again.
+*
+* \param[in]    job     Job not currently queued.
+********************************************************************************** */
+static void Sched_Insert(uint8_t job)
+{
+    uint32_t last = mSched.aDue[job] + mSched.aSlack[job];
+    int32_t ahead = (int32_t)(last - mSched.now);
+    uint32_t blocks;
+    uint8_t slot;
+
+    if (ahead <= 0)
+    {
+        /* Overdue, runs on the next tick processed */
+        slot = (mSched.now + 1) % mSchedSlots_c;
+    }
+    else if (ahead <= mSchedSlots_c)
+    {
+        slot = last % mSchedSlots_c;
+    }
+    else
+    {
+        blocks = (last - (mSched.now - mSched.now % mSchedSlots_c)) / mSchedSlots_c;
+        if (blocks <= mSchedSlots_c)
+        {
+            slot = mSchedSlots_c + (last / mSchedSlots_c) % mSchedSlots_c;
+        }
+        else
+        {
+            slot = mSchedSlots_c + (mSched.now / mSchedSlots_c) % mSchedSlots_c;
+        }
+    }
+
+    mSched.aNext[job] = mSched.aWheel[slot];
+    mSched.aWheel[slot] = job;
+    mSched.aSlot[job] = slot;
+}
+
+static void Sched_Remove(uint8_t job)
+{
+    uint8_t* pLink;
+
+    if (mSched.aSlot[job] == mSchedNone_c)
+    {
+        return;
+    }
+
+    pLink = &mSched.aWheel[mSched.aSlot[job]];
+    while (*pLink != job)
+    {
+        pLink = &mSched.aNext[*pLink];
+    }
+    *pLink = mSched.aNext[job];
+    mSched.aSlot[job] = mSchedNone_c;
+}
+
+/*! *********************************************************************************
+* \brief        Runs a job, queueing a periodic one again first so that its handler may
+*               restart or stop it. A periodic job keeps its cadence unless it fell a
+*               whole period behind.
+*
+* \param[in]    job     Queued job.
+********************************************************************************** */
+static void Sched_Run(uint8_t job)
+{
+    Sched_Remove(job);
+
+    if (mSched.aPeriod[job])
+    {
+        mSched.aDue[job] += mSched.aPeriod[job];
+        if ((int32_t)(mSched.aDue[job] - mSched.now) <= 0)
+        {
+            mSched.aDue[job] = mSched.now + mSched.aPeriod[job];
+        }
+        Sched_Insert(job);
+    }
+
+    mSched.aHandler[job](NULL);
+}
+
+/*! *********************************************************************************
+* \brief        Processes every tick up to the given one, moving level 1 blocks down as
+*               they begin and running the level 0 slot of each tick. Any other job
+*               already due then runs in the same wakeup.
+*
+* \param[in]    tick    Current tick.
+********************************************************************************** */
+static void Sched_Advance(uint32_t tick)
+{
+    uint8_t slot;
+    uint8_t job;
+
+    while ((int32_t)(tick - mSched.now) > 0)
+    {
+        if (((mSched.now + 1) % mSchedSlots_c) == 0)
+        {
+            slot = mSchedSlots_c + ((mSched.now + 1) / mSchedSlots_c) % mSchedSlots_c;
+            while (mSched.aWheel[slot] != mSchedNone_c)
+            {
+                job = mSched.aWheel[slot];
+                Sched_Remove(job);
+                Sched_Insert(job);
+            }
+        }
+
+        mSched.now++;
+
+        /* Moved aside so that jobs filed again by their handlers are not run twice */
+        slot = mSched.now % mSchedSlots_c;
+        while (mSched.aWheel[slot] != mSchedNone_c)
+        {
+            job = mSched.aWheel[slot];
+            Sched_Remove(job);
+            mSched.aNext[job] = mSched.aWheel[mSchedReady_c];
+            mSched.aWheel[mSchedReady_c] = job;
+            mSched.aSlot[job] = mSchedReady_c;
+        }
+        while (mSched.aWheel[mSchedReady_c] != mSchedNone_c)
+        {
+            Sched_Run(mSched.aWheel[mSchedReady_c]);
+        }
+    }
+
+    for (job = 0; job < mSchedJobs_c; job++)
+    {
+        if ((mSched.aSlot[job] != mSchedNone_c) && ((int32_t)(mSched.aDue[job] - tick) <= 0))
+        {
+            Sched_Run(job);
+        }
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Sets the timer for the earliest tick by which a queued job must run, or
+*               stops it when nothing is queued.
+********************************************************************************** */
+static void Sched_Arm(void)
+{
+    uint32_t wake = 0;
+    uint32_t last;
+    uint32_t tick;
+    bool_t found = FALSE;
+    uint8_t i;
+    uint8_t job;
+
+    for (i = 1; i <= mSchedSlots_c; i++)
+    {
+        if (mSched.aWheel[(mSched.now + i) % mSchedSlots_c] != mSchedNone_c)
+        {
+            wake = mSched.now + i;
+            found = TRUE;
+            break;
+        }
+    }
+
+    /* Level 1 jobs are few; the earliest of them may come before a later level 0 slot */
+    for (i = mSchedSlots_c; i < 2 * mSchedSlots_c; i++)
+    {
+        for (job = mSched.aWheel[i]; job != mSchedNone_c; job = mSched.aNext[job])
+        {
+            last = mSched.aDue[job] + mSched.aSlack[job];
+            if (!found || ((int32_t)(last - wake) < 0))
+            {
+                wake = last;
+                found = TRUE;
+            }
+        }
+    }
+
+    if (!found)
+    {
+        TMR_StopTimer(mSchedTimerId);
+        return;
+    }
+
+    /* Timeout from the ticks still to go, less the part of the current one gone */
+    tick = Sched_Tick();
+    last = ((int32_t)(wake - tick) > 0) ? ((wake - tick) * mSchedTick_ms) : 0;
+    last -= OSA_TimeGetMsec() - mSched.tickStart_ms;
+    TMR_StartLowPowerTimer
+    (
+        mSchedTimerId,
+        gTmrLowPowerSingleShotMillisTimer_c,
+        ((int32_t)last > 0) ? last : 1,
+        SchedTimerCallback,
+        NULL
+    );
+}
+
+static void SchedTimerCallback(void* param)
+{
+    Mem_TrackTimerTask();
+    Mem_Sample();
+    Sched_Advance(Sched_Tick());
+    Sched_Arm();
+}
+
+/*! *********************************************************************************
+* \brief        Sends the next hello with TTL 0, so that no relay repeats it, or once
+*               all are out the next chunk of the neighbor report to the Comm. Every
+*               chunk stands on its own, so a lost one only loses its entries.
+********************************************************************************** */
+static void NeighborTimerCallback(void* param)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameNeighbor_c];
+    uint32_t cycle_ms = (uint32_t)(mNeighborSlots + 1) * mHelloSlot_ms;
+    uint8_t slot = BD_ADDR_ID % mNeighborSlots;
+    uint8_t first;
+    uint8_t count;
+    uint8_t ttl;
+
+    pFrame->aData[CUSTOM_CMD_NBR_ROUND] = mNeighborRound;
+
+    if (mNeighborStep < mHelloRepeats_c)
+    {
+        pFrame->aData[CUSTOM_CMD_DEST] = CUSTOM_CMD_DEST_ALL;
+        pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_HELLO;
+        pFrame->dataLength = CUSTOM_CMD_HELLO_LEN;
+        Mesh_GetTtl(&ttl);
+        Mesh_SetTtl(0);
+        CustomData_Send(gBroadcastAddress_c, pFrame);
+        Mesh_SetTtl(ttl);
+
+        mNeighborStep++;
+        TMR_StartSingleShotTimer
+        (
+            mNeighborTimerId,
+            (mNeighborStep < mHelloRepeats_c) ? cycle_ms :
+                    (cycle_ms - mHelloSlot_ms * (1 + slot) + (uint32_t)mNeighborReportSlot_ms * slot),
+            NeighborTimerCallback,
+            NULL
+        );
+        return;
+    }
+
+    first = (mNeighborStep - mHelloRepeats_c) * mNeighborPerChunk_c;
+    count = mNeighborCount - first;
+    if (count > mNeighborPerChunk_c)
+    {
+        count = mNeighborPerChunk_c;
+    }
+
+    pFrame->aData[CUSTOM_CMD_DEST] = 0;
+    pFrame->aData[CUSTOM_CMD_FUNC] = CUSTOM_CMD_NEIGHBOR_REPORT;
+    pFrame->aData[CUSTOM_CMD_NBR_FLAGS] = mNeighborFlags_c;
+    pFrame->aData[CUSTOM_CMD_NBR_CHUNK] = mNeighborStep - mHelloRepeats_c;
+    if (first + count == mNeighborCount)
+    {
+        pFrame->aData[CUSTOM_CMD_NBR_CHUNK] |= CUSTOM_CMD_NBR_LAST_CHUNK;
+    }
+    pFrame->dataLength = CUSTOM_CMD_NBR_ENTRIES;
+    for (uint8_t i = first; i < first + count; i++)
+    {
+        pFrame->aData[pFrame->dataLength++] = mNeighbors[i];
+        pFrame->aData[pFrame->dataLength++] = (uint8_t)((100 * mNeighborHeard[i]) / mHelloRepeats_c);
+    }
+    CustomData_Send(CUSTOM_CMD_COMM_ADDR, pFrame);
+    mNeighborStep++;
+
+    if (first + count < mNeighborCount)
+    {
+        TMR_StartSingleShotTimer(mNeighborTimerId, mNeighborChunkGap_ms, NeighborTimerCallback, NULL);
+    }
+    else
+    {
+        debug_printf("Neighbors reported: %d\r\n", mNeighborCount);
+        mNeighborBusy = FALSE;
+        Power_Update();
+    }
+}
+
+#if mNodeSendsData_d
+static void Segment_Done(void)
+{
+    TMR_StopTimer(mSegTxTimerId);
+    mSegTx.busy = FALSE;
+    Power_Update();
+}
+
+static void SegmentTxTimerCallback(void* param)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameSegment_c];
+    uint8_t sent = 0;
+    uint16_t offset;
+
+    for (uint8_t index = 0; (index < mSegTx.count) && (sent < mSegTxBurst_c); index++)
+    {
+        if (!(mSegTx.aPending[index >> 3] & (1 << (index & 7))))
+        {
+            continue;
+        }
+        mSegTx.aPending[index >> 3] &= (uint8_t)~(1 << (index & 7));
+
+        offset = (uint16_t)index * mSegPayload_c;
+        pFrame->aData[CUSTOM_CMD_SEG_INDEX] = index;
+        pFrame->dataLength = CUSTOM_CMD_SEG_DATA +
+                (uint8_t)(((mSegTx.length - offset) < mSegPayload_c) ? (mSegTx.length - offset) : mSegPayload_c);
+        FLib_MemCpy(&pFrame->aData[CUSTOM_CMD_SEG_DATA], &mSegTx.aData[offset], pFrame->dataLength - CUSTOM_CMD_SEG_DATA);
+        CustomData_Send(mSegTx.destination, pFrame);
+        sent++;
+    }
+
+    if (sent)
+    {
+        return;
+    }
+
+    /* Keep answering NACKs for a while after the last segment went out */
+    if (++mSegTx.idleTicks >= mSegTxHoldTicks_c)
+    {
+        Segment_Done();
+        debug_printf("Message %d to %d not confirmed\r\n", mSegTx.msgId, mSegTx.destId);
+    }
+    else if ((mSegTx.idleTicks % mSegTxProbeTicks_c) == 0)
+    {
+        /* Resending the last segment makes the receiver repeat its status */
+        mSegTx.aPending[(mSegTx.count - 1) >> 3] |= (uint8_t)(1 << ((mSegTx.count - 1) & 7));
+    }
+}
+#endif /* mNodeSendsData_d */
+
+#if gAppLightBulb_d
+static void EnableLightReports(bool_t enable)
+{
+    if (enable)
+    {
+        Sched_Start
+        (
+            mSchedLightReport_c,
+            LightReportTimerCallback,
+            1000 * mLightReportInterval_sec,
+            1000 * mLightReportInterval_sec
+        );
+    }
+    else
+    {
+        Sched_Stop(mSchedLightReport_c);
+    }
+}
+
+static void LightReportTimerCallback(void* param)
+{
+    MeshLightServer_PublishState(mLightState);
+}
+
+static void RandomLightWait(uint32_t maxMs)
+{
+    uint16_t random;
+    RNG_GetPseudoRandomNo((uint8_t*) &random, 2, NULL);
+    
+    uint32_t interval_ms = (uint32_t) random * maxMs / 0x0000ffff;
+    
+    Sched_Start(mSchedLightWait_c, LightReportTimerCallback, interval_ms, 0);
+}
+
+static meshResult_t MeshLightServerCallback
+(
+    meshLightServerEvent_t* pEvent
+)
+{
+    switch (pEvent->eventType)
+    {
+        case gMeshLightToggleCommand_c:
+            {
+            	debug_printf("MeshLightServerCallback: Light Toggle Event %d\n\r");
+                mLightState = !mLightState;
+                UpdateLightUI(mLightState);
+                RandomLightWait(mAppMaxResponseDelay_ms);
+            }
+            break;
+            
+        case gMeshLightGetCommand_c:
+            {
+            	debug_printf("MeshLightServerCallback: Light GET Event Source: %d , Light state: %d\n\r"
+            			,pEvent->eventData.getCommand.source,mLightState);
+                MeshLightServer_SendState(pEvent->eventData.getCommand.source, mLightState);
+            }
+            break;
+            
+        case gMeshLightSetCommand_c:
+            {
+            	debug_printf("MeshLightServerCallback: Light SET Event Source: %d , Light state: %d\n\r"
+            			,pEvent->eventData.setCommand.source,pEvent->eventData.setCommand.lightState);
+                mLightState = pEvent->eventData.setCommand.lightState;
+                UpdateLightUI(mLightState);
+                RandomLightWait(mAppMaxResponseDelay_ms);
+            }
+            break;
+            
+        case gMeshLightGetReportCommand_c:
+            {
+            	debug_printf("MeshLightServerCallback: GET Report Event Source: %d , Report Intvl: %d\n\r"
+            			,pEvent->eventData.getReportCommand.source,mLightReportInterval_sec);
+                MeshLightServer_SendPeriodicReportState
+                (
+                    pEvent->eventData.getReportCommand.source,
+                    Sched_IsActive(mSchedLightReport_c),
+                    mLightReportInterval_sec
+                );
+            }
+            break;
+            
+        case gMeshLightSetReportCommand_c:
+            {
+            	debug_printf("MeshLightServerCallback: SET Report Event Source: %d , Enable: %d  Report Intvl: %d\n\r"
+            			,pEvent->eventData.setReportCommand.source,pEvent->eventData.setReportCommand.enable,
+							pEvent->eventData.setReportCommand.intervalSeconds);
+                mLightReportInterval_sec = pEvent->eventData.setReportCommand.intervalSeconds;
+                EnableLightReports(pEvent->eventData.setReportCommand.enable);
+                MeshLightServer_SendPeriodicReportState
+                (
+                    pEvent->eventData.getReportCommand.source,
+                    pEvent->eventData.setReportCommand.enable,
+                    mLightReportInterval_sec
+                );
+            }
+            break;
+            
+        default:
+            {
+                /* Ignore */
+            }
+            break;
+    }
+    return gMeshSuccess_c;
+}
+#endif /* gAppLightBulb_d */
+
+#if gAppTempSensor_d
+static void EnableTemperatureReports(bool_t enable)
+{
+    if (enable)
+    {
+        Sched_Start
+        (
+            mSchedTempReport_c,
+            TemperatureReportTimerCallback,
+            1000 * mTemperatureReportInterval_sec,
+            1000 * mTemperatureReportInterval_sec
+        );
+    }
+    else
+    {
+        Sched_Stop(mSchedTempReport_c);
+    }
+}
+
+static void TemperatureReportTimerCallback(void* param)
+{
+    /* Published from TempSensor_Done once the conversion completes */
+    mTempPublishPending = TRUE;
+    TempSensor_Request();
+}
+
+/*! *********************************************************************************
+* \brief        Converts a completed bandgap/sensor pair to degrees Celsius, caches it
+*               and serves the GET requests and publication that were waiting for it.
+*
+* \param[in]    param   Bandgap result in the upper, sensor result in the lower half.
+********************************************************************************** */
+static void TempSensor_Done(appCallbackParam_t param)
+{
+    uint32_t bandgap = (uint32_t)(uintptr_t)param >> 16;
+    uint32_t sensor = (uint32_t)(uintptr_t)param & 0xFFFF;
+    int32_t vtemp_uV;
+    uint8_t i;
+
+    /* A result that raced a timeout restart leaves the lock to the new conversion */
+    if (mTempSleepLocked && !mTempAdcStage)
+    {
+#if cPWR_UsePowerDownMode
+        PWR_AllowDeviceToSleep();
+#endif
+        mTempSleepLocked = FALSE;
+    }
+
+    if (!bandgap)
+    {
+        return;
+    }
+
+    /* Ratio to the bandgap removes the dependency on the supply voltage */
+    vtemp_uV = (int32_t)(((uint64_t)sensor * mTempBandgap_uV) / bandgap);
+    mTempCached = (int16_t)(25 - (((int64_t)(vtemp_uV - mTempVtemp25_uV) * 1000) / mTempSlope_nVPerC));
+    mTempCachedAt_ms = OSA_TimeGetMsec();
+    mTempCacheValid = TRUE;
+
+    for (i = 0; i < mTempPendingGetCount; i++)
+    {
+        MeshTemperatureServer_SendTemperature(mTempPendingGets[i], mTempCached);
+    }
+    mTempPendingGetCount = 0;
+
+    if (mTempPublishPending)
+    {
+        mTempPublishPending = FALSE;
+        MeshTemperatureServer_PublishTemperature(mTempCached);
+    }
+}
+
+static meshResult_t MeshTemperatureServerCallback
+(
+    meshTemperatureServerEvent_t* pEvent
+)
+{
+    switch (pEvent->eventType)
+    {
+        case gMeshTemperatureGetCommand_c:
+            {
+                meshAddress_t source = pEvent->eventData.getCommand.source;
+
+                /* Never wait on the ADC here: answer from a fresh sample, otherwise
+                 * queue the request until the conversion completes */
+                if (mTempCacheValid && ((OSA_TimeGetMsec() - mTempCachedAt_ms) <= gAppTempMaxAge_ms))
+                {
+                    debug_printf("MeshTemperatureServerCallback: Temp GET Event Source: %d, Temp = %d\n\r"
+                            ,source,mTempCached);
+                    MeshTemperatureServer_SendTemperature(source, mTempCached);
+                }
+                else if (mTempPendingGetCount < mTempMaxPendingGets_c)
+                {
+                    mTempPendingGets[mTempPendingGetCount++] = source;
+                    TempSensor_Request();
+                }
+                else if (mTempCacheValid)
+                {
+                    MeshTemperatureServer_SendTemperature(source, mTempCached);
+                }
+            } 
+            break;
+            
+        case gMeshTemperatureSetReportCommand_c:
+            {
+            	debug_printf("MeshTemperatureServerCallback: SET Report Event Source: %d , Enable: %d  Report Intvl: %d\n\r"
+            			,pEvent->eventData.setReportCommand.source,pEvent->eventData.setReportCommand.enable,
+							pEvent->eventData.setReportCommand.intervalSeconds);
+                mTemperatureReportInterval_sec = pEvent->eventData.setReportCommand.intervalSeconds;
+                EnableTemperatureReports(pEvent->eventData.setReportCommand.enable);
+                MeshTemperatureServer_SendPeriodicReportState
+                (
+                    pEvent->eventData.getReportCommand.source,
+                    pEvent->eventData.setReportCommand.enable,
+                    mTemperatureReportInterval_sec
+                );
+            } 
+            break;
+            
+        case gMeshTemperatureGetReportCommand_c:
+            {
+            	debug_printf("MeshTemperatureServerCallback: GET Report Event Source: %d , Report Intvl: %d\n\r"
+            			,pEvent->eventData.getReportCommand.source,mTemperatureReportInterval_sec);
+                MeshTemperatureServer_SendPeriodicReportState
+                (
+                    pEvent->eventData.getReportCommand.source,
+                    Sched_IsActive(mSchedTempReport_c),
+                    mTemperatureReportInterval_sec
+                );
+            } 
+            break;
+            
+        default:
+            {
+                /* Ignore */
+            }
+            break;
+    }
+    return gMeshSuccess_c;
+}
+#endif /* gAppTempSensor_d */
+#endif /* gAppRole_d != gAppRoleComm_c */
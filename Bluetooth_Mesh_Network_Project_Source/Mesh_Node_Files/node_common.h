@@ -0,0 +1,433 @@
+/*! *********************************************************************************
+* \file node_common.h
+* Custom data protocol spoken by the Comm, the relays and the leaves, and the interface
+* of node_common.c, the code they share.
+*
+* Every role's project builds node_common.c next to its own app.c, with its own folder
+* (app.h, app_preinclude.h) and Mesh_Node_Files on the include path. gAppRole_d from
+* the node preincludes selects the parts a role builds; a project that does not define
+* it, the Comm's, builds the part every role shares.
+********************************************************************************** */
+
+#ifndef _NODE_COMMON_H_
+#define _NODE_COMMON_H_
+
+/************************************************************************************
+*************************************************************************************
+* Include
+*************************************************************************************
+************************************************************************************/
+#include "TimersManager.h"
+#include "mesh_interface.h"
+
+/*************************************************************************************
+**************************************************************************************
+* Public macros
+**************************************************************************************
+*************************************************************************************/
+/* Roles; the node preincludes set gAppRole_d */
+#ifndef gAppRoleComm_c
+#define gAppRoleComm_c                  0
+#endif
+#ifndef gAppRoleLeaf_c
+#define gAppRoleLeaf_c                  1
+#define gAppRoleRelay_c                 2
+#endif
+#ifndef gAppRole_d
+#define gAppRole_d                      gAppRoleComm_c
+#endif
+
+/* Leaves and aggregating relays send sensor data and segmented messages */
+#if (gAppRole_d == gAppRoleLeaf_c) || ((gAppRole_d == gAppRoleRelay_c) && gAppRelayAggregation_d)
+#define mNodeSendsData_d                1
+#else
+#define mNodeSendsData_d                0
+#endif
+
+/* Every frame starts with source, destination and function */
+#define CUSTOM_CMD_SOURCE				0
+#define CUSTOM_CMD_DEST					1
+#define CUSTOM_CMD_FUNC					2
+
+/* CUSTOM_CMD_SENSOR_DATA */
+#define CUSTOM_CMD_ORIGIN				3
+#define CUSTOM_CMD_SEQ					4
+#define CUSTOM_CMD_HOP_SEQ				5
+#define CUSTOM_CMD_VAL_ID				6
+#define CUSTOM_CMD_STAMP_0				7	/* mesh time of the newest sample in CUSTOM_CMD_STAMP_UNIT_ms, */
+#define CUSTOM_CMD_STAMP_1				8	/* modulo 2^16; CUSTOM_CMD_STAMP_NONE when not known */
+#define CUSTOM_CMD_VAL					9	/* zigzag varint, 1 to CUSTOM_CMD_VAL_MAX_LEN bytes */
+										/* further samples follow as zigzag varint deltas from the first */
+
+#define CUSTOM_CMD_STAMP_UNIT_ms		100
+#define CUSTOM_CMD_STAMP_NONE			0xFFFF
+
+/* CUSTOM_CMD_TIME_SYNC, flooded by the Comm and repeated by relays */
+#define CUSTOM_CMD_TIME_EPOCH			3	/* beacon number; copies of one beacon share it */
+#define CUSTOM_CMD_TIME_HOPS			4	/* relays that repeated this copy */
+#define CUSTOM_CMD_TIME_MS_0			5	/* little-endian mesh time in ms when sent */
+#define CUSTOM_CMD_TIME_SYNC_LEN		9
+
+/* CUSTOM_CMD_HOP_PROBE, echoed back unchanged by the probed node */
+#define CUSTOM_CMD_PROBE_TTL			3	/* TTL the Comm sent the probe with */
+#define CUSTOM_CMD_HOP_PROBE_LEN		4
+
+/* CUSTOM_CMD_DATA_ACK, from the aggregating relay back to the reporting leaf */
+#define CUSTOM_CMD_DATA_ACK_SEQ			3	/* newest CUSTOM_CMD_HOP_SEQ received from the leaf */
+#define CUSTOM_CMD_DATA_ACK_MAP_0		4	/* bit n set: ACK_SEQ - n was received as well */
+#define CUSTOM_CMD_DATA_ACK_MAP_1		5
+#define CUSTOM_CMD_DATA_ACK_LEN			6
+
+/* CUSTOM_CMD_NEIGHBOR_QUERY, CUSTOM_CMD_HELLO and CUSTOM_CMD_NEIGHBOR_REPORT */
+#define CUSTOM_CMD_NBR_ROUND			3	/* discovery round the frame belongs to */
+#define CUSTOM_CMD_NBR_SLOTS			4	/* CUSTOM_CMD_NEIGHBOR_QUERY: node slots per hello cycle */
+#define CUSTOM_CMD_NEIGHBOR_QUERY_LEN	5
+#define CUSTOM_CMD_HELLO_LEN			4
+#define CUSTOM_CMD_NBR_FLAGS			4	/* CUSTOM_CMD_NEIGHBOR_REPORT: CUSTOM_CMD_NBR_CAN_RELAY */
+#define CUSTOM_CMD_NBR_CHUNK			5	/* chunk number, CUSTOM_CMD_NBR_LAST_CHUNK set on the last */
+#define CUSTOM_CMD_NBR_ENTRIES			6	/* per neighbor its ID and the percentage of its hellos heard */
+#define CUSTOM_CMD_NBR_ENTRY_LEN		2
+
+#define CUSTOM_CMD_NBR_CAN_RELAY		0x01	/* the node may be given the relay role */
+#define CUSTOM_CMD_NBR_AGGREGATES		0x02	/* the node is in CUSTOM_CMD_RELAY_GROUP */
+#define CUSTOM_CMD_NBR_LAST_CHUNK		0x80
+
+/* CUSTOM_CMD_START_DATA and CUSTOM_CMD_REPORT_CONFIG */
+#define CUSTOM_CMD_POLL_ITVL_0			3
+#define CUSTOM_CMD_POLL_ITVL_1			4
+#define CUSTOM_CMD_POLL_ITVL_2			5
+#define CUSTOM_CMD_POLL_ITVL_3			6
+#define CUSTOM_CMD_POWER_CTRL			7	/* CUSTOM_CMD_REPORT_CONFIG only */
+#define CUSTOM_CMD_POLL_MAX_0			8	/* CUSTOM_CMD_REPORT_CONFIG only; above POLL_ITVL selects adaptive reports */
+#define CUSTOM_CMD_POLL_MAX_1			9
+#define CUSTOM_CMD_START_DATA_LEN		7
+#define CUSTOM_CMD_REPORT_CONFIG_LEN	10
+
+/* CUSTOM_CMD_CONFIG_ACK */
+#define CUSTOM_CMD_ACK_FUNC				3
+#define CUSTOM_CMD_ACK_LEN				4
+
+/* CUSTOM_CMD_BATCH_CONFIG */
+#define CUSTOM_CMD_BATCH_SIZE			3
+#define CUSTOM_CMD_BATCH_BUDGET_0		4
+#define CUSTOM_CMD_BATCH_BUDGET_1		5
+#define CUSTOM_CMD_BATCH_FLAGS			6
+#define CUSTOM_CMD_BATCH_CONFIG_LEN		7
+
+#define CUSTOM_CMD_BATCH_ACKED			0x01	/* resend reports until the relay acknowledges them */
+
+/* CUSTOM_CMD_POWER_CONFIG */
+#define CUSTOM_CMD_POWER_TARGET			3	/* CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_LIGHT_ID or 0 for every leaf */
+#define CUSTOM_CMD_POWER_STATE			4	/* CUSTOM_CMD_SYS_AWAKE or CUSTOM_CMD_SYS_SLEEP */
+#define CUSTOM_CMD_POWER_CONFIG_LEN		5
+
+/* CUSTOM_CMD_INTERVAL_CONFIG */
+#define CUSTOM_CMD_INTERVAL_TARGET		3	/* CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_LIGHT_ID or 0 for every leaf */
+#define CUSTOM_CMD_INTERVAL_MIN_0		4	/* seconds */
+#define CUSTOM_CMD_INTERVAL_MIN_1		5
+#define CUSTOM_CMD_INTERVAL_MAX_0		6	/* seconds, 0 or up to MIN for a fixed interval */
+#define CUSTOM_CMD_INTERVAL_MAX_1		7
+#define CUSTOM_CMD_INTERVAL_CONFIG_LEN	8
+
+/* CUSTOM_CMD_MEM_REPORT */
+#define CUSTOM_CMD_MEM_MAIN_0			3	/* most bytes of the main task stack ever used, */
+#define CUSTOM_CMD_MEM_MAIN_1			4	/* 0 when not measured */
+#define CUSTOM_CMD_MEM_TMR_0			5	/* the same for the timer task stack */
+#define CUSTOM_CMD_MEM_TMR_1			6
+#define CUSTOM_CMD_MEM_FAILS			7	/* Mem_Alloc calls refused, saturating */
+#define CUSTOM_CMD_MEM_POOLS			8	/* per pool: block size / 4, blocks, most blocks seen in use */
+#define CUSTOM_CMD_MEM_POOL_LEN			3
+
+/* CUSTOM_CMD_ENERGY_REPORT; counters travel in CUSTOM_CMD_ENERGY_* order */
+#define CUSTOM_CMD_ENERGY_FIRST			3	/* index of the first counter carried */
+#define CUSTOM_CMD_ENERGY_VAL			4	/* little-endian 32 bit counters */
+#define CUSTOM_CMD_ENERGY_PER_FRAME		4
+
+#define CUSTOM_CMD_ENERGY_SENDS			0
+#define CUSTOM_CMD_ENERGY_TX_BYTES		1
+#define CUSTOM_CMD_ENERGY_RX_FRAMES		2
+#define CUSTOM_CMD_ENERGY_READINGS		3
+#define CUSTOM_CMD_ENERGY_UART_BYTES	4
+#define CUSTOM_CMD_ENERGY_AWAKE_S		5
+#define CUSTOM_CMD_ENERGY_ASLEEP_S		6
+#define CUSTOM_CMD_ENERGY_COUNTERS		7
+
+/* CUSTOM_CMD_FILTER_CONFIG */
+#define CUSTOM_CMD_FILTER_KIND			3	/* CUSTOM_CMD_FILTER_NONE, _AVERAGE or _MEDIAN */
+#define CUSTOM_CMD_FILTER_TAPS			4	/* samples in the filter window */
+#define CUSTOM_CMD_FILTER_PERIOD_0		5	/* milliseconds between samples */
+#define CUSTOM_CMD_FILTER_PERIOD_1		6
+#define CUSTOM_CMD_FILTER_DECIM			7	/* samples per filter output */
+#define CUSTOM_CMD_FILTER_CONFIG_LEN	8
+
+#define CUSTOM_CMD_FILTER_NONE			0
+#define CUSTOM_CMD_FILTER_AVERAGE		1
+#define CUSTOM_CMD_FILTER_MEDIAN		2
+
+/* CUSTOM_CMD_HISTORY_QUERY */
+#define CUSTOM_CMD_HISTORY_FROM_0		3	/* log index of the first entry wanted */
+#define CUSTOM_CMD_HISTORY_FROM_1		4
+#define CUSTOM_CMD_HISTORY_FROM_2		5
+#define CUSTOM_CMD_HISTORY_FROM_3		6
+#define CUSTOM_CMD_HISTORY_COUNT_0		7
+#define CUSTOM_CMD_HISTORY_COUNT_1		8
+#define CUSTOM_CMD_HISTORY_QUERY_LEN	9
+
+#define CUSTOM_CMD_HISTORY_NEWEST		0xFFFFFFFF	/* FROM: the newest COUNT entries */
+
+/* Segmented CUSTOM_CMD_HISTORY_REPORT message, after its type byte */
+#define CUSTOM_CMD_HISTORY_VAL_ID		1
+#define CUSTOM_CMD_HISTORY_FIRST_0		2	/* log index of the first entry carried */
+#define CUSTOM_CMD_HISTORY_OLDEST_0		6	/* oldest log index the leaf still holds */
+#define CUSTOM_CMD_HISTORY_NOW_0		10	/* leaf clock in seconds when sent */
+#define CUSTOM_CMD_HISTORY_ENTRIES		14	/* per entry two zigzag varints: seconds since the previous */
+										/* entry (the first: before NOW) and value delta (the first: absolute) */
+
+#define CUSTOM_CMD_VAL_MAX_LEN			5
+
+/* CUSTOM_CMD_SEGMENT */
+#define CUSTOM_CMD_SEG_MSG_ID			3
+#define CUSTOM_CMD_SEG_INDEX			4
+#define CUSTOM_CMD_SEG_COUNT			5
+#define CUSTOM_CMD_SEG_DATA				6
+
+/* CUSTOM_CMD_SEG_STATUS; no missing bit set from a base of SEG_COUNT means complete */
+#define CUSTOM_CMD_SEG_BASE				4
+#define CUSTOM_CMD_SEG_MISSING			5	/* bit n set: segment BASE + n still missing */
+#define CUSTOM_CMD_SEG_STATUS_LEN		(CUSTOM_CMD_SEG_MISSING + mSegWindow_c / 8)
+
+/* One record per node in a segmented CUSTOM_CMD_LINK_REPORT message */
+#define CUSTOM_CMD_LINK_NODE			0
+#define CUSTOM_CMD_LINK_RX_0			1
+#define CUSTOM_CMD_LINK_LOST_0			3
+#define CUSTOM_CMD_LINK_REORDER_0		5
+#define CUSTOM_CMD_LINK_DUP_0			7
+#define CUSTOM_CMD_LINK_SHED_0			9	/* samples the relay dropped */
+#define CUSTOM_CMD_LINK_COALESCED_0		11	/* held samples replaced by newer ones under the rate limit */
+#define CUSTOM_CMD_LINK_RECORD_LEN		13
+
+#define CUSTOM_CMD_TEMP_ID				1
+#define CUSTOM_CMD_LIGHT_ID				2
+#define CUSTOM_CMD_NUM_SENSORS			2
+
+/* CUSTOM_CMD_VAL_ID of a frame carrying readings of several sensors taken together;
+   CUSTOM_CMD_VAL then holds a sensor ID and a zigzag varint for each of them */
+#define CUSTOM_CMD_MULTI_ID				0x80
+
+/* Decimal digits after the point carried by each sensor's integer value */
+#define CUSTOM_CMD_TEMP_SCALE			0
+#define CUSTOM_CMD_LIGHT_SCALE			0
+
+#define CUSTOM_CMD_SYS_AWAKE			1
+#define CUSTOM_CMD_SYS_SLEEP			2
+
+#define CUSTOM_CMD_START_DATA			1
+#define CUSTOM_CMD_STOP_DATA			2
+#define CUSTOM_CMD_SENSOR_DATA			3
+#define CUSTOM_CMD_LINK_QUERY			4
+#define CUSTOM_CMD_LINK_REPORT			5
+#define CUSTOM_CMD_BATCH_CONFIG			6
+#define CUSTOM_CMD_REPORT_CONFIG		7
+#define CUSTOM_CMD_CONFIG_ACK			8
+#define CUSTOM_CMD_SEGMENT				9
+#define CUSTOM_CMD_SEG_STATUS			10
+#define CUSTOM_CMD_POWER_CONFIG			11
+#define CUSTOM_CMD_ENERGY_QUERY			12
+#define CUSTOM_CMD_ENERGY_REPORT		13
+#define CUSTOM_CMD_INTERVAL_CONFIG		14
+#define CUSTOM_CMD_FILTER_CONFIG		15
+#define CUSTOM_CMD_HISTORY_QUERY		16
+#define CUSTOM_CMD_HISTORY_REPORT		17	/* segmented message type */
+#define CUSTOM_CMD_TIME_SYNC			18
+#define CUSTOM_CMD_HOP_PROBE			19
+#define CUSTOM_CMD_NEIGHBOR_QUERY		20
+#define CUSTOM_CMD_HELLO				21	/* sent with TTL 0, so only neighbors hear it */
+#define CUSTOM_CMD_NEIGHBOR_REPORT		22
+#define CUSTOM_CMD_DATA_ACK				23
+#define CUSTOM_CMD_MEM_QUERY			24
+#define CUSTOM_CMD_MEM_REPORT			25
+#define CUSTOM_CMD_FUNC_COUNT			26
+
+#define CUSTOM_CMD_DEST_ALL				0xFF
+#define CUSTOM_CMD_DEST_RELAYS			0xFE	/* every aggregating relay, sent to CUSTOM_CMD_RELAY_GROUP */
+
+/* Group address every aggregating relay subscribes to */
+#define CUSTOM_CMD_RELAY_GROUP			0xC016
+
+#define CUSTOM_CMD_COMM_ADDR			0x3FFF
+
+/* Most samples a leaf holds back, and so carries in one data frame */
+#define mBatchMaxSamples_c				8
+
+/* Link statistics are indexed directly by the 8 bit node ID */
+#define mLinkStatsSize_c				256
+#define mLinkStatsWindow_c				32
+
+/* Program flash the roles keep their own records in, between the image and the NVM
+   area at the top of the KW41Z's 512 KB:
+     0x70000 - 0x73FFF   reading history, leaves only, mHistorySectors_c sectors
+     0x74000 - 0x747FF   stored settings, every role, one sector
+   The linker file must end m_text below mAppFlashStart_c; AppFlash_IsFree() checks
+   the image end it exports, and the records are left alone when they overlap. */
+#define mFlashSectorSize_c				2048	/* KW41Z program flash sector */
+#define mAppFlashStart_c				0x00070000
+#define mHistoryFlashStart_c			mAppFlashStart_c
+#define mHistorySectors_c				8
+#define mSettingsFlashStart_c			(mHistoryFlashStart_c + mHistorySectors_c * mFlashSectorSize_c)
+#define mAppFlashEnd_c					(mSettingsFlashStart_c + mFlashSectorSize_c)
+
+/* The last sector holds the product data, the NVM area sits right below it */
+#if (mAppFlashStart_c % mFlashSectorSize_c) || (mAppFlashEnd_c > 0x0007F800)
+#error "The flash records must start on a sector and end below the product data"
+#endif
+
+/* Messages larger than one frame travel as numbered segments; a leaf only sends its
+   history reports and keeps a smaller buffer */
+#if gAppRole_d == gAppRoleLeaf_c
+#define mSegMaxMessage_c				512
+#else
+#define mSegMaxMessage_c				1024
+#endif
+#define mSegPayload_c					(gMeshMaxAppCustomDataSize_c - CUSTOM_CMD_SEG_DATA)
+#define mSegMaxCount_c					((mSegMaxMessage_c + mSegPayload_c - 1) / mSegPayload_c)
+#define mSegBitmapSize_c				((mSegMaxCount_c + 7) / 8)
+#define mSegWindow_c					64
+
+/* Neighbor discovery: slot 0 of each hello cycle is the Comm's, a node sends one hello
+   per cycle in slot 1 + ID % CUSTOM_CMD_NBR_SLOTS, then after the last cycle its report
+   chunks in report slot ID % CUSTOM_CMD_NBR_SLOTS */
+#define mHelloSlot_ms					50
+#define mHelloRepeats_c					4
+#define mNeighborReportSlot_ms			200
+
+/* Air time assumed for each hop a time beacon takes; the receiver adds it for the
+   last hop and every relay for the hop before it */
+#define mTimeSyncHopDelay_ms			10
+
+/* Periodic jobs of a node share one low-power timer, see Sched_Start */
+#define mSchedTick_ms					100
+
+#define mSchedReport_c					0
+#define mSchedSample_c					1
+#define mSchedBatch_c					2
+#define mSchedTempReport_c				3
+#define mSchedLightReport_c				4
+#define mSchedLightWait_c				5
+#define mSchedJobs_c					6
+
+/*************************************************************************************
+**************************************************************************************
+* Public type definitions
+**************************************************************************************
+*************************************************************************************/
+/* Activity counted for energy accounting since boot */
+typedef struct energyStats_tag
+{
+    uint32_t    sends;
+    uint32_t    txBytes;
+    uint32_t    rxFrames;
+    uint32_t    readings;
+    uint32_t    uartBytes;
+    uint64_t    awake_ms;
+    uint64_t    asleep_ms;
+} energyStats_t;
+
+/* Per-source sequence tracking; aWindow bit n is set when (aLastSeq - n) was received */
+typedef struct linkStats_tag
+{
+    uint32_t    aWindow[mLinkStatsSize_c];
+    uint16_t    aReceived[mLinkStatsSize_c];
+    uint16_t    aLost[mLinkStatsSize_c];
+    uint16_t    aReordered[mLinkStatsSize_c];
+    uint16_t    aDuplicate[mLinkStatsSize_c];
+    uint16_t    aShed[mLinkStatsSize_c];
+    uint16_t    aCoalesced[mLinkStatsSize_c];
+    uint8_t     aLastSeq[mLinkStatsSize_c];
+} linkStats_t;
+
+/* Start of every stored configuration record; the role's own fields follow */
+typedef struct settingsHeader_tag
+{
+    uint16_t    magic;
+    uint16_t    check;          /* over the rest of the record */
+    uint8_t     version;        /* the role's record layout */
+} settingsHeader_t;
+
+/*************************************************************************************
+**************************************************************************************
+* Public memory declarations
+**************************************************************************************
+*************************************************************************************/
+extern energyStats_t gEnergyStats;
+
+#if gAppRole_d != gAppRoleComm_c
+/* Serial interface debug_printf writes to, opened by the role */
+extern uint8_t gAppSerialId;
+#endif
+
+/************************************************************************************
+*************************************************************************************
+* Public prototypes
+*************************************************************************************
+************************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void CustomData_Send(meshAddress_t destination, meshCustomData_t* pFrame);
+void Frame_Init(meshCustomData_t* pFrame, uint8_t destId, uint8_t func, uint8_t length);
+void Frame_PutU16(meshCustomData_t* pFrame, uint8_t index, uint16_t value);
+uint8_t CustomData_EncodeValue(uint8_t* pBuf, int32_t value);
+uint8_t CustomData_DecodeValue(uint8_t* pBuf, uint8_t maxLen, int32_t* pValue);
+uint8_t CustomData_PackSamples(meshCustomData_t* pFrame, int32_t* pSamples, uint8_t count);
+uint8_t CustomData_UnpackSamples(meshCustomData_t* pFrame, int32_t* pSamples);
+uint8_t CustomData_UnpackMulti(meshCustomData_t* pFrame, uint8_t* pValIds, int32_t* pValues);
+bool_t LinkStats_Update(linkStats_t* pStats, uint8_t id, uint8_t seq);
+void* Mem_Alloc(uint32_t numBytes);
+void Mem_TrackMainTask(void);
+void Mem_TrackTimerTask(void);
+void Mem_Sample(void);
+void Mem_FillReport(meshCustomData_t* pFrame);
+bool_t Settings_Read(settingsHeader_t* pRecord, uint16_t size, uint8_t version);
+bool_t Settings_Write(settingsHeader_t* pRecord, uint16_t size, uint8_t version);
+bool_t AppFlash_IsFree(void);
+
+#if gAppRole_d != gAppRoleComm_c
+uint16_t debug_printf(char * format,...);
+void Node_Init(void);
+void Sched_Start(uint8_t job, pfTmrCallBack_t handler, uint32_t delay_ms, uint32_t period_ms);
+void Sched_Stop(uint8_t job);
+bool_t Sched_IsActive(uint8_t job);
+void CustomData_SendAck(meshCustomData_t* pFrame);
+void CustomData_HandleMemQuery(meshCustomData_t* pFrame);
+void CustomData_HandleEnergyQuery(meshCustomData_t* pFrame);
+void CustomData_HandleHopProbe(meshCustomData_t* pFrame);
+void CustomData_HandleNeighborQuery(meshCustomData_t* pFrame);
+void CustomData_HandleHello(meshCustomData_t* pFrame);
+bool_t Neighbor_IsBusy(void);
+
+#if mNodeSendsData_d
+uint8_t* Segment_GetTxBuffer(void);
+void Segment_Send(meshAddress_t destination, uint8_t destId, uint16_t length);
+bool_t Segment_IsBusy(void);
+void CustomData_HandleSegStatus(meshCustomData_t* pFrame);
+#endif
+
+#if gAppTempSensor_d
+void TempSensor_Request(void);
+bool_t TempSensor_Get(int16_t* pCelsius);
+#endif
+
+/* Provided by the role's app.c */
+void Power_Update(void);
+#if gAppLightBulb_d
+void UpdateLightUI(bool_t lightOn);
+#endif
+#endif /* gAppRole_d != gAppRoleComm_c */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NODE_COMMON_H_ */
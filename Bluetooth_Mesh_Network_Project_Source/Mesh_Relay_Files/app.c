@@ -45,10 +45,17 @@
 #include "LED.h"
 #include "TimersManager.h"
 #include "FunctionLib.h"
+#include "Flash_Adapter.h"
 #include "fsl_os_abstraction.h"
+#ifdef FSL_RTOS_FREE_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
 #include "Panic.h"
 #include "app.h"
 #include "board.h"
+#include "fsl_adc16.h"
+#include "ApplMain.h"
 
 #include "mesh_interface.h"
 
@@ -67,6 +74,8 @@
 #include "SerialManager.h"
 #include "MemManager.h"
 
+#include "node_common.h"
+
 
 
 /************************************************************************************
@@ -75,68 +84,107 @@
 *************************************************************************************
 ************************************************************************************/
 #define ADDRESS 9000
-#define mAppMaxResponseDelay_ms    500
-
-#define SHELL_CB_SIZE                 128
 #define SHELL_MAX_COMMANDS            20
 
-#define CUSTOM_CMD_SOURCE				0
-#define CUSTOM_CMD_DEST					1
-#define CUSTOM_CMD_FUNC					2
-#define CUSTOM_CMD_POLL_ITVL_0			3
-#define CUSTOM_CMD_POLL_ITVL_1			4
-#define CUSTOM_CMD_POLL_ITVL_2			5
-#define CUSTOM_CMD_POLL_ITVL_3			6
-#define CUSTOM_CMD_POWER_CTRL			7
-#define CUSTOM_CMD_VAL_ID				8
-#define CUSTOM_CMD_VAL_0				9
-#define CUSTOM_CMD_VAL_1				10
-#define CUSTOM_CMD_VAL_2				11
-#define CUSTOM_CMD_VAL_3				12
-
-#define CUSTOM_CMD_TEMP_ID				1
-#define CUSTOM_CMD_LIGHT_ID				2
-
-#define CUSTOM_CMD_SYS_AWAKE			1
-#define CUSTOM_CMD_SYS_SLEEP			2
-
-#define CUSTOM_CMD_START_DATA			1
-#define CUSTOM_CMD_STOP_DATA			2
+/* Leaves whose samples are held between upstream reports, and samples kept per leaf */
+#define mLeafStoreSize_c				16
+
+/* Per-leaf token buckets: a leaf earns a token every report interval configured for
+   its kind of sensor, up to mRateBurst_c. A frame without a token replaces the samples
+   held for the leaf, and after mRateDebt_c such frames further ones are dropped. */
+#define mRateBurst_c					4
+#define mRateDebt_c						4
+
+#define mRatePass_c						0
+#define mRateCoalesce_c					1
+#define mRateShed_c						2
+
+/* Upstream frames per report cycle, shared between leaves by deficit round-robin with
+   a quantum of one full frame */
+#define mUpstreamBudget_c				mLeafStoreSize_c
+#define mUpstreamQuantum_c				gMeshMaxAppCustomDataSize_c
+
+/* Outgoing frames kept from one send to the next, see Frame_Init */
+#define mFrameReportConfig_c			0	/* report configuration for a leaf */
+#if gAppRelayAggregation_d
+#define mFrameUpstream_c				1	/* held leaf samples to the Comm */
+#define mFrameDataAck_c					2	/* acknowledgements of leaf data */
+#define mFrameSlots_c					3
+#else
+#define mFrameSlots_c					1
+#endif
 
+/* Layout of the relay's settings_t record, see Settings_Read */
+#define mSettingsVersion_c				2	/* bump when settings_t changes layout */
 
 /************************************************************************************
 *************************************************************************************
 * Private type definitions
 *************************************************************************************
 ************************************************************************************/
+/* Samples received from each leaf and not yet forwarded; aFirstSeq is the origin
+   sequence number of aSamples[n][0] and the rest follow consecutively */
+typedef struct leafStore_tag
+{
+    int32_t     aSamples[mLeafStoreSize_c][mBatchMaxSamples_c];
+    uint8_t     aId[mLeafStoreSize_c];
+    uint8_t     aValId[mLeafStoreSize_c];
+    uint8_t     aFirstSeq[mLeafStoreSize_c];
+    uint8_t     aCount[mLeafStoreSize_c];
+    uint16_t    aStamp[mLeafStoreSize_c];	/* CUSTOM_CMD_STAMP_0 of the newest held sample */
+    uint32_t    aRefill_ms[mLeafStoreSize_c];	/* when the last token was earned */
+    uint16_t    aDeficit[mLeafStoreSize_c];	/* upstream bytes the leaf may still send */
+    int8_t      aTokens[mLeafStoreSize_c];	/* below zero: frames taken on credit */
+    bool_t      aConfigDirty[mLeafStoreSize_c];	/* CUSTOM_CMD_REPORT_CONFIG not yet acknowledged */
+} leafStore_t;
+
+/* Reporting configuration kept across resets */
+typedef struct settings_tag
+{
+    settingsHeader_t header;
+    uint8_t     streaming;          /* upstream reports were running */
+    uint32_t    commReportInterval_sec;
+    uint32_t    aLeafIntervalMin_sec[CUSTOM_CMD_LIGHT_ID + 1];
+    uint16_t    aLeafIntervalMax_sec[CUSTOM_CMD_LIGHT_ID + 1];
+    uint8_t     aLeafPowerCtrl[CUSTOM_CMD_LIGHT_ID + 1];
+} settings_t;
+
+/* Handles one received custom data frame, selected by its CUSTOM_CMD_FUNC */
+typedef void (*pfCustomDataHandler_t)(meshCustomData_t* pFrame);
 
 /************************************************************************************
 *************************************************************************************
 * Private memory declarations
 *************************************************************************************
 ************************************************************************************/
-#if gAppLightBulb_d
-static bool_t mLightState = FALSE;
-static tmrTimerID_t mLightReportTimerId;
-static uint32_t     mLightReportInterval_sec;
-static tmrTimerID_t mLightRandomWaitTimerId;
-#endif
+static uint32_t     mCommReportInterval_sec;
 
-#if gAppTempSensor_d
-static tmrTimerID_t mTemperatureReportTimerId;
-static uint32_t     mTemperatureReportInterval_sec;
+#if gAppRelayAggregation_d
+static uint8_t 		mUpstreamSeq = 0;
+static uint8_t		mUpstreamNext = 0;		/* store slot the next report cycle starts at */
+
+static linkStats_t	mLinkStats;
 #endif
+static leafStore_t	mLeafStore;
 
-static uint8_t        interfaceId;
-static uint32_t     mSenReportInterval_sec;
-static uint32_t     mCommReportInterval_sec;
+static uint8_t		mTimeEpoch;
+static bool_t		mTimeRepeated = FALSE;
 
-static uint32_t 	mTempLatVal = 0;
-static uint32_t 	mLightLatVal = 0;
+/* Power state requested for each kind of leaf, indexed by CUSTOM_CMD_VAL_ID */
+static uint8_t mLeafPowerCtrl[CUSTOM_CMD_LIGHT_ID + 1] =
+{
+    CUSTOM_CMD_SYS_AWAKE, CUSTOM_CMD_SYS_AWAKE, CUSTOM_CMD_SYS_AWAKE
+};
+
+/* Report interval bounds for each kind of leaf, indexed by CUSTOM_CMD_VAL_ID; a maximum
+   above the minimum lets the leaf adapt its interval between the two */
+static uint32_t mLeafIntervalMin_sec[CUSTOM_CMD_LIGHT_ID + 1] = { 5, 5, 5 };
+static uint16_t mLeafIntervalMax_sec[CUSTOM_CMD_LIGHT_ID + 1] = { 0, 0, 0 };
 
-static tmrTimerID_t mCustomReportTimerId;
+static meshCustomData_t mFrames[mFrameSlots_c];
 
 bool_t IsTimerStarted = FALSE;
+static bool_t mResumeReports = FALSE;        /* upstream reports were running before the reset */
 
 /************************************************************************************
 *************************************************************************************
@@ -150,46 +198,57 @@ static meshResult_t MeshGenericCallback
     meshGenericEvent_t* pEvent
 );
 
-#if gAppLightBulb_d
-static void EnableLightReports(bool_t enable);
-static void LightReportTimerCallback(void* param);
-static void RandomLightWait(uint32_t maxMs);
-static meshResult_t MeshLightServerCallback
-(
-    meshLightServerEvent_t* pEvent
-);
-static void UpdateLightUI(bool_t lightOn);
-#endif
-
-#if gAppTempSensor_d
-static void EnableTemperatureReports(bool_t enable);
-static void TemperatureReportTimerCallback(void* param);
-static meshResult_t MeshTemperatureServerCallback
-(
-    meshTemperatureServerEvent_t* pEvent
-);
-#endif
-
+static void CustomData_SendReportConfig(uint8_t index);
+static void LeafConfig_Update(uint8_t valId);
+static void LeafInterval_Set(uint8_t target, uint32_t min_sec, uint16_t max_sec);
+static void CustomData_Dispatch(meshCustomData_t* pFrame);
+static void CustomData_HandleConfigAck(meshCustomData_t* pFrame);
+static void CustomData_HandlePowerConfig(meshCustomData_t* pFrame);
+static void CustomData_HandleIntervalConfig(meshCustomData_t* pFrame);
+static void CustomData_HandleTimeSync(meshCustomData_t* pFrame);
+static bool_t Settings_Load(void);
+static void Settings_Save(void);
+static void Settings_Capture(settings_t* pRecord);
+static void Settings_Apply(settings_t* pRecord);
+
+#if gAppRelayAggregation_d
 static void CustomReportTimerCallback(void* param);
+static void LinkStats_Report(void);
+static uint8_t LeafStore_Find(uint8_t id);
+static void LeafStore_Add(uint8_t index, uint8_t valId, uint8_t seq, int32_t value);
+static uint8_t LeafStore_Admit(uint8_t index, uint8_t valId);
+static uint8_t LeafStore_SendFrame(uint8_t index, uint16_t limit);
+static void LeafStore_Flush(uint8_t index);
+static void CustomData_HandleStartData(meshCustomData_t* pFrame);
+static void CustomData_HandleStopData(meshCustomData_t* pFrame);
+static void CustomData_HandleSensorData(meshCustomData_t* pFrame);
+static void CustomData_SendDataAck(uint8_t leaf);
+static void CustomData_HandleLinkQuery(meshCustomData_t* pFrame);
+static void Upstream_Start(void);
+static void Upstream_SendMulti(meshCustomData_t* pFrame, uint8_t count);
+#endif
 
-
-
-uint16_t debug_printf(char * format,...)
+static const pfCustomDataHandler_t mCustomDataHandlers[CUSTOM_CMD_FUNC_COUNT] =
 {
-    va_list ap;
-    uint16_t n;
-    char *pStr = (char*)MEM_BufferAlloc(SHELL_CB_SIZE);
+#if gAppRelayAggregation_d
+    [CUSTOM_CMD_START_DATA] = CustomData_HandleStartData,
+    [CUSTOM_CMD_STOP_DATA] = CustomData_HandleStopData,
+    [CUSTOM_CMD_SENSOR_DATA] = CustomData_HandleSensorData,
+    [CUSTOM_CMD_LINK_QUERY] = CustomData_HandleLinkQuery,
+    [CUSTOM_CMD_SEG_STATUS] = CustomData_HandleSegStatus,
+#endif
+    [CUSTOM_CMD_CONFIG_ACK] = CustomData_HandleConfigAck,
+    [CUSTOM_CMD_POWER_CONFIG] = CustomData_HandlePowerConfig,
+    [CUSTOM_CMD_ENERGY_QUERY] = CustomData_HandleEnergyQuery,
+    [CUSTOM_CMD_MEM_QUERY] = CustomData_HandleMemQuery,
+    [CUSTOM_CMD_INTERVAL_CONFIG] = CustomData_HandleIntervalConfig,
+    [CUSTOM_CMD_TIME_SYNC] = CustomData_HandleTimeSync,
+    [CUSTOM_CMD_HOP_PROBE] = CustomData_HandleHopProbe,
+    [CUSTOM_CMD_NEIGHBOR_QUERY] = CustomData_HandleNeighborQuery,
+    [CUSTOM_CMD_HELLO] = CustomData_HandleHello,
+};
 
-    if(!pStr)
-        return 0;
 
-    va_start(ap, format);
-    n = vsnprintf(pStr, SHELL_CB_SIZE, format, ap);
-    //va_end(ap); /* follow MISRA... */
-    Serial_SyncWrite(interfaceId, (uint8_t*)pStr, n);
-    MEM_BufferFree(pStr);
-    return n;
-}
 
 /************************************************************************************
 *************************************************************************************
@@ -198,19 +257,23 @@ uint16_t debug_printf(char * format,...)
 ************************************************************************************/
 void BleApp_Init(void)
 {    
+    Mem_TrackMainTask();
     BOARD_InitAdc();
+#if gAppTempSensor_d
+    EnableIRQ(ADC0_IRQn);
+#endif
     
     RNG_Init();
     
     SerialManager_Init();
 
-    Serial_InitInterface(&interfaceId, APP_SERIAL_INTERFACE_TYPE, APP_SERIAL_INTERFACE_INSTANCE);
-    Serial_SetBaudRate(interfaceId, gUARTBaudRate115200_c);
+    Serial_InitInterface(&gAppSerialId, APP_SERIAL_INTERFACE_TYPE, APP_SERIAL_INTERFACE_INSTANCE);
+    Serial_SetBaudRate(gAppSerialId, gUARTBaudRate115200_c);
 
     uint8_t rngSeed[20] = { BD_ADDR_ID };
     RNG_SetPseudoRandomNoSeed(rngSeed);
 
-    //Serial_Print(interfaceId, "\n\rBLE Light Bulb ID: \n\r", gAllowToBlock_d);
+    //Serial_Print(gAppSerialId, "\n\rBLE Light Bulb ID: \n\r", gAllowToBlock_d);
     debug_printf("BLE Light Bulb ID: %d Multicast Addr: %d - 0x%x\n\r", BD_ADDR_ID,ADDRESS,(uint32_t)(ADDRESS));
 }
 
@@ -255,21 +318,8 @@ void BleApp_HandleKeys(key_event_t events)
 #endif
 #endif
 
-            mSenReportInterval_sec = 3;
-            debug_printf("Switch Pressed: 4 time: %d\n\r",mSenReportInterval_sec);
-            meshAddress_t destination = GetMeshAddressFromId(112);
-            meshCustomData_t CustomData;
-            CustomData.aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
-            CustomData.aData[CUSTOM_CMD_DEST] = 112;
-
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mSenReportInterval_sec & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mSenReportInterval_sec >> 8) & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mSenReportInterval_sec >> 16) & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mSenReportInterval_sec >> 24) & 0xFF);
-
-            CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_AWAKE;
-            CustomData.dataLength = 7;
-            Mesh_SendCustomData(destination,&CustomData);
+            LeafInterval_Set(0, 3, 0);
+            debug_printf("Switch Pressed: 4 time: %d\n\r",mLeafIntervalMin_sec[CUSTOM_CMD_TEMP_ID]);
         }
         break;
 
@@ -286,23 +336,8 @@ void BleApp_HandleKeys(key_event_t events)
 #endif
 #endif
 
-            mSenReportInterval_sec = 10;
-
-        	debug_printf("Switch Pressed: 3 time: %d\n\r",mSenReportInterval_sec);
-
-            meshAddress_t destination = GetMeshAddressFromId(112);
-            meshCustomData_t CustomData;
-            CustomData.aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
-            CustomData.aData[CUSTOM_CMD_DEST] = 112;
-
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mSenReportInterval_sec & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mSenReportInterval_sec >> 8) & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mSenReportInterval_sec >> 16) & 0xFF);
-            CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mSenReportInterval_sec >> 24) & 0xFF);
-
-            CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_AWAKE;
-            CustomData.dataLength = 7;
-            Mesh_SendCustomData(destination,&CustomData);
+            LeafInterval_Set(0, 10, 0);
+            debug_printf("Switch Pressed: 3 time: %d\n\r",mLeafIntervalMin_sec[CUSTOM_CMD_TEMP_ID]);
         }
         break;
         
@@ -318,16 +353,15 @@ void BleApp_HandleKeys(key_event_t events)
 ************************************************************************************/
 static void AppConfig()
 {      
-#if gAppLightBulb_d    
-    mLightReportTimerId = TMR_AllocateTimer();
-    mLightRandomWaitTimerId = TMR_AllocateTimer();
-    MeshLightServer_RegisterCallback(MeshLightServerCallback);
-#endif
-    
-#if gAppTempSensor_d
-    mTemperatureReportTimerId = TMR_AllocateTimer();
-    MeshTemperatureServer_RegisterCallback(MeshTemperatureServerCallback);
+    Node_Init();
+    Frame_Init(&mFrames[mFrameReportConfig_c], 0, CUSTOM_CMD_REPORT_CONFIG, CUSTOM_CMD_REPORT_CONFIG_LEN);
+#if gAppRelayAggregation_d
+    Frame_Init(&mFrames[mFrameUpstream_c], 0, CUSTOM_CMD_SENSOR_DATA, 0);
+    Frame_Init(&mFrames[mFrameDataAck_c], 0, CUSTOM_CMD_DATA_ACK, CUSTOM_CMD_DATA_ACK_LEN);
 #endif
+
+    NV_Init();
+    Settings_Load();
     
     MeshNode_Init(MeshGenericCallback);
 }
@@ -357,20 +391,27 @@ static meshResult_t MeshGenericCallback
 #if gAppLightBulb_d
                     Mesh_SetRelayState(TRUE);
                     Mesh_Subscribe(gMeshProfileLighting_c,ADDRESS);
+#if gAppRelayAggregation_d
+                    Mesh_Subscribe(gMeshProfileLighting_c, CUSTOM_CMD_RELAY_GROUP);
+#endif
 #else
                     Mesh_SetRelayState(FALSE);
 #endif
                     debug_printf("Device Commissioned: %d\n\r", pEvent->eventData.initComplete.deviceIsCommissioned);
+#if gAppRelayAggregation_d
+                    /* Pick up forwarding where it was, without waiting for the Comm */
+                    if (mResumeReports)
+                    {
+                        mResumeReports = FALSE;
+                        Upstream_Start();
+                    }
+#endif
                 }
             }               
             break;
             
         case gMeshCustomDataReceived_c:
-			{
-				//debug_printf("\r\n -> Received Custom Data: Source: %d\r\n",
-						//GetIdFromMeshAddress(pEvent->eventData.customDataReceived.source));
-
-
+            {
 				debug_printf("Data is: ");
                 for(int i = 0; i<pEvent->eventData.customDataReceived.data.dataLength && i<gMeshMaxAppCustomDataSize_c;
                 		i++)
@@ -378,84 +419,11 @@ static meshResult_t MeshGenericCallback
                 	debug_printf("0x%x ",pEvent->eventData.customDataReceived.data.aData[i]);
                 }
                 debug_printf("\r\n");
-                /*
-				debug_printf("Source: %d Dest: %d Poll Time: %d\r\n",
-						pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_SOURCE],
-						pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_DEST],
-						mSenReportInterval_sec);
-*/
-				if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_SOURCE] == 0) // Comm is source
-				{
-	                mCommReportInterval_sec = (uint32_t)(
-	                		(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_0]));
-
-					if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_FUNC] == CUSTOM_CMD_START_DATA)
-					{
-						 mCommReportInterval_sec = (uint32_t)(
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_0]));
-
-						if (IsTimerStarted)
-						{
-							TMR_StopTimer(mCustomReportTimerId);
-						}
-						TMR_StartIntervalTimer
-						(
-							mCustomReportTimerId,
-							1000 * mCommReportInterval_sec, // 1000 * reqd seconds
-							CustomReportTimerCallback,
-							NULL
-						);
-						IsTimerStarted = TRUE;
-
-					}
-					else if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_FUNC] == CUSTOM_CMD_STOP_DATA)
-					{
-						if (IsTimerStarted)
-						{
-							TMR_StopTimer(mCustomReportTimerId);
-							IsTimerStarted = FALSE;
-						}
-					}
-				}
-				else // Leaf node is source
-				{
-	                mSenReportInterval_sec = (uint32_t)(
-	                		(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
-							(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_POLL_ITVL_0]));
-
-					if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] == CUSTOM_CMD_TEMP_ID)
-					{
-						mTempLatVal = (uint32_t)(
-		                		(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_3]<<24) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_2]<<16) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_1]<<8) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_0]));
-					}
-					else if(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] == CUSTOM_CMD_LIGHT_ID)
-					{
-						mLightLatVal = (uint32_t)(
-		                		(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_3]<<24) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_2]<<16) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_1]<<8) |
-								(pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_0]));
-					}
-					else
-					{
-						debug_printf("Invalid Val type received: %d",pEvent->eventData.customDataReceived.data.aData[CUSTOM_CMD_VAL_ID] );
-					}
-
-					debug_printf("Received Temp val is: %d , Light val is: %d\r\n", mTempLatVal,mLightLatVal);
-				}
-			}
-			break;
+
+                gEnergyStats.rxFrames++;
+                CustomData_Dispatch(&pEvent->eventData.customDataReceived.data);
+            }
+            break;
 
         default:
             {
@@ -487,236 +455,744 @@ static meshResult_t MeshGenericCallback
 #define CUSTOM_CMD_SYS_SLEEP			2
  */
 
-static void CustomReportTimerCallback(void* param)
+/*! *********************************************************************************
+* \brief        Hands a received frame addressed to this node to the handler of its
+*               function code.
+*
+* \param[in]    pFrame  Received custom data.
+********************************************************************************** */
+static void CustomData_Dispatch(meshCustomData_t* pFrame)
 {
+    uint8_t func = pFrame->aData[CUSTOM_CMD_FUNC];
 
-    meshAddress_t destination = 0x3FFF;
-    meshCustomData_t CustomData;
-    CustomData.aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
-    CustomData.aData[CUSTOM_CMD_DEST] = 0;
+    Mem_Sample();
 
-    CustomData.aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mCommReportInterval_sec & 0xFF);
-    CustomData.aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mCommReportInterval_sec >> 8) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mCommReportInterval_sec >> 16) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mCommReportInterval_sec >> 24) & 0xFF);
+    if ((pFrame->dataLength <= CUSTOM_CMD_FUNC) || (pFrame->dataLength > gMeshMaxAppCustomDataSize_c))
+    {
+        return;
+    }
 
-    //CustomData.aData[CUSTOM_CMD_POWER_CTRL] = CUSTOM_CMD_SYS_AWAKE;
+    if ((pFrame->aData[CUSTOM_CMD_DEST] != BD_ADDR_ID) && (pFrame->aData[CUSTOM_CMD_DEST] != CUSTOM_CMD_DEST_ALL) &&
+        (pFrame->aData[CUSTOM_CMD_DEST] != CUSTOM_CMD_DEST_RELAYS))
+    {
+        return;
+    }
 
-    CustomData.aData[CUSTOM_CMD_VAL_ID] = CUSTOM_CMD_TEMP_ID;
-    CustomData.aData[CUSTOM_CMD_VAL_0] = (uint8_t)(mTempLatVal & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_1] = (uint8_t)((mTempLatVal >> 8) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_2] = (uint8_t)((mTempLatVal >> 16) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_3] = (uint8_t)((mTempLatVal >> 24) & 0xFF);
+    if ((func < CUSTOM_CMD_FUNC_COUNT) && mCustomDataHandlers[func])
+    {
+        mCustomDataHandlers[func](pFrame);
+    }
+}
 
-    CustomData.dataLength = 13;
-    Mesh_SendCustomData(destination,&CustomData);
-    debug_printf("Custom data Sent to: %d\n\r",GetIdFromMeshAddress(destination));
-/*
-	debug_printf("Data is: ");
-    for(int i = 0; i<CustomData.dataLength && i<gMeshMaxAppCustomDataSize_c;
-    		i++)
+#if gAppRelayAggregation_d
+static void CustomData_HandleStartData(meshCustomData_t* pFrame)
+{
+    if (pFrame->dataLength < CUSTOM_CMD_START_DATA_LEN)
     {
-    	debug_printf("0x%x ", CustomData.aData[i]);
+        return;
     }
-    debug_printf("\r\n");
 
-*/
-    CustomData.aData[CUSTOM_CMD_VAL_ID] = CUSTOM_CMD_LIGHT_ID;
-    CustomData.aData[CUSTOM_CMD_VAL_0] = (uint8_t)(mLightLatVal & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_1] = (uint8_t)((mLightLatVal >> 8) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_2] = (uint8_t)((mLightLatVal >> 16) & 0xFF);
-    CustomData.aData[CUSTOM_CMD_VAL_3] = (uint8_t)((mLightLatVal >> 24) & 0xFF);
+    mCommReportInterval_sec = (uint32_t)(
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_3]<<24) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_2]<<16) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_1]<<8) |
+            (pFrame->aData[CUSTOM_CMD_POLL_ITVL_0]));
+
+    Upstream_Start();
+    Settings_Save();
 
-    CustomData.dataLength = 13;
-    Mesh_SendCustomData(destination,&CustomData);
-    debug_printf("Custom data Sent to: %d\n\r",GetIdFromMeshAddress(destination));
-	debug_printf("Data is: ");
-    for(int i = 0; i<CustomData.dataLength && i<gMeshMaxAppCustomDataSize_c;
-    		i++)
+    CustomData_SendAck(pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        (Re)starts forwarding held samples to the Comm every
+*               mCommReportInterval_sec.
+********************************************************************************** */
+static void Upstream_Start(void)
+{
+    Sched_Start
+    (
+        mSchedReport_c,
+        CustomReportTimerCallback,
+        1000 * mCommReportInterval_sec, // 1000 * reqd seconds
+        1000 * mCommReportInterval_sec
+    );
+    IsTimerStarted = TRUE;
+}
+
+/*! *********************************************************************************
+* \brief        Forwards a leaf's CUSTOM_CMD_MULTI_ID frame to the Comm as it is, under
+*               this relay's source and upstream sequence number.
+*
+* \param[in]    pFrame  Received frame, patched in place for the repeat.
+* \param[in]    count   Readings it carries.
+********************************************************************************** */
+static void Upstream_SendMulti(meshCustomData_t* pFrame, uint8_t count)
+{
+    pFrame->aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
+    pFrame->aData[CUSTOM_CMD_DEST] = 0;
+    pFrame->aData[CUSTOM_CMD_HOP_SEQ] = mUpstreamSeq++;
+    CustomData_Send(CUSTOM_CMD_COMM_ADDR, pFrame);
+    gEnergyStats.readings += count;
+}
+
+static void CustomData_HandleStopData(meshCustomData_t* pFrame)
+{
+    if (IsTimerStarted)
     {
-    	debug_printf("0x%x ", CustomData.aData[i]);
+        Sched_Stop(mSchedReport_c);
+        IsTimerStarted = FALSE;
     }
-    debug_printf("\r\n");
+    Settings_Save();
+
+    CustomData_SendAck(pFrame);
 }
+#endif
+
+/*! *********************************************************************************
+* \brief        Repeats the first copy of each time beacon towards the leaves. The
+*               mesh time it carries is advanced by the air time of the hop here and
+*               by the time the beacon spent in this node.
+*
+* \param[in]    pFrame  CUSTOM_CMD_TIME_SYNC frame, reused for the repeat.
+********************************************************************************** */
+static void CustomData_HandleTimeSync(meshCustomData_t* pFrame)
+{
+    uint32_t received_ms = OSA_TimeGetMsec();
+    uint8_t epoch = pFrame->aData[CUSTOM_CMD_TIME_EPOCH];
+    uint32_t mesh_ms;
 
+    if (pFrame->dataLength < CUSTOM_CMD_TIME_SYNC_LEN)
+    {
+        return;
+    }
 
-/*
+    if (mTimeRepeated && (epoch == mTimeEpoch))
+    {
+        return;
+    }
+    mTimeEpoch = epoch;
+    mTimeRepeated = TRUE;
+
+    FLib_MemCpy(&mesh_ms, &pFrame->aData[CUSTOM_CMD_TIME_MS_0], sizeof(mesh_ms));
+    pFrame->aData[CUSTOM_CMD_SOURCE] = BD_ADDR_ID;
+    pFrame->aData[CUSTOM_CMD_TIME_HOPS]++;
+    mesh_ms += mTimeSyncHopDelay_ms + (OSA_TimeGetMsec() - received_ms);
+    FLib_MemCpy(&pFrame->aData[CUSTOM_CMD_TIME_MS_0], &mesh_ms, sizeof(mesh_ms));
+    CustomData_Send(gBroadcastAddress_c, pFrame);
+}
+
+#if gAppRelayAggregation_d
+static void CustomData_HandleLinkQuery(meshCustomData_t* pFrame)
+{
+    LinkStats_Report();
+}
+
+/*! *********************************************************************************
+* \brief        Tells a leaf which of its recent frames arrived. The receive window of
+*               its link statistics makes the acknowledgement cumulative, so a lost
+*               acknowledgement is made good by the next one.
+*
+* \param[in]    leaf    Node ID of the leaf.
+********************************************************************************** */
+static void CustomData_SendDataAck(uint8_t leaf)
+{
+    meshCustomData_t* pFrame = &mFrames[mFrameDataAck_c];
+
+    pFrame->aData[CUSTOM_CMD_DEST] = leaf;
+    pFrame->aData[CUSTOM_CMD_DATA_ACK_SEQ] = mLinkStats.aLastSeq[leaf];
+    Frame_PutU16(pFrame, CUSTOM_CMD_DATA_ACK_MAP_0, (uint16_t)mLinkStats.aWindow[leaf]);
+    CustomData_Send(GetMeshAddressFromId(leaf), pFrame);
+}
+
+static void CustomData_HandleSensorData(meshCustomData_t* pFrame)
+{
+    uint8_t source = pFrame->aData[CUSTOM_CMD_SOURCE];
+    uint8_t seq = pFrame->aData[CUSTOM_CMD_SEQ];
+    uint8_t valId = pFrame->aData[CUSTOM_CMD_VAL_ID];
+    bool_t multi = (valId == CUSTOM_CMD_MULTI_ID);
+    int32_t aSamples[mBatchMaxSamples_c];
+    uint8_t aValIds[mBatchMaxSamples_c];
+    uint8_t count;
+    uint8_t index;
+    uint8_t rate;
+    bool_t fresh;
+
+    count = multi ? CustomData_UnpackMulti(pFrame, aValIds, aSamples) : CustomData_UnpackSamples(pFrame, aSamples);
+    if (!count)
+    {
+        debug_printf("Malformed data frame from: %d\r\n", source);
+        return;
+    }
+
+    /* Duplicates and late frames must not overwrite newer samples, but are still
+       acknowledged in case the acknowledgement of the first copy was lost. A relay
+       that is not forwarding stays silent, so its leaves fail over to another. */
+    fresh = LinkStats_Update(&mLinkStats, source, pFrame->aData[CUSTOM_CMD_HOP_SEQ]);
+    if (IsTimerStarted)
+    {
+        CustomData_SendDataAck(source);
+    }
+    if (!fresh)
+    {
+        return;
+    }
+
+    if (multi)
+    {
+        /* The leaf's first sensor sets its rate and its configuration */
+        valId = aValIds[0];
+    }
+    else if ((valId != CUSTOM_CMD_TEMP_ID) && (valId != CUSTOM_CMD_LIGHT_ID))
+    {
+        debug_printf("Invalid Val type received: %d",valId);
+        return;
+    }
+
+    index = LeafStore_Find(source);
+    if (index == mLeafStoreSize_c)
+    {
+        debug_printf("Leaf store full, dropped: %d\r\n", source);
+        mLinkStats.aShed[source] += count;
+        return;
+    }
+
+    rate = LeafStore_Admit(index, valId);
+    if (rate == mRateShed_c)
+    {
+        mLinkStats.aShed[source] += count;
+        return;
+    }
+    if (rate == mRateCoalesce_c)
+    {
+        /* Only the newest frame of a leaf over its rate goes upstream, and the leaf is
+           sent its configured interval again in case it was changed locally */
+        mLinkStats.aCoalesced[source] += mLeafStore.aCount[index];
+        mLeafStore.aCount[index] = 0;
+        mLeafStore.aConfigDirty[index] = TRUE;
+    }
+
+    if (multi)
+    {
+        /* Readings taken together go upstream together, after what is held */
+        if (IsTimerStarted)
+        {
+            LeafStore_Flush(index);
+            Upstream_SendMulti(pFrame, count);
+        }
+        mLeafStore.aValId[index] = valId;
+    }
+    else
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            LeafStore_Add(index, valId, (uint8_t)(seq + i), aSamples[i]);
+        }
+        mLeafStore.aStamp[index] = (uint16_t)(
+                (pFrame->aData[CUSTOM_CMD_STAMP_1]<<8) |
+                (pFrame->aData[CUSTOM_CMD_STAMP_0]));
+    }
+
+    /* A sleeping leaf only listens right after it reports */
+    if (mLeafStore.aConfigDirty[index])
+    {
+        CustomData_SendReportConfig(index);
+    }
+
+    debug_printf("Received %d samples from: %d last val is: %d\r\n", count, source, aSamples[count - 1]);
+}
+#endif
+
+/*! *********************************************************************************
+* \brief        Sends the report interval bounds and the power state for its kind of
+*               sensor to a leaf. The frame is repeated on every report of the leaf
+*               until it is acknowledged, so a sleeping leaf gets it in its listen
+*               window instead of through timed retries it would sleep through.
 *
-* Mesh Profile Callbacks
+* \param[in]    index   Slot returned by LeafStore_Find.
+********************************************************************************** */
+static void CustomData_SendReportConfig(uint8_t index)
+{
+    uint8_t leafId = mLeafStore.aId[index];
+    uint8_t valId = mLeafStore.aValId[index];
+    meshCustomData_t* pFrame = &mFrames[mFrameReportConfig_c];
+
+    if (valId > CUSTOM_CMD_LIGHT_ID)
+    {
+        valId = 0;
+    }
+
+    pFrame->aData[CUSTOM_CMD_DEST] = leafId;
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_0] = (uint8_t)(mLeafIntervalMin_sec[valId] & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_1] = (uint8_t)((mLeafIntervalMin_sec[valId] >> 8) & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_2] = (uint8_t)((mLeafIntervalMin_sec[valId] >> 16) & 0xFF);
+    pFrame->aData[CUSTOM_CMD_POLL_ITVL_3] = (uint8_t)((mLeafIntervalMin_sec[valId] >> 24) & 0xFF);
+    Frame_PutU16(pFrame, CUSTOM_CMD_POLL_MAX_0, mLeafIntervalMax_sec[valId]);
+    pFrame->aData[CUSTOM_CMD_POWER_CTRL] = mLeafPowerCtrl[valId];
+    CustomData_Send(GetMeshAddressFromId(leafId), pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Marks the configuration of every known leaf of one kind as changed
+*               and sends it straight away to those that are still awake to hear it.
 *
-*/
+* \param[in]    valId   CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_LIGHT_ID or 0 for every leaf.
+********************************************************************************** */
+static void LeafConfig_Update(uint8_t valId)
+{
+    for (uint8_t index = 0; index < mLeafStoreSize_c; index++)
+    {
+        if (mLeafStore.aId[index] &&
+            ((valId == 0) || (mLeafStore.aValId[index] == valId)))
+        {
+            mLeafStore.aConfigDirty[index] = TRUE;
+            CustomData_SendReportConfig(index);
+        }
+    }
+}
 
-#if gAppLightBulb_d
-static meshResult_t MeshLightServerCallback
-(
-    meshLightServerEvent_t* pEvent
-)
+static void CustomData_HandleConfigAck(meshCustomData_t* pFrame)
 {
-    switch (pEvent->eventType)
+    if ((pFrame->dataLength < CUSTOM_CMD_ACK_LEN) ||
+        (pFrame->aData[CUSTOM_CMD_ACK_FUNC] != CUSTOM_CMD_REPORT_CONFIG))
     {
-        case gMeshLightToggleCommand_c:
-            {
-            	debug_printf("MeshLightServerCallback: Light Toggle Event %d\n\r");
-                mLightState = !mLightState;
-                UpdateLightUI(mLightState);
-                RandomLightWait(mAppMaxResponseDelay_ms);
-            }
-            break;
-            
-        case gMeshLightGetCommand_c:
-            {
-            	debug_printf("MeshLightServerCallback: Light GET Event Source: %d , Light state: %d\n\r"
-            			,pEvent->eventData.getCommand.source,mLightState);
-                MeshLightServer_SendState(pEvent->eventData.getCommand.source, mLightState);
-            }
-            break;
-            
-        case gMeshLightSetCommand_c:
+        return;
+    }
+
+    for (uint8_t index = 0; index < mLeafStoreSize_c; index++)
+    {
+        if (mLeafStore.aId[index] && (mLeafStore.aId[index] == pFrame->aData[CUSTOM_CMD_SOURCE]))
+        {
+            mLeafStore.aConfigDirty[index] = FALSE;
+            debug_printf("\r\nConfig acknowledged by %d\r\n", pFrame->aData[CUSTOM_CMD_SOURCE]);
+        }
+    }
+}
+
+static void CustomData_HandlePowerConfig(meshCustomData_t* pFrame)
+{
+    uint8_t target = pFrame->aData[CUSTOM_CMD_POWER_TARGET];
+    uint8_t state = pFrame->aData[CUSTOM_CMD_POWER_STATE];
+
+    if ((pFrame->dataLength < CUSTOM_CMD_POWER_CONFIG_LEN) || (target > CUSTOM_CMD_LIGHT_ID) ||
+        ((state != CUSTOM_CMD_SYS_AWAKE) && (state != CUSTOM_CMD_SYS_SLEEP)))
+    {
+        return;
+    }
+
+    for (uint8_t valId = CUSTOM_CMD_TEMP_ID; valId <= CUSTOM_CMD_LIGHT_ID; valId++)
+    {
+        if ((target == 0) || (target == valId))
+        {
+            mLeafPowerCtrl[valId] = state;
+        }
+    }
+    debug_printf("\r\nPower %d for leaves: %d\r\n", state, target);
+
+    LeafConfig_Update(target);
+    Settings_Save();
+    CustomData_SendAck(pFrame);
+}
+
+/*! *********************************************************************************
+* \brief        Sets the report interval bounds of one kind of leaf and passes them
+*               on, but only to leaves whose bounds actually change.
+*
+* \param[in]    target      CUSTOM_CMD_TEMP_ID, CUSTOM_CMD_LIGHT_ID or 0 for every leaf.
+* \param[in]    min_sec     Shortest interval, and the sampling period in adaptive mode.
+* \param[in]    max_sec     Longest interval; 0 or up to min_sec keeps it fixed.
+********************************************************************************** */
+static void LeafInterval_Set(uint8_t target, uint32_t min_sec, uint16_t max_sec)
+{
+    for (uint8_t valId = CUSTOM_CMD_TEMP_ID; valId <= CUSTOM_CMD_LIGHT_ID; valId++)
+    {
+        if (((target == 0) || (target == valId)) &&
+            ((mLeafIntervalMin_sec[valId] != min_sec) || (mLeafIntervalMax_sec[valId] != max_sec)))
+        {
+            mLeafIntervalMin_sec[valId] = min_sec;
+            mLeafIntervalMax_sec[valId] = max_sec;
+            LeafConfig_Update(valId);
+        }
+    }
+    Settings_Save();
+}
+
+static void CustomData_HandleIntervalConfig(meshCustomData_t* pFrame)
+{
+    uint8_t target = pFrame->aData[CUSTOM_CMD_INTERVAL_TARGET];
+    uint16_t min_sec;
+    uint16_t max_sec;
+
+    if ((pFrame->dataLength < CUSTOM_CMD_INTERVAL_CONFIG_LEN) || (target > CUSTOM_CMD_LIGHT_ID))
+    {
+        return;
+    }
+
+    min_sec = (uint16_t)((pFrame->aData[CUSTOM_CMD_INTERVAL_MIN_1]<<8) | pFrame->aData[CUSTOM_CMD_INTERVAL_MIN_0]);
+    max_sec = (uint16_t)((pFrame->aData[CUSTOM_CMD_INTERVAL_MAX_1]<<8) | pFrame->aData[CUSTOM_CMD_INTERVAL_MAX_0]);
+    if (min_sec == 0)
+    {
+        return;
+    }
+    debug_printf("\r\nInterval %d to %d for leaves: %d\r\n", min_sec, max_sec, target);
+
+    LeafInterval_Set(target, min_sec, max_sec);
+    CustomData_SendAck(pFrame);
+}
+
+#if gAppRelayAggregation_d
+/*! *********************************************************************************
+* \brief        Forwards held samples by deficit round-robin. Every round each leaf
+*               with samples held earns a frame's worth of bytes and sends while its
+*               next frame fits, so a leaf with a backlog cannot take the cycle's
+*               frames from the others. What the budget leaves waits for the next
+*               cycle, which starts with the leaf that was next in line.
+********************************************************************************** */
+static void CustomReportTimerCallback(void* param)
+{
+    uint8_t budget = mUpstreamBudget_c;
+    uint8_t next = mUpstreamNext;
+    uint8_t length;
+    bool_t held = TRUE;
+
+    while (budget && held)
+    {
+        held = FALSE;
+        for (uint8_t i = 0; (i < mLeafStoreSize_c) && budget; i++)
+        {
+            uint8_t index = (uint8_t)((mUpstreamNext + i) % mLeafStoreSize_c);
+
+            next = (uint8_t)((index + 1) % mLeafStoreSize_c);
+            if (!mLeafStore.aCount[index])
             {
-            	debug_printf("MeshLightServerCallback: Light SET Event Source: %d , Light state: %d\n\r"
-            			,pEvent->eventData.setCommand.source,pEvent->eventData.setCommand.lightState);
-                mLightState = pEvent->eventData.setCommand.lightState;
-                UpdateLightUI(mLightState);
-                RandomLightWait(mAppMaxResponseDelay_ms);
+                mLeafStore.aDeficit[index] = 0;
+                continue;
             }
-            break;
-            
-        case gMeshLightGetReportCommand_c:
+
+            mLeafStore.aDeficit[index] += mUpstreamQuantum_c;
+            while (budget && mLeafStore.aCount[index])
             {
-            	debug_printf("MeshLightServerCallback: GET Report Event Source: %d , Report Intvl: %d\n\r"
-            			,pEvent->eventData.getReportCommand.source,mLightReportInterval_sec);
-                MeshLightServer_SendPeriodicReportState
-                (
-                    pEvent->eventData.getReportCommand.source,
-                    TMR_IsTimerActive(mLightReportTimerId),
-                    mLightReportInterval_sec
-                );
+                length = LeafStore_SendFrame(index, mLeafStore.aDeficit[index]);
+                if (!length)
+                {
+                    break;
+                }
+                mLeafStore.aDeficit[index] -= length;
+                budget--;
             }
-            break;
-            
-        case gMeshLightSetReportCommand_c:
+
+            if (mLeafStore.aCount[index])
             {
-            	debug_printf("MeshLightServerCallback: SET Report Event Source: %d , Enable: %d  Report Intvl: %d\n\r"
-            			,pEvent->eventData.setReportCommand.source,pEvent->eventData.setReportCommand.enable,
-							pEvent->eventData.setReportCommand.intervalSeconds);
-                mLightReportInterval_sec = pEvent->eventData.setReportCommand.intervalSeconds;
-                EnableLightReports(pEvent->eventData.setReportCommand.enable);
-                MeshLightServer_SendPeriodicReportState
-                (
-                    pEvent->eventData.getReportCommand.source,
-                    pEvent->eventData.setReportCommand.enable,
-                    mLightReportInterval_sec
-                );
+                held = TRUE;
             }
-            break;
-            
-        default:
+            else
             {
-                /* Ignore */
+                mLeafStore.aDeficit[index] = 0;
             }
-            break;
+        }
     }
-    return gMeshSuccess_c;
+    mUpstreamNext = next;
 }
-#endif /* gAppLightBulb_d */
 
-#if gAppTempSensor_d
-static meshResult_t MeshTemperatureServerCallback
-(
-    meshTemperatureServerEvent_t* pEvent
-)
+/*! *********************************************************************************
+* \brief        Returns the store slot of a leaf, claiming a free one on first use.
+*
+* \param[in]    id      Leaf node ID, never 0.
+*
+* \return       Slot index, or mLeafStoreSize_c when every slot is taken.
+********************************************************************************** */
+static uint8_t LeafStore_Find(uint8_t id)
 {
-    switch (pEvent->eventType)
+    uint8_t index;
+    uint8_t freeIndex = mLeafStoreSize_c;
+
+    for (index = 0; index < mLeafStoreSize_c; index++)
     {
-        case gMeshTemperatureGetCommand_c:
-            {
-            	int16_t tempCelsius = BOARD_GetTemperature();
-            	debug_printf("MeshTemperatureServerCallback: Temp GET Event Source: %d, Temp = %d\n\r"
-            			,pEvent->eventData.getCommand.source,tempCelsius);
-                MeshTemperatureServer_SendTemperature(pEvent->eventData.getCommand.source, tempCelsius);
-            } 
-            break;
-            
-        case gMeshTemperatureSetReportCommand_c:
-            {
-            	debug_printf("MeshTemperatureServerCallback: SET Report Event Source: %d , Enable: %d  Report Intvl: %d\n\r"
-            			,pEvent->eventData.setReportCommand.source,pEvent->eventData.setReportCommand.enable,
-							pEvent->eventData.setReportCommand.intervalSeconds);
-                mTemperatureReportInterval_sec = pEvent->eventData.setReportCommand.intervalSeconds;
-                EnableTemperatureReports(pEvent->eventData.setReportCommand.enable);
-                MeshTemperatureServer_SendPeriodicReportState
-                (
-                    pEvent->eventData.getReportCommand.source,
-                    pEvent->eventData.setReportCommand.enable,
-                    mTemperatureReportInterval_sec
-                );
-            } 
-            break;
-            
-        case gMeshTemperatureGetReportCommand_c:
-            {
-            	debug_printf("MeshTemperatureServerCallback: GET Report Event Source: %d , Report Intvl: %d\n\r"
-            			,pEvent->eventData.getReportCommand.source,mTemperatureReportInterval_sec);
-                MeshTemperatureServer_SendPeriodicReportState
-                (
-                    pEvent->eventData.getReportCommand.source,
-                    TMR_IsTimerActive(mTemperatureReportTimerId),
-                    mTemperatureReportInterval_sec
-                );
-            } 
-            break;
-            
-        default:
-            {
-                /* Ignore */
-            }
-            break;
+        if (mLeafStore.aId[index] == id)
+        {
+            return index;
+        }
+        if ((mLeafStore.aId[index] == 0) && (freeIndex == mLeafStoreSize_c))
+        {
+            freeIndex = index;
+        }
     }
-    return gMeshSuccess_c;
+
+    if (freeIndex != mLeafStoreSize_c)
+    {
+        mLeafStore.aId[freeIndex] = id;
+        mLeafStore.aCount[freeIndex] = 0;
+        mLeafStore.aDeficit[freeIndex] = 0;
+        mLeafStore.aTokens[freeIndex] = mRateBurst_c;
+        mLeafStore.aRefill_ms[freeIndex] = OSA_TimeGetMsec();
+        /* A newly heard leaf may still run with defaults */
+        mLeafStore.aConfigDirty[freeIndex] = TRUE;
+    }
+    return freeIndex;
 }
-#endif /* gAppTempSensor_d */
 
-/*
-*
-* Report handling functions
+/*! *********************************************************************************
+* \brief        Holds one sample for the next upstream report. A sample that does not
+*               follow the held ones is sent as a new run, and when the store is full
+*               the oldest held sample gives way.
 *
-*/
+* \param[in]    index   Slot returned by LeafStore_Find.
+* \param[in]    valId   CUSTOM_CMD_TEMP_ID or CUSTOM_CMD_LIGHT_ID.
+* \param[in]    seq     Origin sequence number of the sample.
+* \param[in]    value   Reading in the sensor's fixed-point scale.
+********************************************************************************** */
+static void LeafStore_Add(uint8_t index, uint8_t valId, uint8_t seq, int32_t value)
+{
+    uint8_t count = mLeafStore.aCount[index];
 
-#if gAppLightBulb_d
-static void EnableLightReports(bool_t enable)
+    if (count &&
+        ((mLeafStore.aValId[index] != valId) ||
+         ((uint8_t)(mLeafStore.aFirstSeq[index] + count) != seq)))
+    {
+        /* Upstream frames only carry consecutive samples of one sensor */
+        if (IsTimerStarted)
+        {
+            LeafStore_Flush(index);
+        }
+        count = 0;
+    }
+
+    if (count == mBatchMaxSamples_c)
+    {
+        mLinkStats.aShed[mLeafStore.aId[index]]++;
+        count--;
+        mLeafStore.aFirstSeq[index]++;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            mLeafStore.aSamples[index][i] = mLeafStore.aSamples[index][i + 1];
+        }
+    }
+
+    if (count == 0)
+    {
+        mLeafStore.aFirstSeq[index] = seq;
+        mLeafStore.aValId[index] = valId;
+    }
+    mLeafStore.aSamples[index][count] = value;
+    mLeafStore.aCount[index] = count + 1;
+}
+
+/*! *********************************************************************************
+* \brief        Takes a token from a leaf's bucket for a frame just received.
+*
+* \param[in]    index   Slot returned by LeafStore_Find.
+* \param[in]    valId   CUSTOM_CMD_TEMP_ID or CUSTOM_CMD_LIGHT_ID.
+*
+* \return       mRatePass_c, mRateCoalesce_c or mRateShed_c.
+********************************************************************************** */
+static uint8_t LeafStore_Admit(uint8_t index, uint8_t valId)
 {
-    if (enable)
+    uint32_t now_ms = OSA_TimeGetMsec();
+    uint32_t interval_ms = 1000 * mLeafIntervalMin_sec[valId];
+    uint32_t earned = (now_ms - mLeafStore.aRefill_ms[index]) / interval_ms;
+    int32_t tokens = mLeafStore.aTokens[index];
+    uint8_t rate;
+
+    if (earned)
+    {
+        tokens += (earned < mRateBurst_c + mRateDebt_c) ? (int32_t)earned : (mRateBurst_c + mRateDebt_c);
+        mLeafStore.aRefill_ms[index] += earned * interval_ms;
+    }
+    if (tokens >= mRateBurst_c)
+    {
+        /* A full bucket earns nothing until it is used */
+        tokens = mRateBurst_c;
+        mLeafStore.aRefill_ms[index] = now_ms;
+    }
+
+    if (tokens > 0)
     {
-        TMR_StartIntervalTimer
-        (
-            mLightReportTimerId,
-            1000 * mLightReportInterval_sec,
-            LightReportTimerCallback,
-            NULL
-        );
+        rate = mRatePass_c;
+        tokens--;
+    }
+    else if (tokens > -mRateDebt_c)
+    {
+        rate = mRateCoalesce_c;
+        tokens--;
     }
     else
     {
-        TMR_StopTimer(mLightReportTimerId);
+        rate = mRateShed_c;
+    }
+
+    if ((rate != mRatePass_c) && (tokens == -1))
+    {
+        debug_printf("Leaf %d over its rate\r\n", mLeafStore.aId[index]);
     }
+    mLeafStore.aTokens[index] = (int8_t)tokens;
+    return rate;
 }
 
-static void LightReportTimerCallback(void* param)
+/*! *********************************************************************************
+* \brief        Sends the oldest samples held for one leaf to the Comm in one frame.
+*
+* \param[in]    index   Slot returned by LeafStore_Find, with samples held.
+* \param[in]    limit   Longest frame that may be sent.
+*
+* \return       Length of the frame sent, 0 if it would have been longer than limit.
+********************************************************************************** */
+static uint8_t LeafStore_SendFrame(uint8_t index, uint16_t limit)
 {
-    MeshLightServer_PublishState(mLightState);
+    meshCustomData_t* pFrame = &mFrames[mFrameUpstream_c];
+    meshAddress_t destination = CUSTOM_CMD_COMM_ADDR;
+    uint8_t count = mLeafStore.aCount[index];
+    uint16_t stamp;
+    uint8_t packed;
+
+    pFrame->aData[CUSTOM_CMD_ORIGIN] = mLeafStore.aId[index];
+    pFrame->aData[CUSTOM_CMD_VAL_ID] = mLeafStore.aValId[index];
+    pFrame->aData[CUSTOM_CMD_SEQ] = mLeafStore.aFirstSeq[index];
+    pFrame->aData[CUSTOM_CMD_HOP_SEQ] = mUpstreamSeq;
+    packed = CustomData_PackSamples(pFrame, mLeafStore.aSamples[index], count);
+    if (pFrame->dataLength > limit)
+    {
+        return 0;
+    }
+    /* Only the frame carrying the newest sample has a known time */
+    stamp = (packed == count) ? mLeafStore.aStamp[index] : CUSTOM_CMD_STAMP_NONE;
+    Frame_PutU16(pFrame, CUSTOM_CMD_STAMP_0, stamp);
+
+    mUpstreamSeq++;
+    CustomData_Send(destination, pFrame);
+    gEnergyStats.readings += packed;
+    debug_printf("Custom data Sent to: %d origin: %d samples: %d\n\r",
+            GetIdFromMeshAddress(destination), mLeafStore.aId[index], packed);
+
+    count -= packed;
+    mLeafStore.aFirstSeq[index] += packed;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        mLeafStore.aSamples[index][i] = mLeafStore.aSamples[index][i + packed];
+    }
+    mLeafStore.aCount[index] = count;
+    return pFrame->dataLength;
 }
 
-static void RandomLightWait(uint32_t maxMs)
+/*! *********************************************************************************
+* \brief        Sends all samples held for one leaf to the Comm.
+*
+* \param[in]    index   Slot returned by LeafStore_Find.
+********************************************************************************** */
+static void LeafStore_Flush(uint8_t index)
 {
-    uint16_t random;
-    RNG_GetPseudoRandomNo((uint8_t*) &random, 2, NULL);
-    
-    uint32_t interval_ms = (uint32_t) random * maxMs / 0x0000ffff;
-    
-    TMR_StartSingleShotTimer(mLightRandomWaitTimerId, interval_ms, LightReportTimerCallback, NULL);
+    while (mLeafStore.aCount[index])
+    {
+        LeafStore_SendFrame(index, gMeshMaxAppCustomDataSize_c);
+    }
+}
+
+/*! *********************************************************************************
+* \brief        Sends one link report frame to the Comm for every leaf heard so far.
+*
+********************************************************************************** */
+static void LinkStats_Report(void)
+{
+    uint8_t* pMessage = Segment_GetTxBuffer();
+    uint16_t length = 0;
+
+    if (!pMessage)
+    {
+        debug_printf("Link report skipped, segment transfer busy\r\n");
+        return;
+    }
+
+    pMessage[length++] = CUSTOM_CMD_LINK_REPORT;
+    for (uint16_t id = 0; id < mLinkStatsSize_c; id++)
+    {
+        if (!mLinkStats.aReceived[id])
+        {
+            continue;
+        }
+        if (length + CUSTOM_CMD_LINK_RECORD_LEN > mSegMaxMessage_c)
+        {
+            break;
+        }
+        pMessage[length + CUSTOM_CMD_LINK_NODE] = (uint8_t)id;
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_RX_0], &mLinkStats.aReceived[id], sizeof(uint16_t));
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_LOST_0], &mLinkStats.aLost[id], sizeof(uint16_t));
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_REORDER_0], &mLinkStats.aReordered[id], sizeof(uint16_t));
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_DUP_0], &mLinkStats.aDuplicate[id], sizeof(uint16_t));
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_SHED_0], &mLinkStats.aShed[id], sizeof(uint16_t));
+        FLib_MemCpy(&pMessage[length + CUSTOM_CMD_LINK_COALESCED_0], &mLinkStats.aCoalesced[id], sizeof(uint16_t));
+        length += CUSTOM_CMD_LINK_RECORD_LEN;
+    }
+
+    Segment_Send(CUSTOM_CMD_COMM_ADDR, 0, length);
+}
+#endif
+
+/*! *********************************************************************************
+* \brief        Applies the stored configuration, if there is one of this layout.
+*
+* \return       TRUE if a record was applied.
+********************************************************************************** */
+static bool_t Settings_Load(void)
+{
+    settings_t record;
+
+    if (!Settings_Read(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        return FALSE;
+    }
+    Settings_Apply(&record);
+    return TRUE;
 }
 
-static void UpdateLightUI(bool_t lightOn)
+/* Stores the current configuration, after a change */
+static void Settings_Save(void)
+{
+    settings_t record;
+
+    FLib_MemSet(&record, 0, sizeof(record));
+    Settings_Capture(&record);
+    if (!Settings_Write(&record.header, sizeof(record), mSettingsVersion_c))
+    {
+        debug_printf("Settings write failed\r\n");
+    }
+}
+
+static void Settings_Capture(settings_t* pRecord)
+{
+    pRecord->streaming = IsTimerStarted;
+    pRecord->commReportInterval_sec = mCommReportInterval_sec;
+    FLib_MemCpy(pRecord->aLeafIntervalMin_sec, mLeafIntervalMin_sec, sizeof(mLeafIntervalMin_sec));
+    FLib_MemCpy(pRecord->aLeafIntervalMax_sec, mLeafIntervalMax_sec, sizeof(mLeafIntervalMax_sec));
+    FLib_MemCpy(pRecord->aLeafPowerCtrl, mLeafPowerCtrl, sizeof(mLeafPowerCtrl));
+}
+
+static void Settings_Apply(settings_t* pRecord)
+{
+    mResumeReports = pRecord->streaming && pRecord->commReportInterval_sec;
+    mCommReportInterval_sec = pRecord->commReportInterval_sec;
+    FLib_MemCpy(mLeafIntervalMin_sec, pRecord->aLeafIntervalMin_sec, sizeof(mLeafIntervalMin_sec));
+    FLib_MemCpy(mLeafIntervalMax_sec, pRecord->aLeafIntervalMax_sec, sizeof(mLeafIntervalMax_sec));
+    FLib_MemCpy(mLeafPowerCtrl, pRecord->aLeafPowerCtrl, sizeof(mLeafPowerCtrl));
+    debug_printf("Settings restored: upstream every %d s, reports %s\r\n",
+            mCommReportInterval_sec, mResumeReports ? "on" : "off");
+}
+
+/*! *********************************************************************************
+* \brief        Brings the energy accounting up to date. The relay never sleeps, so
+*               all of its uptime counts as awake.
+********************************************************************************** */
+void Power_Update(void)
+{
+    gEnergyStats.awake_ms = OSA_TimeGetMsec();
+}
+
+/*
+*
+* Report handling functions
+*
+*/
+
+#if gAppLightBulb_d
+void UpdateLightUI(bool_t lightOn)
 {
     /* Insert code here to update UI to indicate Light State ON/OFF. */
 
@@ -735,32 +1211,6 @@ static void UpdateLightUI(bool_t lightOn)
 }
 #endif /* gAppLightBulb_d */
 
-#if gAppTempSensor_d
-static void EnableTemperatureReports(bool_t enable)
-{
-    if (enable)
-    {
-        TMR_StartIntervalTimer
-        (
-            mTemperatureReportTimerId,
-            1000 * mTemperatureReportInterval_sec,
-            TemperatureReportTimerCallback,
-            NULL
-        );
-    }
-    else
-    {
-        TMR_StopTimer(mTemperatureReportTimerId);
-    }
-}
-static void TemperatureReportTimerCallback(void* param)
-{
-    int16_t tempCelsius = BOARD_GetTemperature();
-    MeshTemperatureServer_PublishTemperature(tempCelsius);
-}
-
-#endif /* gAppTempSensor_d */
-
 /*! *********************************************************************************
 * @}
 ********************************************************************************** */
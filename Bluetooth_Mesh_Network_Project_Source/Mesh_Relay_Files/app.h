@@ -57,6 +57,9 @@
 #define gAppLightBulb_d         1
 #define gAppTempSensor_d        1
 
+/* Temperature GET replies are served from a cached sample up to this old */
+#define gAppTempMaxAge_ms       2000
+
 /* Consistency check */
 #if gAppLightSwitch_d && gAppLightBulb_d
 #error "Please define only one of the light roles!"
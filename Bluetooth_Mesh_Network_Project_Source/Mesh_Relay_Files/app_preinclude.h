@@ -67,7 +67,7 @@
          _block_size_ 512  _number_of_blocks_    4 _eol_
 
 /* Defines number of timers needed by the application */
-#define gTmrApplicationTimers_c         7
+#define gTmrApplicationTimers_c         3   /* one per TMR_AllocateTimer in app.c */
 
 /* Defines number of timers needed by the protocol stack */
 #define gTmrStackTimers_c               5
@@ -123,6 +123,23 @@
 /* Defines total heap size used by the OS */
 #define gTotalHeapSize_c        8000
            
+/*! *********************************************************************************
+ * 	Application role
+ ********************************************************************************** */
+
+/* Node role; selects the parts of Mesh_Node_Files/node_common.c that a role builds,
+   see node_common.h */
+#define gAppRoleComm_c                  0
+#define gAppRoleLeaf_c                  1
+#define gAppRoleRelay_c                 2
+#define gAppRole_d                      gAppRoleRelay_c
+
+/* 1 to hold leaf reports and forward them to the Comm, 0 for a relay that only
+   repeats mesh traffic; the aggregation code is then left out of the image */
+#ifndef gAppRelayAggregation_d
+#define gAppRelayAggregation_d          1
+#endif
+
 /*! *********************************************************************************
  * 	BLE Stack Configuration
  ********************************************************************************** */